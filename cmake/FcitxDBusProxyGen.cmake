@@ -0,0 +1,65 @@
+# fcitx_add_dbus_interface(<sources> <interface.xml> <basename>)
+#
+# Drop-in replacement for qt5_add_dbus_interface that generates the proxy with
+# fcitx-dbusproxygen. Only the private proxies of the input context plugin use
+# it, the public FcitxQt5DBusAddons proxies stay checked in. The INCLUDE, CLASSNAME and NO_NAMESPACE source file
+# properties of the xml file work the same way, EXPORT_MACRO adds the given
+# export macro to the class.
+# fcitx_add_dbusproxygen(<directory>)
+#
+# Provides the fcitx-dbusproxygen target. The generator runs on the build
+# machine, so when cross compiling it is looked up on the host instead of
+# being built from <directory>.
+function(fcitx_add_dbusproxygen _directory)
+    if (TARGET fcitx-dbusproxygen)
+        return()
+    endif()
+    if (CMAKE_CROSSCOMPILING)
+        find_program(FCITX_DBUSPROXYGEN_EXECUTABLE fcitx-dbusproxygen)
+        if (NOT FCITX_DBUSPROXYGEN_EXECUTABLE)
+            message(FATAL_ERROR "fcitx-dbusproxygen for the build host is "
+                                "needed when cross compiling, set "
+                                "FCITX_DBUSPROXYGEN_EXECUTABLE to its path")
+        endif()
+        add_executable(fcitx-dbusproxygen IMPORTED GLOBAL)
+        set_target_properties(fcitx-dbusproxygen PROPERTIES
+            IMPORTED_LOCATION "${FCITX_DBUSPROXYGEN_EXECUTABLE}")
+    else()
+        add_subdirectory(${_directory})
+    endif()
+endfunction()
+
+function(fcitx_add_dbus_interface _sources _interface _basename)
+    get_filename_component(_infile ${_interface} ABSOLUTE)
+    set(_header "${CMAKE_CURRENT_BINARY_DIR}/${_basename}.h")
+    set(_impl "${CMAKE_CURRENT_BINARY_DIR}/${_basename}.cpp")
+
+    get_source_file_property(_nonamespace ${_interface} NO_NAMESPACE)
+    get_source_file_property(_classname ${_interface} CLASSNAME)
+    get_source_file_property(_include ${_interface} INCLUDE)
+    get_source_file_property(_exportmacro ${_interface} EXPORT_MACRO)
+
+    set(_params)
+    if (_nonamespace)
+        list(APPEND _params -N)
+    endif()
+    if (_classname)
+        list(APPEND _params -c ${_classname})
+    endif()
+    if (_exportmacro)
+        list(APPEND _params -e ${_exportmacro})
+    endif()
+    if (_include)
+        foreach(_file ${_include})
+            list(APPEND _params -i ${_file})
+        endforeach()
+    endif()
+
+    add_custom_command(OUTPUT "${_impl}" "${_header}"
+                       COMMAND fcitx-dbusproxygen ${_params}
+                               -p "${CMAKE_CURRENT_BINARY_DIR}/${_basename}"
+                               ${_infile}
+                       DEPENDS ${_infile} fcitx-dbusproxygen
+                       VERBATIM)
+    set(${_sources} ${${_sources}} "${_impl}" "${_header}" PARENT_SCOPE)
+endfunction()
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxbenchmark.h"
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QInputMethodEvent>
+#include <QInputMethodQueryEvent>
+#include <QKeyEvent>
+#include <QPluginLoader>
+#include <QTimer>
+#include <QtPlugin>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qplatforminputcontextfactory_p.h>
+#include <qpa/qplatforminputcontextplugin_p.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef FCITX_STATIC_PLUGIN
+Q_IMPORT_PLUGIN(QFcitxPlatformInputContextPlugin)
+#endif
+
+namespace {
+
+const char busConfig[] =
+    "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus "
+    "Configuration 1.0//EN\"\n"
+    " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+    "<busconfig>\n"
+    "  <type>session</type>\n"
+    "  <listen>unix:path=%1</listen>\n"
+    "  <auth>EXTERNAL</auth>\n"
+    "  <policy context=\"default\">\n"
+    "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+    "    <allow eavesdrop=\"true\"/>\n"
+    "    <allow own=\"*\"/>\n"
+    "  </policy>\n"
+    "  <limit name=\"max_connections_per_user\">100000</limit>\n"
+    "  <limit name=\"max_completed_connections\">100000</limit>\n"
+    "  <limit name=\"max_incomplete_connections\">10000</limit>\n"
+    "  <limit name=\"max_match_rules_per_connection\">50000</limit>\n"
+    "</busconfig>\n";
+
+const char benchmarkConnection[] = "fcitx-benchmark";
+
+int qtKeyFromKeysym(uint keysym) {
+    switch (keysym) {
+    case 0xff08:
+        return Qt::Key_Backspace;
+    case 0xff0d:
+        return Qt::Key_Return;
+    case 0xff1b:
+        return Qt::Key_Escape;
+    case 0xffe1:
+        return Qt::Key_Shift;
+    }
+    if (keysym < 0x100) {
+        return QChar(keysym).toUpper().unicode();
+    }
+    return 0;
+}
+
+} // namespace
+
+FcitxBenchmarkBus::FcitxBenchmarkBus() {
+    m_stub.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+}
+
+FcitxBenchmarkBus::~FcitxBenchmarkBus() {
+    stopStub();
+    QDBusConnection::disconnectFromBus(benchmarkConnection);
+    if (m_daemonPid > 0) {
+        kill(m_daemonPid, SIGTERM);
+    }
+}
+
+bool FcitxBenchmarkBus::start() {
+    if (!m_dir.isValid()) {
+        return false;
+    }
+    const QString configPath = m_dir.filePath("bus.conf");
+    QFile config(configPath);
+    if (!config.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    config.write(QString(busConfig).arg(m_dir.filePath("bus")).toUtf8());
+    config.close();
+
+    // Forked before QGuiApplication might connect anywhere, so popen and
+    // not QProcess.
+    const QByteArray command =
+        "dbus-daemon --fork --print-address=1 --print-pid=1 "
+        "--config-file='" +
+        QFile::encodeName(configPath) + "'";
+    FILE *output = popen(command.constData(), "r");
+    if (!output) {
+        return false;
+    }
+    char address[1024] = {0};
+    char pid[64] = {0};
+    const bool ok = fgets(address, sizeof(address), output) &&
+                    fgets(pid, sizeof(pid), output);
+    pclose(output);
+    if (!ok) {
+        return false;
+    }
+    m_address = QString::fromLocal8Bit(address).trimmed();
+    m_daemonPid = QByteArray(pid).trimmed().toLongLong();
+
+    QDir(m_dir.path()).mkpath("config");
+    QDir(m_dir.path()).mkpath("runtime");
+    qputenv("DBUS_SESSION_BUS_ADDRESS", m_address.toLocal8Bit());
+    qputenv("XDG_CONFIG_HOME", QFile::encodeName(m_dir.filePath("config")));
+    qputenv("XDG_RUNTIME_DIR", QFile::encodeName(m_dir.filePath("runtime")));
+    qunsetenv("FCITX_DBUS_ADDRESS");
+    qunsetenv("FCITX_DBUS_PEER_ADDRESS");
+    qunsetenv("FCITX_QT_POLICY_FILE");
+    return !m_address.isEmpty() && m_daemonPid > 0;
+}
+
+QDBusConnection FcitxBenchmarkBus::connection() const {
+    return QDBusConnection::connectToBus(m_address, benchmarkConnection);
+}
+
+bool FcitxBenchmarkBus::startStub(const QString &program,
+                                  const QStringList &arguments) {
+    stopStub();
+    m_stub.start(program, arguments);
+    if (!m_stub.waitForStarted()) {
+        return false;
+    }
+    while (!m_stub.canReadLine()) {
+        if (!m_stub.waitForReadyRead(5000)) {
+            stopStub();
+            return false;
+        }
+    }
+    m_stubService = QString::fromUtf8(m_stub.readLine()).trimmed();
+    return true;
+}
+
+void FcitxBenchmarkBus::stopStub() {
+    if (m_stub.state() == QProcess::NotRunning) {
+        return;
+    }
+    m_stub.kill();
+    m_stub.waitForFinished();
+    // Let the im module see the name go away.
+    fcitxWaitFor(
+        [this]() {
+            return !connection().interface()->isServiceRegistered(
+                m_stubService);
+        },
+        1000);
+}
+
+QVariantMap FcitxBenchmarkBus::stubStats() const {
+    QDBusReply<QVariantMap> reply =
+        connection().call(QDBusMessage::createMethodCall(
+            m_stubService, "/stub", "org.fcitx.Fcitx.Stub", "Stats"));
+    return reply.value();
+}
+
+QList<uint> FcitxBenchmarkBus::stubKeys() const {
+    QDBusReply<QList<uint>> reply =
+        connection().call(QDBusMessage::createMethodCall(
+            m_stubService, "/stub", "org.fcitx.Fcitx.Stub", "Keys"));
+    return reply.value();
+}
+
+void FcitxBenchmarkBus::resetStubStats() const {
+    connection().call(QDBusMessage::createMethodCall(
+        m_stubService, "/stub", "org.fcitx.Fcitx.Stub", "ResetStats"));
+}
+
+qint64 FcitxBenchmarkBus::busCpuTime() const {
+    return fcitxCpuTime(m_daemonPid);
+}
+
+FcitxBenchmarkWindow::FcitxBenchmarkWindow(QWindow *parent)
+    : QWindow(parent) {
+    resize(320, 240);
+}
+
+bool FcitxBenchmarkWindow::activate() {
+    show();
+    requestActivate();
+    return fcitxWaitFor(
+        [this]() { return QGuiApplication::focusWindow() == this; }, 1000);
+}
+
+bool FcitxBenchmarkWindow::event(QEvent *event) {
+    switch (event->type()) {
+    case QEvent::InputMethodQuery: {
+        auto query = static_cast<QInputMethodQueryEvent *>(event);
+        const Qt::InputMethodQueries queries = query->queries();
+        if (queries & Qt::ImEnabled) {
+            query->setValue(Qt::ImEnabled, m_enabled);
+        }
+        if (queries & Qt::ImHints) {
+            query->setValue(Qt::ImHints, int(m_hints));
+        }
+        if (queries & Qt::ImCursorRectangle) {
+            query->setValue(Qt::ImCursorRectangle, QRect(10, 10, 1, 16));
+        }
+        if (queries & Qt::ImSurroundingText) {
+            query->setValue(Qt::ImSurroundingText, m_text);
+        }
+        if (queries & Qt::ImCursorPosition) {
+            query->setValue(Qt::ImCursorPosition,
+                            m_cursor < 0 ? m_text.size() : m_cursor);
+        }
+        if (queries & Qt::ImAnchorPosition) {
+            query->setValue(Qt::ImAnchorPosition,
+                            m_anchor < 0 ? m_text.size() : m_anchor);
+        }
+        query->accept();
+        return true;
+    }
+    case QEvent::InputMethod: {
+        auto inputMethod = static_cast<QInputMethodEvent *>(event);
+        if (!inputMethod->commitString().isEmpty()) {
+            m_commits++;
+            m_text += inputMethod->commitString();
+            m_cursor = m_anchor = -1;
+        } else {
+            m_preedits++;
+        }
+        event->accept();
+        return true;
+    }
+    default:
+        break;
+    }
+    return QWindow::event(event);
+}
+
+void FcitxBenchmarkWindow::setSurroundingText(const QString &text,
+                                              int cursor, int anchor) {
+    m_text = text;
+    m_cursor = cursor;
+    m_anchor = anchor;
+}
+
+void FcitxBenchmarkWindow::keyPressEvent(QKeyEvent *event) {
+    m_keys++;
+    event->accept();
+}
+
+QPlatformInputContext *fcitxCreateInputContext(const QString &path) {
+    if (path.isEmpty()) {
+        return QPlatformInputContextFactory::create(QStringLiteral("fcitx"));
+    }
+    QPluginLoader loader(path);
+    auto plugin =
+        qobject_cast<QPlatformInputContextPlugin *>(loader.instance());
+    if (!plugin) {
+        fprintf(stderr, "%s\n", qPrintable(loader.errorString()));
+        return nullptr;
+    }
+    return plugin->create(QStringLiteral("fcitx"), QStringList());
+}
+
+bool fcitxWaitFor(const std::function<bool()> &condition, int timeout) {
+    // Only there to wake the loop up at the deadline.
+    QTimer deadline;
+    deadline.setSingleShot(true);
+    deadline.start(timeout);
+    bool result;
+    while (!(result = condition()) && deadline.isActive()) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    return result;
+}
+
+bool fcitxSendKey(QPlatformInputContext *context, uint keysym, bool isRelease,
+                  uint state, uint keycode, bool isAutoRepeat) {
+    // Same bits as FcitxKeyState.
+    Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+    if (state & (1 << 0)) {
+        modifiers |= Qt::ShiftModifier;
+    }
+    if (state & (1 << 2)) {
+        modifiers |= Qt::ControlModifier;
+    }
+    if (state & (1 << 3)) {
+        modifiers |= Qt::AltModifier;
+    }
+    const bool printable = keysym >= 0x20 && keysym < 0x100 &&
+                           !(modifiers & (Qt::ControlModifier |
+                                          Qt::AltModifier));
+    const QString text = printable ? QString(QChar(keysym)) : QString();
+    QKeyEvent event(isRelease ? QEvent::KeyRelease : QEvent::KeyPress,
+                    qtKeyFromKeysym(keysym), modifiers, keycode, keysym,
+                    state, text, isAutoRepeat);
+    if (context->filterEvent(&event)) {
+        return true;
+    }
+    if (QWindow *window = QGuiApplication::focusWindow()) {
+        QCoreApplication::sendEvent(window, &event);
+    }
+    return false;
+}
+
+qint64 fcitxCpuTime(qint64 pid) {
+    if (pid == 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return (static_cast<qint64>(usage.ru_utime.tv_sec) +
+                usage.ru_stime.tv_sec) *
+                   1000000000 +
+               (static_cast<qint64>(usage.ru_utime.tv_usec) +
+                usage.ru_stime.tv_usec) *
+                   1000;
+    }
+    QFile stat(QString("/proc/%1/stat").arg(pid));
+    if (!stat.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    // utime and stime are the 14th and 15th fields, the second one may
+    // contain spaces but ends with the last ')'.
+    const QByteArray line = stat.readAll();
+    const QList<QByteArray> fields =
+        line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13) {
+        return 0;
+    }
+    const qint64 ticks = fields[11].toLongLong() + fields[12].toLongLong();
+    return ticks * 1000000000 / sysconf(_SC_CLK_TCK);
+}
+
+qint64 fcitxPercentile(std::vector<qint64> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
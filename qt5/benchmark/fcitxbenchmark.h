@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#ifndef FCITXBENCHMARK_H_
+#define FCITXBENCHMARK_H_
+
+#include <QDBusConnection>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QVariantMap>
+#include <QWindow>
+#include <functional>
+#include <vector>
+
+class QPlatformInputContext;
+
+// A dbus-daemon of the benchmark's own, with the stub daemon on it.
+class FcitxBenchmarkBus {
+public:
+    FcitxBenchmarkBus();
+    ~FcitxBenchmarkBus();
+
+    // Start dbus-daemon and point this process and its children to it, and
+    // move XDG_CONFIG_HOME and XDG_RUNTIME_DIR to a temporary directory so
+    // that neither a running fcitx nor a policy file is picked up. Has to
+    // happen before anything connects to the session bus.
+    bool start();
+    const QString &address() const { return m_address; }
+    // A connection of its own, so the stub sees only the im module traffic.
+    QDBusConnection connection() const;
+
+    // Start fcitx-stub-daemon and wait until it owns its name.
+    bool startStub(const QString &program, const QStringList &arguments);
+    void stopStub();
+    qint64 stubPid() const { return m_stub.processId(); }
+    const QString &stubService() const { return m_stubService; }
+    // Counters of org.fcitx.Fcitx.Stub.
+    QVariantMap stubStats() const;
+    void resetStubStats() const;
+    // Keys the stub received since resetStubStats, see
+    // FcitxStubDaemon::KeyLogSize.
+    QList<uint> stubKeys() const;
+
+    // CPU time of dbus-daemon in nanoseconds.
+    qint64 busCpuTime() const;
+
+private:
+    QTemporaryDir m_dir;
+    QString m_address;
+    qint64 m_daemonPid = 0;
+    QProcess m_stub;
+    QString m_stubService;
+};
+
+// Takes the focus and answers input method queries like a text field, empty
+// unless told otherwise, counting what the im module delivers to it.
+class FcitxBenchmarkWindow : public QWindow {
+    Q_OBJECT
+public:
+    explicit FcitxBenchmarkWindow(QWindow *parent = nullptr);
+
+    // Show, activate and wait until it is the focus window.
+    bool activate();
+
+    int commits() const { return m_commits; }
+    int preedits() const { return m_preedits; }
+    int keys() const { return m_keys; }
+    // Input method events and key events, whatever answers a key.
+    int responses() const { return m_commits + m_preedits + m_keys; }
+    const QString &text() const { return m_text; }
+    // Cursor and anchor -1 are the end of text.
+    void setSurroundingText(const QString &text, int cursor, int anchor);
+    void setHints(Qt::InputMethodHints hints) { m_hints = hints; }
+    void setInputMethodEnabled(bool enabled) { m_enabled = enabled; }
+
+    bool event(QEvent *event) override;
+
+protected:
+    void keyPressEvent(QKeyEvent *event) override;
+
+private:
+    int m_commits = 0;
+    int m_preedits = 0;
+    int m_keys = 0;
+    QString m_text;
+    int m_cursor = -1;
+    int m_anchor = -1;
+    Qt::InputMethodHints m_hints = Qt::ImhNone;
+    bool m_enabled = true;
+};
+
+// Create the fcitx input context from the im module at path, or from the
+// static plugin if the benchmark is linked with it.
+QPlatformInputContext *fcitxCreateInputContext(const QString &path);
+
+// Run the event loop until condition returns true or timeout milliseconds
+// passed, returns the last value of condition.
+bool fcitxWaitFor(const std::function<bool()> &condition, int timeout);
+
+// Deliver a press or release of a keysym to the input context, and to the
+// focus window if the input context doesn't filter it, like QGuiApplication
+// does. Only Latin 1 and a few function keys get a Qt key.
+bool fcitxSendKey(QPlatformInputContext *context, uint keysym, bool isRelease,
+                  uint state = 0, uint keycode = 0, bool isAutoRepeat = false);
+
+// CPU time of this process or pid in nanoseconds.
+qint64 fcitxCpuTime(qint64 pid = 0);
+
+// p in [0, 1], values doesn't need to be sorted.
+qint64 fcitxPercentile(std::vector<qint64> values, double p);
+
+#endif // FCITXBENCHMARK_H_
@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxstubdaemon.h"
+#include "fcitxqtdbustypes.h"
+#include "fcitxshmtransport.h"
+#include <QDBusMetaType>
+#include <QDBusObjectPath>
+#include <QDBusUnixFileDescriptor>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <algorithm>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char imPath[] = "/org/freedesktop/portal/inputmethod";
+const char imInterface[] = "org.fcitx.Fcitx.InputMethod1";
+const char icPathPrefix[] = "/org/freedesktop/portal/inputcontext/";
+const char icInterface[] = "org.fcitx.Fcitx.InputContext1";
+const char im4Path[] = "/inputmethod";
+const char im4Interface[] = "org.fcitx.Fcitx.InputMethod";
+const char ic4PathPrefix[] = "/inputcontext_";
+const char ic4Interface[] = "org.fcitx.Fcitx.InputContext";
+const char stubPath[] = "/stub";
+const char stubInterface[] = "org.fcitx.Fcitx.Stub";
+const char introspectableInterface[] = "org.freedesktop.DBus.Introspectable";
+
+const uint XK_BackSpace = 0xff08;
+const uint XK_Return = 0xff0d;
+// ControlMask | Mod1Mask
+const uint ShortcutState = (1 << 2) | (1 << 3);
+// Underline in both fcitx 4 and 5.
+const qint32 PreeditFormat = 1 << 3;
+
+// Same as displayNumber() in fcitxwatcher.cpp.
+int displayNumber() {
+    QByteArray display(qgetenv("DISPLAY"));
+    int pos = display.indexOf(':');
+    if (pos < 0) {
+        return 0;
+    }
+    ++pos;
+    int pos2 = display.indexOf('.', pos);
+    bool ok;
+    int d = (pos2 > 0 ? display.mid(pos, pos2 - pos) : display.mid(pos))
+                .toInt(&ok);
+    return ok ? d : 0;
+}
+
+qint64 cpuTime() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<qint64>(usage.ru_utime.tv_sec) +
+            usage.ru_stime.tv_sec) *
+               1000000000 +
+           (static_cast<qint64>(usage.ru_utime.tv_usec) +
+            usage.ru_stime.tv_usec) *
+               1000;
+}
+
+// Whether count reached sequence, the counters may wrap around.
+bool reached(quint32 count, quint32 sequence) {
+    return static_cast<qint32>(sequence - count) <= 0;
+}
+
+FcitxShmRing *mapRing(int fd, size_t *bytes) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(FcitxShmRing)) {
+        return nullptr;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    *bytes = st.st_size;
+    return static_cast<FcitxShmRing *>(data);
+}
+
+// Records that fit into a ring of bytes.
+quint32 ringCapacity(size_t bytes) {
+    return (bytes - sizeof(FcitxShmRing)) / sizeof(FcitxShmRecord) + 1;
+}
+
+} // namespace
+
+// The rings of an input context, in is written by the client. calls and
+// signalCount are counted from SetupSharedMemoryTransport on.
+struct FcitxStubDaemon::SharedMemory {
+    ~SharedMemory() {
+        // It may be the one being handled.
+        if (notifier) {
+            notifier->setEnabled(false);
+            notifier->deleteLater();
+        }
+        if (in) {
+            munmap(in, inBytes);
+        }
+        if (out) {
+            munmap(out, outBytes);
+        }
+        for (int fd : {inEventFd, outEventFd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    FcitxShmRing *in = nullptr;
+    FcitxShmRing *out = nullptr;
+    size_t inBytes = 0;
+    size_t outBytes = 0;
+    quint32 inSize = 0;
+    quint32 outSize = 0;
+    int inEventFd = -1;
+    int outEventFd = -1;
+    QSocketNotifier *notifier = nullptr;
+    quint32 calls = 0;
+    quint32 signalCount = 0;
+};
+
+// The (a(si)i) payload of FcitxInputContextEvent::UpdatePreedit.
+struct FcitxStubPreedit {
+    FcitxFormattedPreeditText text;
+    int cursor = 0;
+};
+Q_DECLARE_METATYPE(FcitxStubPreedit)
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxStubPreedit &preedit) {
+    argument.beginStructure();
+    argument << preedit.text << preedit.cursor;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxStubPreedit &preedit) {
+    argument.beginStructure();
+    argument >> preedit.text >> preedit.cursor;
+    argument.endStructure();
+    return argument;
+}
+
+FcitxStubDaemon::FcitxStubDaemon(const QDBusConnection &connection,
+                                 const Options &options, QObject *parent)
+    : QDBusVirtualObject(parent), m_connection(connection),
+      m_options(options) {
+    FcitxFormattedPreedit::registerMetaType();
+    FcitxFormattedPreeditText::registerMetaType();
+    FcitxInputContextArgument::registerMetaType();
+    FcitxInputContextEvent::registerMetaType();
+    qDBusRegisterMetaType<FcitxStubPreedit>();
+}
+
+FcitxStubDaemon::~FcitxStubDaemon() {
+    m_connection.unregisterService(service());
+    m_connection.unregisterObject("/", QDBusConnection::UnregisterTree);
+}
+
+bool FcitxStubDaemon::start() {
+    return m_connection.registerVirtualObject("/", this,
+                                              QDBusConnection::SubPath) &&
+           m_connection.registerService(service());
+}
+
+QString FcitxStubDaemon::service() const {
+    if (m_options.fcitx4) {
+        return QString("org.fcitx.Fcitx-%1").arg(displayNumber());
+    }
+    return QStringLiteral("org.freedesktop.portal.Fcitx");
+}
+
+QString FcitxStubDaemon::introspect(const QString &path) const {
+    if (path == (m_options.fcitx4 ? im4Path : imPath)) {
+        return m_options.fcitx4
+                   ? QStringLiteral(
+                         "<interface name=\"org.fcitx.Fcitx.InputMethod\">"
+                         "<method name=\"CreateICv3\"/></interface>")
+                   : QStringLiteral(
+                         "<interface name=\"org.fcitx.Fcitx.InputMethod1\">"
+                         "<method name=\"CreateInputContext\"/></interface>");
+    }
+    if (!m_ics.contains(path)) {
+        return QString();
+    }
+    QString xml = QString("<interface name=\"%1\">"
+                          "<method name=\"ProcessKeyEvent\"/>")
+                      .arg(m_options.fcitx4 ? ic4Interface : icInterface);
+    if (!m_options.fcitx4 && m_options.batch) {
+        xml += "<method name=\"ProcessKeyEventBatch\"/>";
+    }
+    if (!m_options.fcitx4 && m_options.releaseInterest) {
+        xml += "<method name=\"GetKeyReleaseInterest\"/>";
+    }
+    if (!m_options.fcitx4 && m_options.sharedMemory) {
+        xml += "<method name=\"SetupSharedMemoryTransport\"/>";
+    }
+    xml += "</interface>";
+    return xml;
+}
+
+bool FcitxStubDaemon::handleMessage(const QDBusMessage &message,
+                                    const QDBusConnection &connection) {
+    Q_UNUSED(connection);
+    if (message.type() != QDBusMessage::MethodCallMessage) {
+        return false;
+    }
+    const QString path = message.path();
+    if (path == stubPath && message.interface() == stubInterface) {
+        handleStub(message);
+        return true;
+    }
+    if (message.interface() == introspectableInterface) {
+        sendReply(message, {QString("<node>%1</node>").arg(introspect(path))});
+        return true;
+    }
+    m_calls++;
+    if (path == (m_options.fcitx4 ? im4Path : imPath)) {
+        handleInputMethod(message);
+        return true;
+    }
+    if (m_ics.contains(path)) {
+        // The records written before the call was sent go first, and those
+        // written after it wait until it's counted.
+        processSharedMemory(path);
+        handleInputContext(message);
+        auto iter = m_ics.find(path);
+        if (iter != m_ics.end() && iter->shm &&
+            message.interface() == icInterface &&
+            message.member() != "SetupSharedMemoryTransport") {
+            iter->shm->calls++;
+            processSharedMemory(path);
+        }
+        return true;
+    }
+    m_calls--;
+    return false;
+}
+
+void FcitxStubDaemon::handleInputMethod(const QDBusMessage &message) {
+    const QString member = message.member();
+    if (m_options.fcitx4 && member == "CreateICv3") {
+        const int id = ++m_icId;
+        m_ics.insert(QString("%1%2").arg(ic4PathPrefix).arg(id),
+                     InputContext());
+        m_created++;
+        sendReply(message, {id, true, 0u, 0u, 0u, 0u});
+    } else if (!m_options.fcitx4 && member == "CreateInputContext") {
+        const QString path = QString("%1%2").arg(icPathPrefix).arg(++m_icId);
+        m_ics.insert(path, InputContext());
+        m_created++;
+        sendReply(message, {QVariant::fromValue(QDBusObjectPath(path)),
+                            QByteArray(16, 0)});
+    } else {
+        send(message.createErrorReply(QDBusError::UnknownMethod, member));
+    }
+}
+
+void FcitxStubDaemon::handleInputContext(const QDBusMessage &message) {
+    const QString member = message.member();
+    const QList<QVariant> args = message.arguments();
+    if (member == "ProcessKeyEvent" ||
+        (member == "ProcessKeyEventBatch" && m_options.batch &&
+         !m_options.fcitx4)) {
+        m_keys++;
+        if (args.size() < 4) {
+            send(message.createErrorReply(QDBusError::InvalidArgs, member));
+            return;
+        }
+        if (args[3].toBool()) {
+            m_releases++;
+        }
+        // fcitx 4 has 1 as release type, fcitx 5 a boolean.
+        KeyResult result =
+            processKey(m_ics[message.path()], args[0].toUInt(),
+                       args[2].toUInt(), args[3].toBool());
+        finishKey(message, result, member == "ProcessKeyEventBatch");
+    } else if (member == "GetKeyReleaseInterest" &&
+               m_options.releaseInterest && !m_options.fcitx4) {
+        sendReply(message, {QVariant::fromValue(QList<uint>()), true});
+    } else if (member == "SetupSharedMemoryTransport" &&
+               m_options.sharedMemory && !m_options.fcitx4) {
+        auto shm = attachSharedMemory(args);
+        if (!shm) {
+            send(message.createErrorReply(QDBusError::InvalidArgs, member));
+            return;
+        }
+        m_ics[message.path()].shm = shm;
+        sendReply(message);
+    } else if (member == "DestroyIC") {
+        m_ics.remove(message.path());
+        sendReply(message);
+    } else if (member == "FocusIn" || member == "FocusOut") {
+        m_ics[message.path()].focused = member == "FocusIn";
+        sendReply(message);
+    } else if (member == "Reset" || member == "SetCursorRect" ||
+               member == "SetCursorLocation" || member == "SetCapability" ||
+               member == "SetCapacity" || member == "SetSurroundingText" ||
+               member == "SetSurroundingTextPosition" ||
+               member == "EnableIC" || member == "CloseIC" ||
+               member == "MouseEvent") {
+        sendReply(message);
+    } else {
+        send(message.createErrorReply(QDBusError::UnknownMethod, member));
+    }
+}
+
+void FcitxStubDaemon::handleStub(const QDBusMessage &message) {
+    if (message.member() == "Stats") {
+        QVariantMap stats;
+        stats["calls"] = m_calls;
+        stats["replies"] = m_replies;
+        stats["signals"] = m_signals;
+        stats["keys"] = m_keys;
+        stats["releases"] = m_releases;
+        stats["sharedKeys"] = m_sharedKeys;
+        stats["unfocusedKeys"] = m_unfocusedKeys;
+        stats["created"] = m_created;
+        stats["inputContexts"] = m_ics.size();
+        stats["cpuTime"] = cpuTime();
+        sendReply(message, {stats});
+        // Not part of the traffic it reports.
+        m_replies--;
+    } else if (message.member() == "Keys") {
+        sendReply(message, {QVariant::fromValue(m_keyLog)});
+        m_replies--;
+    } else if (message.member() == "ResetStats") {
+        m_calls = m_replies = m_signals = m_keys = m_releases = 0;
+        m_sharedKeys = m_unfocusedKeys = m_created = 0;
+        m_keyLog.clear();
+        sendReply(message);
+        m_replies--;
+    } else {
+        send(message.createErrorReply(QDBusError::UnknownMethod,
+                                      message.member()));
+    }
+}
+
+FcitxStubDaemon::KeyResult FcitxStubDaemon::processKey(InputContext &ic,
+                                                       uint keyval,
+                                                       uint state,
+                                                       bool isRelease) {
+    KeyResult result;
+    // fcitx would drop them.
+    if (!ic.focused) {
+        m_unfocusedKeys++;
+    }
+    if (m_keyLog.size() < KeyLogSize) {
+        m_keyLog << (keyval | (isRelease ? ReleaseFlag : 0));
+    }
+    if (isRelease) {
+        return result;
+    }
+    const bool printable =
+        keyval >= 0x20 && keyval <= 0x7e && !(state & ShortcutState);
+    switch (m_options.pattern) {
+    case Pattern::Commit:
+        if (printable) {
+            result.handled = true;
+            result.commit = QChar(keyval);
+        }
+        break;
+    case Pattern::Preedit:
+        if ((keyval == ' ' || keyval == XK_Return) && !ic.preedit.isEmpty()) {
+            result.commit = ic.preedit;
+            ic.preedit.clear();
+        } else if (printable && keyval != ' ') {
+            ic.preedit.append(QChar(keyval));
+        } else if (keyval == XK_BackSpace && !ic.preedit.isEmpty()) {
+            ic.preedit.chop(1);
+        } else {
+            break;
+        }
+        result.handled = true;
+        result.preeditChanged = true;
+        result.preedit = ic.preedit;
+        break;
+    case Pattern::PassThrough:
+        break;
+    }
+    return result;
+}
+
+QList<QDBusMessage>
+FcitxStubDaemon::keySignals(const QString &path, const QString &interface,
+                            const KeyResult &result) const {
+    QList<QDBusMessage> signalList;
+    if (!result.commit.isEmpty()) {
+        QDBusMessage signal =
+            QDBusMessage::createSignal(path, interface, "CommitString");
+        signal << result.commit;
+        signalList << signal;
+    }
+    if (result.preeditChanged) {
+        FcitxFormattedPreeditText preedit;
+        if (!result.preedit.isEmpty()) {
+            preedit.append(result.preedit, PreeditFormat);
+        }
+        QDBusMessage signal = QDBusMessage::createSignal(
+            path, interface, "UpdateFormattedPreedit");
+        signal << QVariant::fromValue(preedit)
+               << result.preedit.toUtf8().size();
+        signalList << signal;
+    }
+    return signalList;
+}
+
+void FcitxStubDaemon::finishKey(const QDBusMessage &message,
+                                const KeyResult &result, bool batch) {
+    QList<QDBusMessage> signalList;
+    QList<QVariant> replyArgs;
+    if (batch) {
+        FcitxInputContextEventList events;
+        if (!result.commit.isEmpty()) {
+            FcitxInputContextEvent event;
+            event.setType(FcitxInputContextEvent::CommitString);
+            event.setData(result.commit);
+            events << event;
+        }
+        if (result.preeditChanged) {
+            FcitxStubPreedit data;
+            if (!result.preedit.isEmpty()) {
+                data.text.append(result.preedit, PreeditFormat);
+            }
+            data.cursor = result.preedit.toUtf8().size();
+            FcitxInputContextEvent event;
+            event.setType(FcitxInputContextEvent::UpdatePreedit);
+            event.setData(QVariant::fromValue(data));
+            events << event;
+        }
+        replyArgs << QVariant::fromValue(events) << result.handled;
+    } else {
+        signalList =
+            keySignals(message.path(), message.interface(), result);
+        if (m_options.fcitx4) {
+            replyArgs << (result.handled ? 1 : 0);
+        } else {
+            replyArgs << result.handled;
+        }
+    }
+
+    // Like fcitx, everything caused by the key goes out before its reply.
+    auto finish = [this, message, signalList, replyArgs]() {
+        for (const auto &signal : signalList) {
+            sendSignal(signal);
+        }
+        sendReply(message, replyArgs);
+    };
+    if (m_options.delay > 0) {
+        QTimer::singleShot(m_options.delay, this, finish);
+    } else {
+        finish();
+    }
+}
+
+std::shared_ptr<FcitxStubDaemon::SharedMemory>
+FcitxStubDaemon::attachSharedMemory(const QList<QVariant> &args) {
+    std::shared_ptr<SharedMemory> shm;
+    if (args.size() < 4) {
+        return shm;
+    }
+    int fds[4];
+    for (int i = 0; i < 4; i++) {
+        fds[i] = args[i].value<QDBusUnixFileDescriptor>().fileDescriptor();
+        if (fds[i] < 0) {
+            return shm;
+        }
+    }
+    shm = std::make_shared<SharedMemory>();
+    shm->in = mapRing(fds[0], &shm->inBytes);
+    shm->out = mapRing(fds[2], &shm->outBytes);
+    // The descriptors of the message are closed with it.
+    shm->inEventFd = dup(fds[1]);
+    shm->outEventFd = dup(fds[3]);
+    if (!shm->in || !shm->out || shm->inEventFd < 0 || shm->outEventFd < 0) {
+        shm.reset();
+        return shm;
+    }
+    // The client sets the size, it must not point past the mapping.
+    shm->inSize = std::min(shm->in->size, ringCapacity(shm->inBytes));
+    shm->outSize = std::min(shm->out->size, ringCapacity(shm->outBytes));
+    if (!shm->inSize || !shm->outSize) {
+        shm.reset();
+        return shm;
+    }
+    shm->notifier =
+        new QSocketNotifier(shm->inEventFd, QSocketNotifier::Read);
+    connect(shm->notifier, SIGNAL(activated(int)), this,
+            SLOT(readSharedMemory(int)));
+    return shm;
+}
+
+void FcitxStubDaemon::readSharedMemory(int fd) {
+    quint64 value;
+    while (read(fd, &value, sizeof(value)) > 0) {
+    }
+    for (auto iter = m_ics.begin(); iter != m_ics.end(); ++iter) {
+        if (iter->shm && iter->shm->inEventFd == fd) {
+            processSharedMemory(iter.key());
+            return;
+        }
+    }
+}
+
+void FcitxStubDaemon::processSharedMemory(const QString &path) {
+    auto iter = m_ics.find(path);
+    if (iter == m_ics.end() || !iter->shm) {
+        return;
+    }
+    SharedMemory &shm = *iter->shm;
+    quint32 head = shm.in->head.load(std::memory_order_relaxed);
+    const quint32 tail = shm.in->tail.load(std::memory_order_acquire);
+    if (tail - head > shm.inSize) {
+        iter->shm.reset();
+        return;
+    }
+    while (head != tail) {
+        const FcitxShmRecord record = shm.in->records[head % shm.inSize];
+        if (!reached(shm.calls, record.sequence)) {
+            break;
+        }
+        ++head;
+        shm.in->head.store(head, std::memory_order_release);
+        if (record.type != FcitxShmRecordType::KeyEvent) {
+            continue;
+        }
+        m_keys++;
+        m_sharedKeys++;
+        if (record.args[3]) {
+            m_releases++;
+        }
+        KeyResult result = processKey(*iter, record.args[0], record.args[2],
+                                      record.args[3]);
+        finishSharedKey(path, record.serial, result);
+    }
+}
+
+void FcitxStubDaemon::finishSharedKey(const QString &path, quint32 serial,
+                                      const KeyResult &result) {
+    const QList<QDBusMessage> signalList =
+        keySignals(path, icInterface, result);
+    const bool handled = result.handled;
+    auto finish = [this, path, serial, signalList, handled]() {
+        for (const auto &signal : signalList) {
+            sendSignal(signal);
+        }
+        auto iter = m_ics.find(path);
+        if (iter == m_ics.end() || !iter->shm) {
+            return;
+        }
+        SharedMemory &shm = *iter->shm;
+        const quint32 tail = shm.out->tail.load(std::memory_order_relaxed);
+        const quint32 head = shm.out->head.load(std::memory_order_acquire);
+        // The client stopped reading, like fcitx the result is dropped.
+        if (tail - head >= shm.outSize) {
+            return;
+        }
+        FcitxShmRecord record{};
+        record.type = FcitxShmRecordType::KeyResult;
+        record.serial = serial;
+        record.sequence = shm.signalCount;
+        record.args[0] = handled;
+        shm.out->records[tail % shm.outSize] = record;
+        shm.out->tail.store(tail + 1, std::memory_order_release);
+        quint64 one = 1;
+        ssize_t ret;
+        do {
+            ret = write(shm.outEventFd, &one, sizeof(one));
+        } while (ret < 0 && errno == EINTR);
+    };
+    if (m_options.delay > 0) {
+        QTimer::singleShot(m_options.delay, this, finish);
+    } else {
+        finish();
+    }
+}
+
+void FcitxStubDaemon::send(const QDBusMessage &message) {
+    if (message.type() == QDBusMessage::SignalMessage) {
+        m_signals++;
+    } else {
+        m_replies++;
+    }
+    m_connection.send(message);
+}
+
+void FcitxStubDaemon::sendSignal(const QDBusMessage &signal) {
+    auto iter = m_ics.find(signal.path());
+    if (iter != m_ics.end() && iter->shm) {
+        iter->shm->signalCount++;
+    }
+    send(signal);
+}
+
+void FcitxStubDaemon::sendReply(const QDBusMessage &message,
+                                const QList<QVariant> &arguments) {
+    send(message.createReply(arguments));
+}
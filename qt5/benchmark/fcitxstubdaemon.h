@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#ifndef FCITXSTUBDAEMON_H_
+#define FCITXSTUBDAEMON_H_
+
+#include <QDBusConnection>
+#include <QDBusVirtualObject>
+#include <QHash>
+#include <QVariant>
+#include <memory>
+
+// Just enough of fcitx 5 (org.fcitx.Fcitx.InputMethod1 on the portal name)
+// or fcitx 4 (org.fcitx.Fcitx.InputMethod on org.fcitx.Fcitx-<display>) to
+// drive the im module: every input context follows the same key pattern,
+// with an optional delay before each key is answered, on D-Bus or on the
+// rings of SetupSharedMemoryTransport. Counters and the keys received are
+// exported as org.fcitx.Fcitx.Stub on /stub.
+class FcitxStubDaemon : public QDBusVirtualObject {
+    Q_OBJECT
+public:
+    // Keys in the log of Keys, the keysym with ReleaseFlag set for releases.
+    static constexpr int KeyLogSize = 1024;
+    static constexpr uint ReleaseFlag = 1u << 31;
+
+    enum class Pattern {
+        // Every printable key is committed right away.
+        Commit,
+        // Printable keys go to the preedit, space and return commit it.
+        Preedit,
+        // No key is handled.
+        PassThrough,
+    };
+
+    struct Options {
+        bool fcitx4 = false;
+        bool batch = true;
+        int delay = 0;
+        Pattern pattern = Pattern::Commit;
+        // Answer GetKeyReleaseInterest with modifiers only, the fcitx 5 that
+        // doesn't know it makes the im module send every release.
+        bool releaseInterest = false;
+        // Accept SetupSharedMemoryTransport.
+        bool sharedMemory = false;
+    };
+
+    FcitxStubDaemon(const QDBusConnection &connection, const Options &options,
+                    QObject *parent = nullptr);
+    ~FcitxStubDaemon();
+
+    // Register the objects and the service name.
+    bool start();
+    QString service() const;
+
+    QString introspect(const QString &path) const override;
+    bool handleMessage(const QDBusMessage &message,
+                       const QDBusConnection &connection) override;
+
+private Q_SLOTS:
+    void readSharedMemory(int fd);
+
+private:
+    struct SharedMemory;
+
+    struct InputContext {
+        QString preedit;
+        bool focused = false;
+        std::shared_ptr<SharedMemory> shm;
+    };
+
+    struct KeyResult {
+        bool handled = false;
+        QString commit;
+        bool preeditChanged = false;
+        QString preedit;
+    };
+
+    void handleInputMethod(const QDBusMessage &message);
+    void handleInputContext(const QDBusMessage &message);
+    void handleStub(const QDBusMessage &message);
+    KeyResult processKey(InputContext &ic, uint keyval, uint state,
+                         bool isRelease);
+    QList<QDBusMessage> keySignals(const QString &path,
+                                   const QString &interface,
+                                   const KeyResult &result) const;
+    // Send the signals of a key and then its reply, after the delay.
+    void finishKey(const QDBusMessage &message, const KeyResult &result,
+                   bool batch);
+    std::shared_ptr<SharedMemory>
+    attachSharedMemory(const QList<QVariant> &args);
+    // Handle the records that don't wait for a D-Bus call any more.
+    void processSharedMemory(const QString &path);
+    // Same as finishKey, with a KeyResult record instead of a reply.
+    void finishSharedKey(const QString &path, quint32 serial,
+                         const KeyResult &result);
+    void send(const QDBusMessage &message);
+    void sendSignal(const QDBusMessage &signal);
+    void sendReply(const QDBusMessage &message,
+                   const QList<QVariant> &arguments = QList<QVariant>());
+
+    QDBusConnection m_connection;
+    Options m_options;
+    QHash<QString, InputContext> m_ics;
+    int m_icId = 0;
+    quint64 m_calls = 0;
+    quint64 m_replies = 0;
+    quint64 m_signals = 0;
+    quint64 m_keys = 0;
+    quint64 m_releases = 0;
+    quint64 m_sharedKeys = 0;
+    quint64 m_unfocusedKeys = 0;
+    quint64 m_created = 0;
+    // The first KeyLogSize keys since ResetStats.
+    QList<uint> m_keyLog;
+};
+
+#endif // FCITXSTUBDAEMON_H_
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// Reports what the im module costs a process that never types into it: the
+// time and heap to load and create the input context, and the heap each
+// window adds. Built against the static plugin, it gives the load time to
+// compare with the dlopen build.
+
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QWindow>
+#include <QtPlugin>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qplatforminputcontextfactory_p.h>
+#include <vector>
+
+#ifdef FCITX_STATIC_PLUGIN
+Q_IMPORT_PLUGIN(QFcitxPlatformInputContextPlugin)
+#endif
+
+static qint64 heapInUse() {
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return static_cast<qint64>(mallinfo2().uordblks);
+#else
+    return static_cast<qint64>(mallinfo().uordblks);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    // The input context is created by hand below, not by QGuiApplication.
+    qputenv("QT_IM_MODULE", "none");
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    const int count = argc > 1 ? std::max(1, atoi(argv[1])) : 64;
+
+    std::vector<std::unique_ptr<QWindow>> windows;
+    for (int i = 0; i < count; i++) {
+        windows.emplace_back(new QWindow);
+        windows.back()->resize(16, 16);
+        windows.back()->show();
+    }
+    app.processEvents();
+
+    const qint64 before = heapInUse();
+    QElapsedTimer timer;
+    timer.start();
+    std::unique_ptr<QPlatformInputContext> context(
+        QPlatformInputContextFactory::create(QStringLiteral("fcitx")));
+    const qint64 loadTime = timer.nsecsElapsed();
+    if (!context) {
+        fprintf(stderr, "Failed to create the fcitx input context.\n");
+        return 1;
+    }
+    app.processEvents();
+    const qint64 idle = heapInUse();
+
+    // Every focused window gets its FcitxQtICData.
+    for (auto &window : windows) {
+        window->requestActivate();
+        app.processEvents();
+        context->setFocusObject(window.get());
+    }
+    app.processEvents();
+    const qint64 withICs = heapInUse();
+
+    printf("load-time-us %lld\n", static_cast<long long>(loadTime / 1000));
+    printf("idle-heap %lld\n", static_cast<long long>(idle - before));
+    printf("ic-heap %lld\n", static_cast<long long>((withICs - idle) / count));
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Usage: footprint.sh <im module> <footprint program>
+#
+# Prints the load cost of the im module and fails if a FOOTPRINT_MAX_*
+# budget from the environment is exceeded, a budget of 0 is not checked.
+
+plugin="$1"
+program="$2"
+failed=0
+
+check() {
+    printf '%-22s %10s' "$1" "$2"
+    if [ "${3:-0}" -gt 0 ] && [ "$2" -gt "$3" ]; then
+        printf '   over budget of %s\n' "$3"
+        failed=1
+    else
+        printf '\n'
+    fi
+}
+
+relocations=$(readelf -rW "$plugin" | grep -c '^[0-9a-f]\{8,\} ')
+# Size and entry size of .init_array.
+set -- $(readelf -SW "$plugin" | awk '
+    { for (i = 1; i < NF; i++) if ($i == ".init_array") print $(i + 4), $(i + 5) }')
+constructors=0
+if [ $# -eq 2 ]; then
+    constructors=$((0x$1 / 0x$2))
+fi
+xkb_symbols=$(nm -D --undefined-only "$plugin" | grep -c ' xkb_')
+
+check relocations "$relocations" "$FOOTPRINT_MAX_RELOCATIONS"
+check static-constructors "$constructors" "$FOOTPRINT_MAX_STATIC_CONSTRUCTORS"
+check xkbcommon-symbols "$xkb_symbols" "$FOOTPRINT_MAX_XKB_SYMBOLS"
+
+# Let Qt find the module under the name it expects.
+plugin_path=$(mktemp -d)
+trap 'rm -rf "$plugin_path"' EXIT
+mkdir "$plugin_path/platforminputcontexts"
+ln -s "$(readlink -f "$plugin")" "$plugin_path/platforminputcontexts/"
+
+output=$(QT_PLUGIN_PATH="$plugin_path" "$program") || exit 1
+load_time=$(echo "$output" | awk '$1 == "load-time-us" { print $2 }')
+idle_heap=$(echo "$output" | awk '$1 == "idle-heap" { print $2 }')
+ic_heap=$(echo "$output" | awk '$1 == "ic-heap" { print $2 }')
+
+check load-time-us "$load_time"
+check idle-heap "$idle_heap" "$FOOTPRINT_MAX_IDLE_HEAP"
+check ic-heap "$ic_heap" "$FOOTPRINT_MAX_IC_HEAP"
+
+exit $failed
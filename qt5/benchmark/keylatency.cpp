@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// Keystroke latency of the im module against fcitx-stub-daemon on a private
+// bus, one JSON object per mode on stdout:
+//   sync    fcitx 5 interface with FCITX_QT_USE_SYNC
+//   async   fcitx 5 interface
+//   fcitx4  legacy fcitx 4 interface
+// Latency is from the press entering filterEvent to the first input method
+// event (commit or preedit) or forwarded key reaching the window. Messages
+// and CPU are per press and release pair.
+
+#include "fcitxbenchmark.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+
+namespace {
+
+struct Options {
+    QString plugin;
+    QString stub;
+    QStringList stubArguments;
+    int keys = 2000;
+    bool preedit = false;
+};
+
+// Letters, with a space to commit every eighth key for the preedit pattern.
+uint keysymAt(const Options &options, int i) {
+    if (options.preedit && i % 8 == 7) {
+        return ' ';
+    }
+    return 'a' + i % 26;
+}
+
+bool runMode(FcitxBenchmarkBus &bus, const Options &options,
+             const QString &mode) {
+    QStringList arguments = options.stubArguments;
+    if (mode == "fcitx4") {
+        arguments << "--fcitx4";
+    }
+    if (!bus.startStub(options.stub, arguments)) {
+        fprintf(stderr, "Failed to start %s.\n", qPrintable(options.stub));
+        return false;
+    }
+    qputenv("FCITX_QT_USE_SYNC", mode == "sync" ? "1" : "0");
+
+    FcitxBenchmarkWindow window;
+    std::unique_ptr<QPlatformInputContext> context(
+        fcitxCreateInputContext(options.plugin));
+    if (!context || !window.activate()) {
+        fprintf(stderr, "Failed to set up the input context.\n");
+        return false;
+    }
+    context->setFocusObject(&window);
+
+    // Until a key makes it through fcitx, the input context is not there.
+    bool ready = false;
+    for (int i = 0; i < 50 && !ready; i++) {
+        const int events = window.commits() + window.preedits();
+        fcitxSendKey(context.get(), 'x', false);
+        fcitxSendKey(context.get(), 'x', true);
+        ready = fcitxWaitFor(
+            [&window, events]() {
+                return window.commits() + window.preedits() > events;
+            },
+            100);
+    }
+    if (!ready) {
+        fprintf(stderr, "No answer from the stub in %s mode.\n",
+                qPrintable(mode));
+        return false;
+    }
+    fcitxWaitFor([]() { return false; }, 100);
+
+    bus.resetStubStats();
+    const qint64 stubCpu = bus.stubStats().value("cpuTime").toLongLong();
+    const qint64 busCpu = bus.busCpuTime();
+    const qint64 cpu = fcitxCpuTime();
+    std::vector<qint64> latencies;
+    latencies.reserve(options.keys);
+    int missed = 0;
+    QElapsedTimer timer;
+    for (int i = 0; i < options.keys; i++) {
+        const uint keysym = keysymAt(options, i);
+        const int responses = window.responses();
+        timer.start();
+        fcitxSendKey(context.get(), keysym, false);
+        if (fcitxWaitFor(
+                [&window, responses]() {
+                    return window.responses() > responses;
+                },
+                1000)) {
+            latencies.push_back(timer.nsecsElapsed());
+        } else {
+            missed++;
+        }
+        fcitxSendKey(context.get(), keysym, true);
+    }
+    // Let the last replies land before counting.
+    fcitxWaitFor([]() { return false; }, 100);
+    const qint64 cpuUsed = fcitxCpuTime() - cpu;
+    const qint64 busCpuUsed = bus.busCpuTime() - busCpu;
+    const QVariantMap stats = bus.stubStats();
+
+    const double keys = options.keys;
+    const quint64 messages = stats.value("calls").toULongLong() +
+                             stats.value("replies").toULongLong() +
+                             stats.value("signals").toULongLong();
+    QJsonObject result;
+    result["mode"] = mode;
+    result["keys"] = options.keys;
+    result["missed"] = missed;
+    result["p50_us"] = fcitxPercentile(latencies, 0.5) / 1000.0;
+    result["p99_us"] = fcitxPercentile(latencies, 0.99) / 1000.0;
+    result["max_us"] = fcitxPercentile(latencies, 1) / 1000.0;
+    result["messages_per_key"] = messages / keys;
+    result["cpu_us_per_key"] = cpuUsed / keys / 1000.0;
+    result["stub_cpu_us_per_key"] =
+        (stats.value("cpuTime").toLongLong() - stubCpu) / keys / 1000.0;
+    result["bus_cpu_us_per_key"] = busCpuUsed / keys / 1000.0;
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact)
+                       .constData());
+    fflush(stdout);
+
+    context.reset();
+    bus.stopStub();
+    return missed == 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    FcitxBenchmarkBus bus;
+    if (!bus.start()) {
+        fprintf(stderr, "Failed to start dbus-daemon.\n");
+        return 1;
+    }
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Keystroke latency of the fcitx im module against a stub daemon.");
+    parser.addHelpOption();
+    QCommandLineOption pluginOption(
+        "plugin", "The im module, not needed with a static plugin.", "path");
+    QCommandLineOption stubOption("stub", "The fcitx-stub-daemon program.",
+                                  "path", "fcitx-stub-daemon");
+    QCommandLineOption keysOption("keys", "Keys per mode.", "count", "2000");
+    QCommandLineOption modesOption("modes", "Comma separated modes to run.",
+                                   "modes", "sync,async,fcitx4");
+    QCommandLineOption delayOption(
+        "delay", "Milliseconds the stub takes for each key.", "ms", "0");
+    QCommandLineOption patternOption(
+        "pattern", "What the stub does with keys: commit or preedit.",
+        "pattern", "commit");
+    QCommandLineOption noBatchOption(
+        "no-batch", "The stub doesn't provide ProcessKeyEventBatch.");
+    parser.addOptions({pluginOption, stubOption, keysOption, modesOption,
+                       delayOption, patternOption, noBatchOption});
+    parser.process(app);
+
+    Options options;
+    options.plugin = parser.value(pluginOption);
+    options.stub = parser.value(stubOption);
+    options.keys = std::max(1, parser.value(keysOption).toInt());
+    options.preedit = parser.value(patternOption) == "preedit";
+    options.stubArguments << "--delay" << parser.value(delayOption)
+                          << "--pattern" << parser.value(patternOption);
+    if (parser.isSet(noBatchOption)) {
+        options.stubArguments << "--no-batch";
+    }
+
+    bool ok = true;
+    for (const QString &mode : parser.value(modesOption).split(',')) {
+        if (mode.isEmpty()) {
+            continue;
+        }
+        if (mode != "sync" && mode != "async" && mode != "fcitx4") {
+            fprintf(stderr, "Unknown mode %s.\n", qPrintable(mode));
+            return 1;
+        }
+        ok = runMode(bus, options, mode) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,641 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// Load generator for many im module clients on one bus. It starts a private
+// dbus-daemon and fcitx-stub-daemon, then --processes copies of itself,
+// each with --contexts instances of the im module serving --windows windows
+// each, and runs them through these phases:
+//   create   all processes start at once and type into each of their
+//            windows, latency is from focusing a window to the first commit
+//   churn    focus hops between the windows with a few keys typed each time,
+//            latency is per key
+//   restart  the stub is killed and started again, recovery is from the new
+//            stub owning its name to the last window of a process getting a
+//            commit again
+// One JSON object per phase goes to stdout. messages counts everything on
+// the bus with dbus-monitor, --no-monitor leaves it out of the dbus-daemon
+// CPU time. match_rules comes from org.freedesktop.DBus.Debug.Stats, it is
+// -1 if dbus-daemon doesn't have it.
+
+#include "fcitxbenchmark.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSocketNotifier>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+qint64 monotonicTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void printJson(const QJsonObject &object) {
+    printf("%s\n",
+           QJsonDocument(object).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+}
+
+QJsonArray toJsonArray(const std::vector<qint64> &values) {
+    QJsonArray array;
+    for (qint64 value : values) {
+        array.append(static_cast<double>(value));
+    }
+    return array;
+}
+
+// One process of the load, driven by lines on stdin:
+//   churn <rounds> <keys>
+//   recover
+//   quit
+// and answering each with a JSON line on stdout.
+class Worker {
+public:
+    bool setUp(const QString &plugin, int contexts, int windows) {
+        for (int i = 0; i < contexts; i++) {
+            std::unique_ptr<QPlatformInputContext> context(
+                fcitxCreateInputContext(plugin));
+            if (!context) {
+                return false;
+            }
+            m_contexts.push_back(std::move(context));
+            for (int j = 0; j < windows; j++) {
+                m_windows.emplace_back(new FcitxBenchmarkWindow);
+            }
+        }
+        m_windowsPerContext = windows;
+        return true;
+    }
+
+    void create() {
+        std::vector<qint64> latencies;
+        int failed = 0;
+        const qint64 cpu = fcitxCpuTime();
+        for (size_t i = 0; i < m_windows.size(); i++) {
+            const qint64 start = monotonicTime();
+            const qint64 committed = focusAndCommit(i, 10000);
+            if (committed < 0) {
+                failed++;
+            } else {
+                latencies.push_back(committed - start);
+            }
+        }
+        QJsonObject result;
+        result["event"] = "created";
+        result["latencies"] = toJsonArray(latencies);
+        result["failed"] = failed;
+        result["cpu"] = static_cast<double>(fcitxCpuTime() - cpu);
+        printJson(result);
+    }
+
+    void churn(int rounds, int keys) {
+        std::vector<qint64> latencies;
+        int failed = 0;
+        const qint64 cpu = fcitxCpuTime();
+        for (int round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < m_windows.size(); i++) {
+                focus(i);
+                for (int key = 0; key < keys; key++) {
+                    const qint64 start = monotonicTime();
+                    if (typeKey(i, 1000)) {
+                        latencies.push_back(monotonicTime() - start);
+                    } else {
+                        failed++;
+                    }
+                }
+            }
+        }
+        QJsonObject result;
+        result["event"] = "churned";
+        result["latencies"] = toJsonArray(latencies);
+        result["failed"] = failed;
+        result["cpu"] = static_cast<double>(fcitxCpuTime() - cpu);
+        printJson(result);
+    }
+
+    void recover() {
+        qint64 first = -1;
+        qint64 last = -1;
+        int failed = 0;
+        const qint64 cpu = fcitxCpuTime();
+        for (size_t i = 0; i < m_windows.size(); i++) {
+            const qint64 committed = focusAndCommit(i, 10000);
+            if (committed < 0) {
+                failed++;
+                continue;
+            }
+            if (first < 0) {
+                first = committed;
+            }
+            last = std::max(last, committed);
+        }
+        QJsonObject result;
+        result["event"] = "recovered";
+        result["first"] = static_cast<double>(first);
+        result["last"] = static_cast<double>(last);
+        result["failed"] = failed;
+        result["cpu"] = static_cast<double>(fcitxCpuTime() - cpu);
+        printJson(result);
+    }
+
+private:
+    QPlatformInputContext *contextOf(size_t window) const {
+        return m_contexts[window / m_windowsPerContext].get();
+    }
+
+    void focus(size_t window) {
+        QPlatformInputContext *context = contextOf(window);
+        // Focus out the other instance while its window still has the
+        // focus, so that it doesn't create an input context for this one.
+        if (m_focusContext && m_focusContext != context) {
+            m_focusContext->setFocusObject(nullptr);
+        }
+        m_windows[window]->activate();
+        context->setFocusObject(m_windows[window].get());
+        m_focusContext = context;
+    }
+
+    // Type until the key is committed, keys typed while fcitx is not there
+    // go to the window and don't count. Returns when it was committed, or
+    // -1.
+    qint64 focusAndCommit(size_t window, int timeout) {
+        focus(window);
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < timeout) {
+            if (typeKey(window, 20)) {
+                return monotonicTime();
+            }
+        }
+        return -1;
+    }
+
+    bool typeKey(size_t window, int timeout) {
+        FcitxBenchmarkWindow *target = m_windows[window].get();
+        const int commits = target->commits();
+        fcitxSendKey(contextOf(window), 'a', false);
+        fcitxSendKey(contextOf(window), 'a', true);
+        return fcitxWaitFor(
+            [target, commits]() { return target->commits() > commits; },
+            timeout);
+    }
+
+    std::vector<std::unique_ptr<QPlatformInputContext>> m_contexts;
+    std::vector<std::unique_ptr<FcitxBenchmarkWindow>> m_windows;
+    int m_windowsPerContext = 1;
+    QPlatformInputContext *m_focusContext = nullptr;
+};
+
+int runWorker(int argc, char *argv[]) {
+    QGuiApplication app(argc, argv);
+    QCommandLineParser parser;
+    QCommandLineOption workerOption("worker");
+    QCommandLineOption pluginOption("plugin", "", "path");
+    QCommandLineOption contextsOption("contexts", "", "count", "1");
+    QCommandLineOption windowsOption("windows", "", "count", "1");
+    parser.addOptions(
+        {workerOption, pluginOption, contextsOption, windowsOption});
+    parser.process(app);
+
+    Worker worker;
+    if (!worker.setUp(parser.value(pluginOption),
+                      std::max(1, parser.value(contextsOption).toInt()),
+                      std::max(1, parser.value(windowsOption).toInt()))) {
+        fprintf(stderr, "Failed to set up the input contexts.\n");
+        return 1;
+    }
+    worker.create();
+
+    // Keep the event loop running between commands, so that the im module
+    // sees the daemon go away when it happens.
+    QByteArray input;
+    QSocketNotifier notifier(STDIN_FILENO, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated, &app,
+                     [&input, &worker, &notifier, &app]() {
+                         char buffer[256];
+                         const ssize_t size =
+                             read(STDIN_FILENO, buffer, sizeof(buffer));
+                         if (size <= 0) {
+                             app.quit();
+                             return;
+                         }
+                         input.append(buffer, size);
+                         int end;
+                         while ((end = input.indexOf('\n')) >= 0) {
+                             const QList<QByteArray> command =
+                                 input.left(end).split(' ');
+                             input.remove(0, end + 1);
+                             // Commands take a while, don't nest them.
+                             notifier.setEnabled(false);
+                             if (command[0] == "churn" &&
+                                 command.size() == 3) {
+                                 worker.churn(command[1].toInt(),
+                                              command[2].toInt());
+                             } else if (command[0] == "recover") {
+                                 worker.recover();
+                             } else if (command[0] == "quit") {
+                                 app.quit();
+                                 return;
+                             }
+                             notifier.setEnabled(true);
+                         }
+                     });
+    return app.exec();
+}
+
+struct Options {
+    QString program;
+    QString plugin;
+    QString stub;
+    QStringList stubArguments;
+    int processes = 10;
+    int contexts = 1;
+    int windows = 4;
+    int churnRounds = 5;
+    int churnKeys = 4;
+    int restarts = 1;
+    bool monitor = true;
+    int timeout = 120000;
+};
+
+// Counts the messages on the bus with dbus-monitor --profile, one line per
+// message after a comment header.
+class MessageCounter {
+public:
+    bool start(const QString &address) {
+        m_process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        QObject::connect(&m_process, &QProcess::readyReadStandardOutput,
+                         [this]() {
+                             while (m_process.canReadLine()) {
+                                 if (!m_process.readLine().startsWith('#')) {
+                                     m_count++;
+                                 }
+                             }
+                         });
+        m_process.start("dbus-monitor",
+                        QStringList() << "--address" << address
+                                      << "--profile");
+        if (!m_process.waitForStarted()) {
+            return false;
+        }
+        // Give it the time to become a monitor.
+        fcitxWaitFor([]() { return false; }, 200);
+        return isRunning();
+    }
+    bool isRunning() const { return m_process.state() == QProcess::Running; }
+    qint64 count() const { return m_count; }
+
+    ~MessageCounter() {
+        m_process.kill();
+        m_process.waitForFinished();
+    }
+
+private:
+    QProcess m_process;
+    qint64 m_count = 0;
+};
+
+class LoadGenerator {
+public:
+    LoadGenerator(FcitxBenchmarkBus &bus, const Options &options)
+        : m_bus(bus), m_options(options) {}
+
+    ~LoadGenerator() {
+        for (auto &worker : m_workers) {
+            if (!worker->process.waitForFinished(5000)) {
+                worker->process.kill();
+                worker->process.waitForFinished();
+            }
+        }
+    }
+
+    bool run() {
+        if (!m_bus.startStub(m_options.stub, m_options.stubArguments)) {
+            fprintf(stderr, "Failed to start %s.\n",
+                    qPrintable(m_options.stub));
+            return false;
+        }
+        if (m_options.monitor && !m_counter.start(m_bus.address())) {
+            fprintf(stderr, "dbus-monitor is not there, messages will be "
+                            "-1.\n");
+        }
+
+        bool ok = create();
+        ok = ok && churn();
+        for (int i = 0; ok && i < m_options.restarts; i++) {
+            ok = restart();
+        }
+        sendAll("quit");
+        return ok;
+    }
+
+private:
+    struct WorkerProcess {
+        QProcess process;
+        QByteArray output;
+        QJsonObject last;
+    };
+
+    bool create() {
+        begin();
+        for (int i = 0; i < m_options.processes; i++) {
+            m_workers.emplace_back(new WorkerProcess);
+            WorkerProcess *worker = m_workers.back().get();
+            worker->process.setProcessChannelMode(
+                QProcess::ForwardedErrorChannel);
+            QObject::connect(&worker->process,
+                             &QProcess::readyReadStandardOutput, [worker]() {
+                                 while (worker->process.canReadLine()) {
+                                     worker->last =
+                                         QJsonDocument::fromJson(
+                                             worker->process.readLine())
+                                             .object();
+                                 }
+                             });
+            QStringList arguments;
+            arguments << "--worker"
+                      << "--contexts" << QString::number(m_options.contexts)
+                      << "--windows" << QString::number(m_options.windows);
+            if (!m_options.plugin.isEmpty()) {
+                arguments << "--plugin" << m_options.plugin;
+            }
+            worker->process.start(m_options.program, arguments);
+        }
+        const std::vector<QJsonObject> results = waitAll("created");
+        if (results.empty()) {
+            return false;
+        }
+        QJsonObject report = latencyReport("create", results);
+        report["wall_ms"] = (monotonicTime() - m_phaseStart) / 1e6;
+        return end(report, results);
+    }
+
+    bool churn() {
+        begin();
+        sendAll(QString("churn %1 %2")
+                    .arg(m_options.churnRounds)
+                    .arg(m_options.churnKeys)
+                    .toUtf8());
+        const std::vector<QJsonObject> results = waitAll("churned");
+        if (results.empty()) {
+            return false;
+        }
+        QJsonObject report = latencyReport("churn", results);
+        report["focus_changes"] =
+            m_options.churnRounds * m_options.processes *
+            m_options.contexts * m_options.windows;
+        return end(report, results);
+    }
+
+    bool restart() {
+        m_bus.stopStub();
+        begin();
+        if (!m_bus.startStub(m_options.stub, m_options.stubArguments)) {
+            fprintf(stderr, "Failed to restart %s.\n",
+                    qPrintable(m_options.stub));
+            return false;
+        }
+        const qint64 restarted = monotonicTime();
+        sendAll("recover");
+        const std::vector<QJsonObject> results = waitAll("recovered");
+        if (results.empty()) {
+            return false;
+        }
+        std::vector<qint64> first;
+        std::vector<qint64> last;
+        int failed = 0;
+        for (const QJsonObject &result : results) {
+            failed += result["failed"].toInt();
+            if (result["first"].toDouble() >= 0) {
+                first.push_back(
+                    static_cast<qint64>(result["first"].toDouble()) -
+                    restarted);
+                last.push_back(static_cast<qint64>(result["last"].toDouble()) -
+                               restarted);
+            }
+        }
+        QJsonObject report;
+        report["phase"] = "restart";
+        report["failed"] = failed;
+        report["first_commit_ms"] = fcitxPercentile(first, 0) / 1e6;
+        report["recovery_p50_ms"] = fcitxPercentile(last, 0.5) / 1e6;
+        report["recovery_p99_ms"] = fcitxPercentile(last, 0.99) / 1e6;
+        report["recovery_max_ms"] = fcitxPercentile(last, 1) / 1e6;
+        return end(report, results);
+    }
+
+    void sendAll(const QByteArray &command) {
+        for (auto &worker : m_workers) {
+            worker->last = QJsonObject();
+            worker->process.write(command + '\n');
+        }
+    }
+
+    // Wait until every worker answered with event, empty if one didn't.
+    std::vector<QJsonObject> waitAll(const QString &event) {
+        const bool ok = fcitxWaitFor(
+            [this, &event]() {
+                for (auto &worker : m_workers) {
+                    if (worker->process.state() == QProcess::NotRunning ||
+                        worker->last["event"].toString() != event) {
+                        return false;
+                    }
+                }
+                return true;
+            },
+            m_options.timeout);
+        std::vector<QJsonObject> results;
+        if (!ok) {
+            fprintf(stderr, "Not all workers got to %s.\n",
+                    qPrintable(event));
+            return results;
+        }
+        for (auto &worker : m_workers) {
+            results.push_back(worker->last);
+        }
+        return results;
+    }
+
+    QJsonObject latencyReport(const QString &phase,
+                              const std::vector<QJsonObject> &results) {
+        std::vector<qint64> latencies;
+        int failed = 0;
+        for (const QJsonObject &result : results) {
+            for (const QJsonValue &latency : result["latencies"].toArray()) {
+                latencies.push_back(static_cast<qint64>(latency.toDouble()));
+            }
+            failed += result["failed"].toInt();
+        }
+        QJsonObject report;
+        report["phase"] = phase;
+        report["samples"] = static_cast<int>(latencies.size());
+        report["failed"] = failed;
+        report["p50_ms"] = fcitxPercentile(latencies, 0.5) / 1e6;
+        report["p99_ms"] = fcitxPercentile(latencies, 0.99) / 1e6;
+        report["max_ms"] = fcitxPercentile(latencies, 1) / 1e6;
+        return report;
+    }
+
+    qint64 matchRules() const {
+        QDBusReply<QVariantMap> reply =
+            m_bus.connection().call(QDBusMessage::createMethodCall(
+                "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                "org.freedesktop.DBus.Debug.Stats", "GetStats"));
+        if (!reply.isValid() || !reply.value().contains("MatchRules")) {
+            return -1;
+        }
+        return reply.value().value("MatchRules").toLongLong();
+    }
+
+    void begin() {
+        m_phaseStart = monotonicTime();
+        m_messages = m_counter.count();
+        m_busCpu = m_bus.busCpuTime();
+        m_bus.resetStubStats();
+    }
+
+    bool end(QJsonObject report, const std::vector<QJsonObject> &results) {
+        // Let the last messages reach dbus-monitor.
+        fcitxWaitFor([]() { return false; }, 100);
+        const QVariantMap stats = m_bus.stubStats();
+        double clientCpu = 0;
+        for (const QJsonObject &result : results) {
+            clientCpu += result["cpu"].toDouble();
+        }
+        report["processes"] = m_options.processes;
+        report["contexts"] = m_options.processes * m_options.contexts;
+        report["windows"] =
+            m_options.processes * m_options.contexts * m_options.windows;
+        report["messages"] =
+            m_counter.isRunning()
+                ? static_cast<double>(m_counter.count() - m_messages)
+                : -1.0;
+        report["stub_calls"] = stats.value("calls").toDouble();
+        report["input_contexts_created"] = stats.value("created").toDouble();
+        report["match_rules"] = static_cast<double>(matchRules());
+        report["bus_cpu_ms"] = (m_bus.busCpuTime() - m_busCpu) / 1e6;
+        report["stub_cpu_ms"] = stats.value("cpuTime").toDouble() / 1e6;
+        report["client_cpu_ms"] = clientCpu / 1e6;
+        printJson(report);
+        return report["failed"].toInt() == 0;
+    }
+
+    FcitxBenchmarkBus &m_bus;
+    const Options &m_options;
+    MessageCounter m_counter;
+    std::vector<std::unique_ptr<WorkerProcess>> m_workers;
+    qint64 m_phaseStart = 0;
+    qint64 m_messages = 0;
+    qint64 m_busCpu = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--worker") == 0) {
+            return runWorker(argc, argv);
+        }
+    }
+
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    FcitxBenchmarkBus bus;
+    if (!bus.start()) {
+        fprintf(stderr, "Failed to start dbus-daemon.\n");
+        return 1;
+    }
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Many fcitx im module clients against a stub daemon.");
+    parser.addHelpOption();
+    QCommandLineOption pluginOption(
+        "plugin", "The im module, not needed with a static plugin.", "path");
+    QCommandLineOption stubOption("stub", "The fcitx-stub-daemon program.",
+                                  "path", "fcitx-stub-daemon");
+    QCommandLineOption processesOption("processes", "Client processes.",
+                                       "count", "10");
+    QCommandLineOption contextsOption(
+        "contexts", "Im module instances per process.", "count", "1");
+    QCommandLineOption windowsOption("windows", "Windows per instance.",
+                                     "count", "4");
+    QCommandLineOption roundsOption(
+        "churn-rounds", "Times the focus goes through all windows.", "count",
+        "5");
+    QCommandLineOption keysOption("churn-keys", "Keys typed per focus.",
+                                  "count", "4");
+    QCommandLineOption restartsOption("restarts", "Stub restarts.", "count",
+                                      "1");
+    QCommandLineOption delayOption(
+        "delay", "Milliseconds the stub takes for each key.", "ms", "0");
+    QCommandLineOption fcitx4Option("fcitx4",
+                                    "The stub serves the fcitx 4 interface.");
+    QCommandLineOption noMonitorOption(
+        "no-monitor", "Don't count the messages with dbus-monitor.");
+    QCommandLineOption timeoutOption(
+        "timeout", "Seconds to wait for the processes in each phase.",
+        "seconds", "120");
+    parser.addOptions({pluginOption, stubOption, processesOption,
+                       contextsOption, windowsOption, roundsOption,
+                       keysOption, restartsOption, delayOption, fcitx4Option,
+                       noMonitorOption, timeoutOption});
+    parser.process(app);
+
+    Options options;
+    options.program = QCoreApplication::applicationFilePath();
+    options.plugin = parser.value(pluginOption);
+    options.stub = parser.value(stubOption);
+    options.processes = std::max(1, parser.value(processesOption).toInt());
+    options.contexts = std::max(1, parser.value(contextsOption).toInt());
+    options.windows = std::max(1, parser.value(windowsOption).toInt());
+    options.churnRounds = std::max(0, parser.value(roundsOption).toInt());
+    options.churnKeys = std::max(1, parser.value(keysOption).toInt());
+    options.restarts = std::max(0, parser.value(restartsOption).toInt());
+    options.monitor = !parser.isSet(noMonitorOption);
+    options.timeout =
+        std::max(1, parser.value(timeoutOption).toInt()) * 1000;
+    options.stubArguments << "--delay" << parser.value(delayOption)
+                          << "--pattern"
+                          << "commit";
+    if (parser.isSet(fcitx4Option)) {
+        options.stubArguments << "--fcitx4";
+    }
+
+    LoadGenerator generator(bus, options);
+    return generator.run() ? 0 : 1;
+}
@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// CPU time of the im module's hot functions that don't talk to fcitx, as one
+// JSON document on stdout:
+//   {"qt": "5.15.2", "benchmarks": [{"name": "createKeyEvent", "size": 0,
+//     "iterations": 1048576, "ns_per_iteration": 95.3,
+//     "cpu_ns_per_iteration": 95.1}, ...]}
+// Each benchmark runs until it took --min-time milliseconds, the fastest of
+// --repeat runs is reported. size is the parameter of the benchmark, e.g.
+// the number of preedit segments, or 0.
+// With --stub, the generated D-Bus proxies are compared with qdbusxml2cpp
+// ones on a ProcessKeyEvent round trip to fcitx-stub-daemon, where the CPU
+// time is the part spent in this process, and on decoding its reply.
+
+#include "fcitxbenchmark.h"
+#include "qfcitxplatforminputcontext.h"
+#include "qtdbusinputcontext1proxy.h"
+#include "qtkey.h"
+#include <QCommandLineParser>
+#include <QDBusPendingReply>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+#ifdef FCITX_BENCHMARK_QTKEYTRANS
+#include "qtkeytrans.h"
+
+// Not in qtkeytrans.h, but global in qtkeytrans.cpp.
+void qEventToSym(int key, const QString &text, Qt::KeyboardModifiers mod,
+                 int &outsym, unsigned int &outstate);
+int translateKeySym(uint key);
+#endif
+
+namespace {
+
+// Keeps the results alive so the compiler can't drop the work.
+volatile quint64 sink;
+
+// Ordinary letters, keypad, function and modifier keys, a dead key, a
+// Cyrillic letter and a Unicode keysym.
+const uint keysyms[] = {'a', 'Z', '5', ' ', 0xff0d, 0xff08, 0xffbe,
+                        0xffe1, 0xffb7, 0xfe51, 0x6c1, 0x100263a};
+const int keysymCount = sizeof(keysyms) / sizeof(keysyms[0]);
+
+#ifdef FCITX_BENCHMARK_QTKEYTRANS
+const int qtKeys[] = {Qt::Key_A, Qt::Key_Z, Qt::Key_5, Qt::Key_Space,
+                      Qt::Key_Return, Qt::Key_Backspace, Qt::Key_F1,
+                      Qt::Key_Shift, Qt::Key_Escape, Qt::Key_Launch0,
+                      Qt::Key_VolumeUp, Qt::Key_Dead_Acute};
+const int qtKeyCount = sizeof(qtKeys) / sizeof(qtKeys[0]);
+#endif
+
+struct Options {
+    qint64 minTime = 100;
+    int repeat = 5;
+    QString filter;
+};
+
+class Runner {
+public:
+    explicit Runner(const Options &options) : m_options(options) {}
+
+    // Run body with the number of iterations to do.
+    void run(const QString &name, int size,
+             const std::function<void(int)> &body) {
+        if (!m_options.filter.isEmpty() && !name.contains(m_options.filter)) {
+            return;
+        }
+        QElapsedTimer timer;
+        // Find an iteration count that takes at least min time.
+        int iterations = 1;
+        qint64 elapsed = 0;
+        qint64 cpu = 0;
+        while (true) {
+            timer.start();
+            cpu = fcitxCpuTime();
+            body(iterations);
+            elapsed = timer.nsecsElapsed();
+            cpu = fcitxCpuTime() - cpu;
+            if (elapsed >= m_options.minTime * 1000000 ||
+                iterations >= (1 << 30)) {
+                break;
+            }
+            iterations *= 2;
+        }
+        qint64 best = elapsed;
+        qint64 bestCpu = cpu;
+        for (int i = 1; i < m_options.repeat; i++) {
+            timer.start();
+            cpu = fcitxCpuTime();
+            body(iterations);
+            best = std::min(best, timer.nsecsElapsed());
+            bestCpu = std::min(bestCpu, fcitxCpuTime() - cpu);
+        }
+
+        QJsonObject result;
+        result["name"] = name;
+        result["size"] = size;
+        result["iterations"] = iterations;
+        result["ns_per_iteration"] = static_cast<double>(best) / iterations;
+        result["cpu_ns_per_iteration"] =
+            static_cast<double>(bestCpu) / iterations;
+        m_results.append(result);
+        fprintf(stderr, "%-28s %5d %12.1f ns\n", qPrintable(name), size,
+                static_cast<double>(best) / iterations);
+    }
+
+    QJsonArray results() const { return m_results; }
+
+private:
+    const Options &m_options;
+    QJsonArray m_results;
+};
+
+// Characters and non BMP characters mixed, like text with emoji in it.
+QString surroundingText(int size) {
+    QString text;
+    text.reserve(size * 2);
+    for (int i = 0; i < size; i++) {
+        if (i % 8 == 7) {
+            text.append(QString::fromUcs4(U"\U0001F600", 1));
+        } else {
+            text.append(QChar('a' + i % 26));
+        }
+    }
+    return text;
+}
+
+// Segments of two characters, formats as fcitx 5 uses them.
+FcitxFormattedPreeditText preeditText(int segments) {
+    const qint32 formats[] = {1 << 3, (1 << 3) | (1 << 4), 1 << 3,
+                              (1 << 3) | (1 << 5)};
+    FcitxFormattedPreeditText text;
+    for (int i = 0; i < segments; i++) {
+        text.append(QString("ni"), formats[i % 4]);
+    }
+    return text;
+}
+
+void runKeyBenchmarks(Runner &runner) {
+    runner.run("keysymToQtKey", 0, [](int iterations) {
+        const QString text("a");
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            total += keysymToQtKey(keysyms[i % keysymCount], text);
+        }
+        sink = total;
+    });
+
+    runner.run("createKeyEvent", 0, [](int iterations) {
+        const FcitxKeyEventData none;
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            auto event = QFcitxPlatformInputContext::createKeyEvent(
+                keysyms[i % keysymCount], i & 1, false, none);
+            total += event.key;
+        }
+        sink = total;
+    });
+
+#ifdef FCITX_BENCHMARK_QTKEYTRANS
+    runner.run("qEventToSym", 0, [](int iterations) {
+        const QString texts[] = {QString(), QString("a")};
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            int sym;
+            unsigned int state;
+            qEventToSym(qtKeys[i % qtKeyCount], texts[i & 1],
+                        Qt::NoModifier, sym, state);
+            total += sym;
+        }
+        sink = total;
+    });
+
+    runner.run("translateKeySym", 0, [](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            total += translateKeySym(qtKeys[i % qtKeyCount]);
+        }
+        sink = total;
+    });
+
+    runner.run("symToKeyQt", 0, [](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            int key;
+            Qt::KeyboardModifiers modifiers;
+            symToKeyQt(keysyms[i % keysymCount], 0, key, modifiers);
+            total += key;
+        }
+        sink = total;
+    });
+
+    runner.run("keyQtToSym", 0, [](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            int sym;
+            unsigned int state;
+            keyQtToSym(qtKeys[i % qtKeyCount], Qt::ShiftModifier, sym, state);
+            total += sym;
+        }
+        sink = total;
+    });
+#endif
+}
+
+void runSurroundingTextBenchmarks(Runner &runner) {
+    for (int size : {100, 512, 4096}) {
+        const QString text = surroundingText(size);
+        // A selection of ten before the middle.
+        const int cursor = text.size() / 2;
+        const int anchor = cursor - 10;
+
+        runner.run("surroundingTextPosition", size,
+                   [&text, cursor, anchor](int iterations) {
+                       quint64 total = 0;
+                       for (int i = 0; i < iterations; i++) {
+                           int c = cursor;
+                           int a = anchor;
+                           QFcitxPlatformInputContext::surroundingTextPosition(
+                               text, c, a);
+                           total += c + a;
+                       }
+                       sink = total;
+                   });
+
+        int ucsCursor = cursor;
+        int ucsAnchor = anchor;
+        QFcitxPlatformInputContext::surroundingTextPosition(text, ucsCursor,
+                                                            ucsAnchor);
+        runner.run("surroundingTextDeletion", size,
+                   [&text, ucsCursor, ucsAnchor](int iterations) {
+                       quint64 total = 0;
+                       for (int i = 0; i < iterations; i++) {
+                           int offset = -5;
+                           int nchar = 15;
+                           QFcitxPlatformInputContext::surroundingTextDeletion(
+                               text, ucsCursor, ucsAnchor, offset, nchar);
+                           total += offset + nchar;
+                       }
+                       sink = total;
+                   });
+    }
+}
+
+void runPreeditBenchmarks(Runner &runner,
+                          QFcitxPlatformInputContext &context) {
+    for (int segments : {1, 10, 50, 200}) {
+        const FcitxFormattedPreeditText text = preeditText(segments);
+        // Moving the cursor every time defeats the unchanged preedit check.
+        runner.run("updateFormattedPreedit", segments,
+                   [&context, &text](int iterations) {
+                       for (int i = 0; i < iterations; i++) {
+                           context.updateFormattedPreedit(text, i & 1);
+                       }
+                   });
+    }
+    context.updateFormattedPreedit(FcitxFormattedPreeditText(), 0);
+}
+
+// org::fcitx::Fcitx::InputContext1 is the generated proxy the im module
+// uses, QtDBusInputContext1Proxy the one qdbusxml2cpp makes from the same
+// XML.
+bool runProxyBenchmarks(Runner &runner, FcitxBenchmarkBus &bus,
+                        const QString &stub) {
+    if (!bus.startStub(stub, QStringList() << "--pattern"
+                                           << "passthrough")) {
+        fprintf(stderr, "Failed to start %s.\n", qPrintable(stub));
+        return false;
+    }
+    const QString service = QStringLiteral("org.freedesktop.portal.Fcitx");
+    QDBusConnection connection = bus.connection();
+    QDBusMessage create = QDBusMessage::createMethodCall(
+        service, "/org/freedesktop/portal/inputmethod",
+        "org.fcitx.Fcitx.InputMethod1", "CreateInputContext");
+    create << QVariant::fromValue(FcitxInputContextArgumentList());
+    const QDBusMessage created = connection.call(create);
+    if (created.type() != QDBusMessage::ReplyMessage ||
+        created.arguments().isEmpty()) {
+        fprintf(stderr, "Failed to create an input context.\n");
+        return false;
+    }
+    const QString path =
+        qdbus_cast<QDBusObjectPath>(created.arguments().at(0)).path();
+    org::fcitx::Fcitx::InputContext1 generated(service, path, connection);
+    QtDBusInputContext1Proxy qdbusxml2cpp(service, path, connection);
+
+    runner.run("proxyCall/generated", 0, [&generated](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            QDBusPendingCall call = generated.connection().asyncCall(
+                generated.createProcessKeyEventMessage('a', 38, 0, false, i));
+            call.waitForFinished();
+            bool processed = false;
+            org::fcitx::Fcitx::InputContext1::decodeProcessKeyEventReply(
+                call.reply(), processed);
+            total += processed;
+        }
+        sink = total;
+    });
+    runner.run("proxyCall/qdbusxml2cpp", 0, [&qdbusxml2cpp](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            QDBusPendingReply<bool> reply =
+                qdbusxml2cpp.ProcessKeyEvent('a', 38, 0, false, i);
+            reply.waitForFinished();
+            total += reply.value();
+        }
+        sink = total;
+    });
+
+    const QDBusMessage reply = connection.call(
+        generated.createProcessKeyEventMessage('a', 38, 0, false, 0));
+    runner.run("proxyDecode/generated", 0, [&reply](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            bool processed = false;
+            org::fcitx::Fcitx::InputContext1::decodeProcessKeyEventReply(
+                reply, processed);
+            total += processed;
+        }
+        sink = total;
+    });
+    runner.run("proxyDecode/qdbusxml2cpp", 0, [&reply](int iterations) {
+        quint64 total = 0;
+        for (int i = 0; i < iterations; i++) {
+            QDBusPendingReply<bool> pending =
+                QDBusPendingCall::fromCompletedCall(reply);
+            total += pending.value();
+        }
+        sink = total;
+    });
+    bus.stopStub();
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    // The input context is only needed for updateFormattedPreedit, but keep
+    // it away from the real session bus and fcitx.
+    FcitxBenchmarkBus bus;
+    if (!bus.start()) {
+        fprintf(stderr, "Failed to start dbus-daemon.\n");
+        return 1;
+    }
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "CPU time of the fcitx im module's key and text handling.");
+    parser.addHelpOption();
+    QCommandLineOption minTimeOption(
+        "min-time", "Milliseconds each run of a benchmark takes at least.",
+        "ms", "100");
+    QCommandLineOption repeatOption("repeat", "Runs of each benchmark.",
+                                    "count", "5");
+    QCommandLineOption filterOption(
+        "filter", "Only run benchmarks whose name contains this.", "name");
+    QCommandLineOption stubOption(
+        "stub", "fcitx-stub-daemon, to compare the D-Bus proxies.", "path");
+    parser.addOptions({minTimeOption, repeatOption, filterOption, stubOption});
+    parser.process(app);
+
+    Options options;
+    options.minTime = std::max(1, parser.value(minTimeOption).toInt());
+    options.repeat = std::max(1, parser.value(repeatOption).toInt());
+    options.filter = parser.value(filterOption);
+    Runner runner(options);
+
+    runKeyBenchmarks(runner);
+    runSurroundingTextBenchmarks(runner);
+
+    FcitxBenchmarkWindow window;
+    QFcitxPlatformInputContext context;
+    if (!window.activate()) {
+        fprintf(stderr, "Failed to focus the window.\n");
+        return 1;
+    }
+    runPreeditBenchmarks(runner, context);
+    if (parser.isSet(stubOption) &&
+        !runProxyBenchmarks(runner, bus, parser.value(stubOption))) {
+        return 1;
+    }
+
+    QJsonObject result;
+    result["qt"] = QString(qVersion());
+    result["benchmarks"] = runner.results();
+    printf("%s\n", QJsonDocument(result).toJson().constData());
+    return 0;
+}
@@ -0,0 +1,628 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// Checks of what the im module puts on the bus, against fcitx-stub-daemon on
+// a private bus. One JSON object per check goes to stdout, the exit status
+// is 0 only if all of them passed:
+//   release-interest  with a stub that asks for modifier releases only, no
+//                     other release reaches it
+//   release-all       with a stub that doesn't know GetKeyReleaseInterest,
+//                     every release reaches it
+//   shared-memory     keys go through the rings of the shared memory
+//                     transport, focus changes sent on D-Bus right before a
+//                     key reach the stub before it, and commits on D-Bus and
+//                     keys forwarded after a result in the ring reach the
+//                     window in the order they were typed in, also when the
+//                     stub is stopped long enough for the ring to fill up,
+//                     and a key it doesn't answer before the key deadline
+//                     is delivered locally
+//   autorepeat        a key held while fcitx is behind, released and followed
+//                     by another key: none of the held back repeats reaches
+//                     the stub after the release or the other key
+//   allocations       heap allocations of the GUI thread for a key press,
+//                     from filterEvent to the reply being handled, exceed
+//                     those of a bare QtDBus client making the same call to
+//                     the same stub by at most --max-overhead, and a release
+//                     fcitx isn't interested in makes none; needs glibc
+
+#include "fcitxbenchmark.h"
+#include <QCommandLineParser>
+#include <QDBusMessage>
+#include <QDBusObjectPath>
+#include <QGuiApplication>
+#include <QInputMethodEvent>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QKeyEvent>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <pthread.h>
+#include <qpa/qplatforminputcontext.h>
+#include <qpa/qwindowsysteminterface.h>
+#include <signal.h>
+
+namespace {
+
+// Set while a part of the key path is measured.
+std::atomic<bool> countingAllocations{false};
+pthread_t guiThread;
+quint64 guiAllocations = 0;
+std::atomic<quint64> processAllocations{0};
+
+void countAllocation() {
+    if (!countingAllocations.load(std::memory_order_relaxed)) {
+        return;
+    }
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (pthread_equal(pthread_self(), guiThread)) {
+        guiAllocations++;
+    }
+}
+
+} // namespace
+
+#if defined(__GLIBC__)
+// Everything, operator new included, ends up here.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+namespace {
+
+const uint XK_BackSpace = 0xff08;
+const uint XK_Return = 0xff0d;
+const uint XK_Shift_L = 0xffe1;
+// More records than the 256 of the ring, four per key typed.
+const int RingBurst = 300;
+// Same as FcitxKeyState_Shift.
+const uint ShiftState = 1 << 0;
+// Same as FcitxStubDaemon::ReleaseFlag.
+const uint ReleaseFlag = 1u << 31;
+// FCITX_QT_KEY_DEADLINE of the shared-memory check, in milliseconds.
+const int KeyDeadline = 2000;
+// Autorepeat presses while the key is held.
+const int Repeats = 10;
+
+struct Options {
+    QString plugin;
+    QString stub;
+    int keys = 100;
+    int maxOverhead = -1;
+};
+
+// Start the stub with arguments and give window the focus and a new input
+// context, ready once a key made it through fcitx.
+std::unique_ptr<QPlatformInputContext> setUp(FcitxBenchmarkBus &bus,
+                                             const Options &options,
+                                             const QStringList &arguments,
+                                             FcitxBenchmarkWindow &window) {
+    std::unique_ptr<QPlatformInputContext> context;
+    if (!bus.startStub(options.stub, arguments)) {
+        fprintf(stderr, "Failed to start %s.\n", qPrintable(options.stub));
+        return context;
+    }
+    context.reset(fcitxCreateInputContext(options.plugin));
+    if (!context || !window.activate()) {
+        fprintf(stderr, "Failed to set up the input context.\n");
+        context.reset();
+        return context;
+    }
+    context->setFocusObject(&window);
+
+    bool ready = false;
+    for (int i = 0; i < 50 && !ready; i++) {
+        const int responses = window.responses();
+        fcitxSendKey(context.get(), 'x', false);
+        fcitxSendKey(context.get(), 'x', true);
+        ready = fcitxWaitFor(
+            [&window, responses]() {
+                return window.responses() > responses;
+            },
+            100);
+    }
+    if (!ready) {
+        fprintf(stderr, "No answer from the stub.\n");
+        context.reset();
+        return context;
+    }
+    fcitxWaitFor([]() { return false; }, 100);
+    bus.resetStubStats();
+    return context;
+}
+
+// Press a key and release it once fcitx answered the press, so that the
+// release doesn't have to follow a pending key to the bus.
+bool typeKey(QPlatformInputContext *context, FcitxBenchmarkWindow &window,
+             uint keysym) {
+    const int commits = window.commits();
+    fcitxSendKey(context, keysym, false);
+    // The commit of the key comes before its reply.
+    const bool committed = fcitxWaitFor(
+        [&window, commits]() { return window.commits() > commits; }, 1000);
+    fcitxWaitFor([]() { return false; }, 10);
+    fcitxSendKey(context, keysym, true);
+    return committed;
+}
+
+// Logs commits and key presses in the order they arrive, a key as #.
+class FcitxLogWindow : public FcitxBenchmarkWindow {
+public:
+    const QString &log() const { return m_log; }
+
+    bool event(QEvent *event) override {
+        if (event->type() == QEvent::InputMethod) {
+            m_log += static_cast<QInputMethodEvent *>(event)->commitString();
+        }
+        return FcitxBenchmarkWindow::event(event);
+    }
+
+protected:
+    void keyPressEvent(QKeyEvent *event) override {
+        m_log += '#';
+        FcitxBenchmarkWindow::keyPressEvent(event);
+    }
+
+private:
+    QString m_log;
+};
+
+bool report(QJsonObject result, bool passed) {
+    result["passed"] = passed;
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact)
+                       .constData());
+    fflush(stdout);
+    return passed;
+}
+
+bool checkReleases(FcitxBenchmarkBus &bus, const Options &options,
+                   bool interest) {
+    FcitxBenchmarkWindow window;
+    QStringList arguments;
+    if (interest) {
+        arguments << "--release-interest";
+    }
+    auto context = setUp(bus, options, arguments, window);
+    if (!context) {
+        return false;
+    }
+
+    int missed = 0;
+    for (int i = 0; i < options.keys; i++) {
+        if (!typeKey(context.get(), window, 'a' + i % 26)) {
+            missed++;
+        }
+    }
+    // A modifier release is something fcitx always asks for.
+    fcitxSendKey(context.get(), XK_Shift_L, false);
+    fcitxWaitFor([]() { return false; }, 10);
+    fcitxSendKey(context.get(), XK_Shift_L, true, ShiftState);
+    fcitxWaitFor([]() { return false; }, 100);
+
+    const QVariantMap stats = bus.stubStats();
+    const quint64 releases = stats.value("releases").toULongLong();
+    const quint64 expected = interest ? 1 : options.keys + 1;
+    QJsonObject result;
+    result["check"] = interest ? "release-interest" : "release-all";
+    result["keys"] = options.keys;
+    result["missed"] = missed;
+    result["releases"] = static_cast<qint64>(releases);
+    result["expected_releases"] = static_cast<qint64>(expected);
+
+    context.reset();
+    bus.stopStub();
+    return report(result, missed == 0 && releases == expected);
+}
+
+bool checkSharedMemory(FcitxBenchmarkBus &bus, const Options &options) {
+    qputenv("FCITX_QT_USE_SHM", "1");
+    qputenv("FCITX_QT_KEY_DEADLINE", QByteArray::number(KeyDeadline));
+    // Forwarded keys reach the window right away like commits do, or the
+    // log would have them late.
+    QWindowSystemInterface::setSynchronousWindowSystemEvents(true);
+    FcitxLogWindow window;
+    auto context = setUp(bus, options, {"--shared-memory"}, window);
+    qputenv("FCITX_QT_USE_SHM", "0");
+    qunsetenv("FCITX_QT_KEY_DEADLINE");
+    if (!context) {
+        QWindowSystemInterface::setSynchronousWindowSystemEvents(false);
+        return false;
+    }
+
+    // Each key right after a focus out and in.
+    const int commits = window.commits();
+    for (int i = 0; i < options.keys; i++) {
+        context->setFocusObject(&window);
+        fcitxSendKey(context.get(), 'a' + i % 26, false);
+        fcitxSendKey(context.get(), 'a' + i % 26, true);
+    }
+    const bool focusAnswered = fcitxWaitFor(
+        [&window, commits, &options]() {
+            return window.commits() >= commits + options.keys;
+        },
+        5000);
+
+    // Commits and forwarded keys interleaved, typed while the stub can't
+    // read the ring.
+    QString expected;
+    const int start = window.log().size();
+    kill(bus.stubPid(), SIGSTOP);
+    for (int i = 0; i < RingBurst; i++) {
+        const uint keysym = 'a' + i % 26;
+        for (uint key : {keysym, XK_Return}) {
+            fcitxSendKey(context.get(), key, false);
+            fcitxSendKey(context.get(), key, true);
+        }
+        expected += QChar(keysym);
+        expected += '#';
+    }
+    kill(bus.stubPid(), SIGCONT);
+    fcitxWaitFor(
+        [&window, start, &expected]() {
+            return window.log().size() - start >= expected.size();
+        },
+        5000);
+    fcitxWaitFor([]() { return false; }, 100);
+    const QString log = window.log().mid(start);
+
+    const QVariantMap stats = bus.stubStats();
+    const quint64 keys = stats.value("keys").toULongLong();
+    const quint64 sharedKeys = stats.value("sharedKeys").toULongLong();
+    const quint64 unfocusedKeys = stats.value("unfocusedKeys").toULongLong();
+    // What reached the window out of order or not at all.
+    int misplaced = std::abs(log.size() - expected.size());
+    for (int i = 0; i < std::min(log.size(), expected.size()); i++) {
+        if (log[i] != expected[i]) {
+            misplaced++;
+        }
+    }
+
+    // Not answered at all, the key is forwarded once the deadline passed.
+    const int stalledStart = window.log().size();
+    kill(bus.stubPid(), SIGSTOP);
+    fcitxSendKey(context.get(), XK_Return, false);
+    fcitxSendKey(context.get(), XK_Return, true);
+    const bool expired = fcitxWaitFor(
+        [&window, stalledStart]() {
+            return window.log().size() > stalledStart;
+        },
+        KeyDeadline * 3);
+    kill(bus.stubPid(), SIGCONT);
+
+    QJsonObject result;
+    result["check"] = "shared-memory";
+    result["keys"] = static_cast<qint64>(keys);
+    result["shared_keys"] = static_cast<qint64>(sharedKeys);
+    result["unfocused_keys"] = static_cast<qint64>(unfocusedKeys);
+    result["misplaced"] = misplaced;
+    result["expired"] = expired;
+
+    context.reset();
+    bus.stopStub();
+    QWindowSystemInterface::setSynchronousWindowSystemEvents(false);
+    return report(result, focusAnswered && keys > 0 && sharedKeys == keys &&
+                              unfocusedKeys == 0 && misplaced == 0 &&
+                              expired);
+}
+
+bool checkAutoRepeat(FcitxBenchmarkBus &bus, const Options &options) {
+    FcitxBenchmarkWindow window;
+    // Backspace is handled as long as there is a preedit, it starts with
+    // the x of setUp.
+    auto context = setUp(bus, options, {"--pattern", "preedit"}, window);
+    if (!context) {
+        return false;
+    }
+
+    // No reply is handled before the event loop runs, so the backlog
+    // builds up like with a slow fcitx.
+    const int preedits = window.preedits();
+    fcitxSendKey(context.get(), XK_BackSpace, false);
+    for (int i = 0; i < Repeats; i++) {
+        // Like X11, every repeat is a release and a press.
+        fcitxSendKey(context.get(), XK_BackSpace, true, 0, 0, true);
+        fcitxSendKey(context.get(), XK_BackSpace, false, 0, 0, true);
+    }
+    fcitxSendKey(context.get(), XK_BackSpace, true);
+    fcitxSendKey(context.get(), 'y', false);
+    fcitxSendKey(context.get(), 'y', true);
+    // The preedit of backspace and y, and then whatever would follow them.
+    fcitxWaitFor(
+        [&window, preedits]() { return window.preedits() >= preedits + 2; },
+        1000);
+    fcitxWaitFor([]() { return false; }, 100);
+
+    const QList<uint> keys = bus.stubKeys();
+    const int presses = keys.count(XK_BackSpace);
+    // Held back repeats sent after the release would delete the y.
+    const int lastPress = keys.lastIndexOf(XK_BackSpace);
+    const int lastRelease = keys.lastIndexOf(XK_BackSpace | ReleaseFlag);
+    const int typed = keys.indexOf('y');
+    QJsonObject result;
+    result["check"] = "autorepeat";
+    result["repeats"] = Repeats;
+    result["backspace_presses"] = presses;
+    result["last_press"] = lastPress;
+    result["last_release"] = lastRelease;
+    result["typed"] = typed;
+
+    context.reset();
+    bus.stopStub();
+    return report(result, presses > 0 && presses <= Repeats &&
+                              lastPress < lastRelease && lastRelease < typed);
+}
+
+// Does for a key what any QtDBus client of fcitx has to: the call, the
+// CommitString signal delivered to the window and the reply. It's what the
+// im module is measured against.
+class FcitxBareClient : public QObject {
+    Q_OBJECT
+public:
+    FcitxBareClient(const QDBusConnection &connection, const QString &service,
+                    QWindow *window)
+        : m_connection(connection), m_service(service), m_window(window) {}
+
+    bool createInputContext() {
+        QDBusMessage reply = m_connection.call(QDBusMessage::createMethodCall(
+            m_service, "/org/freedesktop/portal/inputmethod",
+            "org.fcitx.Fcitx.InputMethod1", "CreateInputContext"));
+        if (reply.type() != QDBusMessage::ReplyMessage ||
+            reply.arguments().isEmpty()) {
+            return false;
+        }
+        m_path = qdbus_cast<QDBusObjectPath>(reply.arguments().at(0)).path();
+        m_connection.call(QDBusMessage::createMethodCall(
+            m_service, m_path, "org.fcitx.Fcitx.InputContext1", "FocusIn"));
+        return m_connection.connect(m_service, m_path,
+                                    "org.fcitx.Fcitx.InputContext1",
+                                    "CommitString", this,
+                                    SLOT(commitString(QString)));
+    }
+
+    // Its reply bumps replies.
+    bool sendKey(uint keysym) {
+        QDBusMessage message = QDBusMessage::createMethodCall(
+            m_service, m_path, "org.fcitx.Fcitx.InputContext1",
+            "ProcessKeyEvent");
+        message.setArguments({QVariant(keysym), QVariant(0u), QVariant(0u),
+                              QVariant(false), QVariant(0u)});
+        return m_connection.callWithCallback(message, this,
+                                             SLOT(replied(QDBusMessage)),
+                                             SLOT(failed(QDBusError)));
+    }
+    int replies() const { return m_replies; }
+
+private Q_SLOTS:
+    void commitString(const QString &text) {
+        QInputMethodEvent event;
+        event.setCommitString(text);
+        QCoreApplication::sendEvent(m_window, &event);
+    }
+    void replied(const QDBusMessage &reply) {
+        Q_UNUSED(reply);
+        m_replies++;
+    }
+    void failed(const QDBusError &error) {
+        Q_UNUSED(error);
+    }
+
+private:
+    QDBusConnection m_connection;
+    QString m_service;
+    QString m_path;
+    QWindow *m_window;
+    int m_replies = 0;
+};
+
+bool checkAllocations(FcitxBenchmarkBus &bus, const Options &options) {
+#if defined(__GLIBC__)
+    FcitxBenchmarkWindow window;
+    // Without ProcessKeyEventBatch, so that the im module makes the same call
+    // as the bare client.
+    auto context =
+        setUp(bus, options, {"--release-interest", "--no-batch"}, window);
+    if (!context) {
+        return false;
+    }
+
+    FcitxBareClient client(bus.connection(), bus.stubService(), &window);
+    if (!client.createInputContext()) {
+        fprintf(stderr, "Failed to create the bare input context.\n");
+        return false;
+    }
+    // Counted like the keys of the im module below, after the same warm up.
+    guiAllocations = 0;
+    for (int i = 0; i < 50 + options.keys; i++) {
+        QTimer deadline;
+        deadline.setSingleShot(true);
+        deadline.start(1000);
+        const int replies = client.replies();
+
+        countingAllocations = i >= 50;
+        client.sendKey('a' + i % 26);
+        while (client.replies() == replies && deadline.isActive()) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+        countingAllocations = false;
+    }
+    const quint64 baselineAllocations = guiAllocations;
+    // Caches, vectors and QtDBus reach their steady state.
+    for (int i = 0; i < 50; i++) {
+        typeKey(context.get(), window, 'a' + i % 26);
+    }
+
+    guiAllocations = 0;
+    processAllocations = 0;
+    quint64 releaseAllocations = 0;
+    int missed = 0;
+    for (int i = 0; i < options.keys; i++) {
+        // What the platform plugin would have made, outside of the count.
+        const uint keysym = 'a' + i % 26;
+        const QString text(QChar(keysym));
+        QKeyEvent press(QEvent::KeyPress, Qt::Key_A + i % 26, Qt::NoModifier,
+                        0, keysym, 0, text);
+        QKeyEvent release(QEvent::KeyRelease, Qt::Key_A + i % 26,
+                          Qt::NoModifier, 0, keysym, 0, text);
+        QTimer deadline;
+        deadline.setSingleShot(true);
+        deadline.start(1000);
+        const int commits = window.commits();
+
+        // The commit comes with the reply, right before it is handled.
+        countingAllocations = true;
+        context->filterEvent(&press);
+        while (window.commits() == commits && deadline.isActive()) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+        countingAllocations = false;
+        if (window.commits() == commits) {
+            missed++;
+        }
+
+        const quint64 allocations = guiAllocations;
+        countingAllocations = true;
+        context->filterEvent(&release);
+        countingAllocations = false;
+        releaseAllocations += guiAllocations - allocations;
+        guiAllocations = allocations;
+    }
+
+    const double keys = options.keys;
+    const double perKey = guiAllocations / keys;
+    const double baselinePerKey = baselineAllocations / keys;
+    const double overhead = perKey - baselinePerKey;
+    QJsonObject result;
+    result["check"] = "allocations";
+    result["keys"] = options.keys;
+    result["missed"] = missed;
+    result["allocations_per_key"] = perKey;
+    result["baseline_allocations_per_key"] = baselinePerKey;
+    result["overhead_per_key"] = overhead;
+    result["process_allocations_per_key"] = processAllocations / keys;
+    result["release_allocations"] = static_cast<qint64>(releaseAllocations);
+    result["max_overhead_per_key"] = options.maxOverhead;
+
+    context.reset();
+    bus.stopStub();
+    return report(result, missed == 0 && releaseAllocations == 0 &&
+                              (options.maxOverhead < 0 ||
+                               overhead <= options.maxOverhead));
+#else
+    Q_UNUSED(bus);
+    Q_UNUSED(options);
+    QJsonObject result;
+    result["check"] = "allocations";
+    result["skipped"] = "no malloc hook without glibc";
+    return report(result, true);
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    guiThread = pthread_self();
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    // Whatever the environment of the test says, the checks pick the modes.
+    qputenv("FCITX_QT_USE_SYNC", "0");
+    qputenv("FCITX_QT_USE_SHM", "0");
+    qputenv("FCITX_QT_SUPPRESS_KEY_RELEASE", "1");
+    FcitxBenchmarkBus bus;
+    if (!bus.start()) {
+        fprintf(stderr, "Failed to start dbus-daemon.\n");
+        return 1;
+    }
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Checks of the fcitx im module traffic against a stub daemon.");
+    parser.addHelpOption();
+    QCommandLineOption pluginOption(
+        "plugin", "The im module, not needed with a static plugin.", "path");
+    QCommandLineOption stubOption("stub", "The fcitx-stub-daemon program.",
+                                  "path", "fcitx-stub-daemon");
+    QCommandLineOption keysOption("keys", "Keys per check.", "count", "100");
+    QCommandLineOption maxOverheadOption(
+        "max-overhead",
+        "Heap allocations a key press may make on the GUI thread on top of "
+        "those of a bare QtDBus client, -1 doesn't check.",
+        "count", "-1");
+    QCommandLineOption checksOption("checks", "Comma separated checks to run.",
+                                    "checks",
+                                    "release-interest,release-all,"
+                                    "shared-memory,autorepeat,allocations");
+    parser.addOptions({pluginOption, stubOption, keysOption,
+                       maxOverheadOption, checksOption});
+    parser.process(app);
+
+    Options options;
+    options.plugin = parser.value(pluginOption);
+    options.stub = parser.value(stubOption);
+    options.keys = std::max(1, parser.value(keysOption).toInt());
+    options.maxOverhead = parser.value(maxOverheadOption).toInt();
+
+    bool ok = true;
+    for (const QString &check : parser.value(checksOption).split(',')) {
+        if (check.isEmpty()) {
+            continue;
+        }
+        if (check == "release-interest") {
+            ok = checkReleases(bus, options, true) && ok;
+        } else if (check == "release-all") {
+            ok = checkReleases(bus, options, false) && ok;
+        } else if (check == "shared-memory") {
+            ok = checkSharedMemory(bus, options) && ok;
+        } else if (check == "autorepeat") {
+            ok = checkAutoRepeat(bus, options) && ok;
+        } else if (check == "allocations") {
+            ok = checkAllocations(bus, options) && ok;
+        } else {
+            fprintf(stderr, "Unknown check %s.\n", qPrintable(check));
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+#include "protocoltest.moc"
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+// Replays a session recorded with FCITX_QT_RECORD through the im module
+// against fcitx-stub-daemon on a private bus, and prints a JSON report
+// comparing the key latency of the recording with the replay:
+//   original  press to the key result of fcitx, as the im module saw it
+//   replay    press to the first commit, preedit or key reaching the window
+// --speed 2 replays twice as fast, 0 sends each input as soon as the
+// previous key got its answer. With --baseline, the report of an earlier
+// replay, e.g. with the last release, is compared too, and the exit code is
+// 1 if the p99 got more than --max-regression percent worse.
+
+#include "fcitxbenchmark.h"
+#include "fcitxsessionrecorder.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <qpa/qplatforminputcontext.h>
+
+namespace {
+
+struct Options {
+    QString trace;
+    QString plugin;
+    QString stub;
+    double speed = 1;
+    QString baseline;
+    double maxRegression = 0;
+};
+
+QJsonObject latencyObject(const std::vector<qint64> &latencies) {
+    QJsonObject result;
+    result["p50_us"] = fcitxPercentile(latencies, 0.5) / 1000.0;
+    result["p99_us"] = fcitxPercentile(latencies, 0.99) / 1000.0;
+    result["max_us"] = fcitxPercentile(latencies, 1) / 1000.0;
+    return result;
+}
+
+bool isInput(FcitxSessionRecordType type) {
+    switch (type) {
+    case FcitxSessionRecordType::Key:
+    case FcitxSessionRecordType::Focus:
+    case FcitxSessionRecordType::Query:
+    case FcitxSessionRecordType::SurroundingText:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Key presses matched with the next key result of the same keysym.
+QJsonObject originalLatency(const std::vector<FcitxSessionRecord> &records) {
+    std::map<quint32, std::deque<qint64>> pending;
+    std::vector<qint64> latencies;
+    qint64 time = 0;
+    for (const FcitxSessionRecord &record : records) {
+        time += record.delta;
+        const bool isRelease = record.flags & 1;
+        if (record.type == FcitxSessionRecordType::Key && !isRelease) {
+            pending[record.args[0]].push_back(time);
+        } else if (record.type == FcitxSessionRecordType::KeyResult &&
+                   !isRelease) {
+            auto &presses = pending[record.args[0]];
+            if (!presses.empty()) {
+                latencies.push_back((time - presses.front()) * 1000);
+                presses.pop_front();
+            }
+        }
+    }
+    QJsonObject result = latencyObject(latencies);
+    result["keys"] = static_cast<int>(latencies.size());
+    result["duration_ms"] = time / 1000.0;
+    return result;
+}
+
+class Replayer {
+public:
+    Replayer(QPlatformInputContext *context, const Options &options)
+        : m_context(context), m_options(options) {}
+
+    QJsonObject run(const std::vector<FcitxSessionRecord> &records) {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 time = 0;
+        for (const FcitxSessionRecord &record : records) {
+            time += record.delta;
+            if (!isInput(record.type)) {
+                continue;
+            }
+            if (m_options.speed > 0) {
+                const qint64 due =
+                    static_cast<qint64>(time / m_options.speed / 1000);
+                collect(std::max<qint64>(0, due - timer.elapsed()));
+            } else {
+                collect(m_pending.empty() ? 0 : 1000, true);
+            }
+            replay(record);
+        }
+        collect(1000, true);
+
+        QJsonObject result = latencyObject(m_latencies);
+        result["keys"] = static_cast<int>(m_latencies.size());
+        result["missed"] = static_cast<int>(m_pending.size());
+        result["duration_ms"] = static_cast<double>(timer.elapsed());
+        return result;
+    }
+
+private:
+    FcitxBenchmarkWindow *window(quint8 id) {
+        std::unique_ptr<FcitxBenchmarkWindow> &window = m_windows[id];
+        if (!window) {
+            window.reset(new FcitxBenchmarkWindow);
+        }
+        return window.get();
+    }
+
+    int responses() const {
+        int responses = 0;
+        for (const auto &window : m_windows) {
+            responses += window.second->responses();
+        }
+        return responses;
+    }
+
+    // Process events for timeout milliseconds, or until all keys are
+    // answered if untilAnswered, and take the answers.
+    void collect(qint64 timeout, bool untilAnswered = false) {
+        auto take = [this]() {
+            const int current = responses();
+            for (; m_responses < current; m_responses++) {
+                if (!m_pending.empty()) {
+                    m_latencies.push_back(m_clock.nsecsElapsed() -
+                                          m_pending.front());
+                    m_pending.pop_front();
+                }
+            }
+            return false;
+        };
+        if (untilAnswered) {
+            fcitxWaitFor(
+                [this, &take]() {
+                    take();
+                    return m_pending.empty();
+                },
+                timeout);
+        } else {
+            fcitxWaitFor(take, timeout);
+        }
+    }
+
+    void replay(const FcitxSessionRecord &record) {
+        if (!m_clock.isValid()) {
+            m_clock.start();
+        }
+        switch (record.type) {
+        case FcitxSessionRecordType::Focus:
+            if (record.window) {
+                FcitxBenchmarkWindow *target = window(record.window);
+                target->setInputMethodEnabled(record.flags & 1);
+                target->setHints(record.flags & 2 ? Qt::ImhHiddenText
+                                                  : Qt::ImhNone);
+                target->activate();
+                m_context->setFocusObject(target);
+            } else {
+                m_context->setFocusObject(nullptr);
+            }
+            break;
+        case FcitxSessionRecordType::Key: {
+            const bool isRelease = record.flags & 1;
+            if (!isRelease) {
+                m_pending.push_back(m_clock.nsecsElapsed());
+            }
+            // Keys the im module doesn't filter reach the window right away
+            // and are taken by the next collect.
+            fcitxSendKey(m_context, record.args[0], isRelease, record.args[1],
+                         record.args[2], record.flags & 2);
+            break;
+        }
+        case FcitxSessionRecordType::SurroundingText:
+            window(record.window)
+                ->setSurroundingText(
+                    QString(static_cast<int>(record.args[0]), QChar('a')),
+                    static_cast<int>(record.args[1]),
+                    static_cast<int>(record.args[2]));
+            break;
+        case FcitxSessionRecordType::Query: {
+            const auto queries = Qt::InputMethodQueries(record.args[0]);
+            if (queries & Qt::ImHints) {
+                window(record.window)
+                    ->setHints(Qt::InputMethodHints(record.args[1]));
+            }
+            m_context->update(queries);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    QPlatformInputContext *m_context;
+    const Options &m_options;
+    std::map<quint8, std::unique_ptr<FcitxBenchmarkWindow>> m_windows;
+    QElapsedTimer m_clock;
+    std::deque<qint64> m_pending;
+    std::vector<qint64> m_latencies;
+    int m_responses = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    FcitxBenchmarkBus bus;
+    if (!bus.start()) {
+        fprintf(stderr, "Failed to start dbus-daemon.\n");
+        return 1;
+    }
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Replay a recorded session through the fcitx im module.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "File written by FCITX_QT_RECORD.");
+    QCommandLineOption pluginOption(
+        "plugin", "The im module, not needed with a static plugin.", "path");
+    QCommandLineOption stubOption("stub", "The fcitx-stub-daemon program.",
+                                  "path", "fcitx-stub-daemon");
+    QCommandLineOption speedOption(
+        "speed", "Speed up the recorded timing, 0 doesn't wait.", "factor",
+        "1");
+    QCommandLineOption patternOption(
+        "pattern", "What the stub does with keys: commit or preedit.",
+        "pattern", "commit");
+    QCommandLineOption baselineOption(
+        "baseline", "Report of an earlier replay to compare with.", "path");
+    QCommandLineOption maxRegressionOption(
+        "max-regression",
+        "Fail if the replay p99 is this many percent above the baseline.",
+        "percent", "0");
+    parser.addOptions({pluginOption, stubOption, speedOption, patternOption,
+                       baselineOption, maxRegressionOption});
+    parser.process(app);
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    Options options;
+    options.trace = parser.positionalArguments().at(0);
+    options.plugin = parser.value(pluginOption);
+    options.stub = parser.value(stubOption);
+    options.speed = std::max(0.0, parser.value(speedOption).toDouble());
+    options.baseline = parser.value(baselineOption);
+    options.maxRegression = parser.value(maxRegressionOption).toDouble();
+
+    std::vector<FcitxSessionRecord> records;
+    if (!FcitxSessionRecorder::load(options.trace, records)) {
+        fprintf(stderr, "%s is not a session recording.\n",
+                qPrintable(options.trace));
+        return 1;
+    }
+    if (!bus.startStub(options.stub, QStringList()
+                                         << "--pattern"
+                                         << parser.value(patternOption))) {
+        fprintf(stderr, "Failed to start %s.\n", qPrintable(options.stub));
+        return 1;
+    }
+    std::unique_ptr<QPlatformInputContext> context(
+        fcitxCreateInputContext(options.plugin));
+    if (!context) {
+        return 1;
+    }
+
+    QJsonObject report;
+    report["trace"] = options.trace;
+    report["records"] = static_cast<int>(records.size());
+    report["speed"] = options.speed;
+    const QJsonObject original = originalLatency(records);
+    const QJsonObject replayed = Replayer(context.get(), options).run(records);
+    report["original"] = original;
+    report["replay"] = replayed;
+    if (original["p99_us"].toDouble() > 0) {
+        report["p99_change_percent"] =
+            (replayed["p99_us"].toDouble() / original["p99_us"].toDouble() -
+             1) *
+            100;
+    }
+
+    bool ok = true;
+    if (!options.baseline.isEmpty()) {
+        QFile file(options.baseline);
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "Failed to read %s.\n",
+                    qPrintable(options.baseline));
+            return 1;
+        }
+        const QJsonObject baseline =
+            QJsonDocument::fromJson(file.readAll()).object()["replay"]
+                .toObject();
+        report["baseline"] = baseline;
+        if (baseline["p99_us"].toDouble() > 0) {
+            const double regression = (replayed["p99_us"].toDouble() /
+                                           baseline["p99_us"].toDouble() -
+                                       1) *
+                                      100;
+            report["p99_regression_percent"] = regression;
+            ok = options.maxRegression <= 0 ||
+                 regression <= options.maxRegression;
+        }
+    }
+    printf("%s\n", QJsonDocument(report).toJson().constData());
+    return ok ? 0 : 1;
+}
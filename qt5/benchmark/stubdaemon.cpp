@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxstubdaemon.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Stub fcitx daemon for the im module benchmarks.");
+    parser.addHelpOption();
+    QCommandLineOption fcitx4Option("fcitx4",
+                                    "Serve the fcitx 4 interface instead.");
+    QCommandLineOption noBatchOption(
+        "no-batch", "Don't provide ProcessKeyEventBatch.");
+    QCommandLineOption delayOption(
+        "delay", "Milliseconds before each key is answered.", "ms", "0");
+    QCommandLineOption patternOption(
+        "pattern", "What keys do: commit, preedit or passthrough.", "pattern",
+        "commit");
+    QCommandLineOption releaseInterestOption(
+        "release-interest",
+        "Provide GetKeyReleaseInterest, asking for modifier releases only.");
+    QCommandLineOption sharedMemoryOption(
+        "shared-memory", "Provide SetupSharedMemoryTransport.");
+    parser.addOptions({fcitx4Option, noBatchOption, delayOption,
+                       patternOption, releaseInterestOption,
+                       sharedMemoryOption});
+    parser.process(app);
+
+    FcitxStubDaemon::Options options;
+    options.fcitx4 = parser.isSet(fcitx4Option);
+    options.batch = !parser.isSet(noBatchOption);
+    options.delay = parser.value(delayOption).toInt();
+    options.releaseInterest = parser.isSet(releaseInterestOption);
+    options.sharedMemory = parser.isSet(sharedMemoryOption);
+    const QString pattern = parser.value(patternOption);
+    if (pattern == "commit") {
+        options.pattern = FcitxStubDaemon::Pattern::Commit;
+    } else if (pattern == "preedit") {
+        options.pattern = FcitxStubDaemon::Pattern::Preedit;
+    } else if (pattern == "passthrough") {
+        options.pattern = FcitxStubDaemon::Pattern::PassThrough;
+    } else {
+        fprintf(stderr, "Unknown pattern %s.\n", qPrintable(pattern));
+        return 1;
+    }
+
+    FcitxStubDaemon daemon(QDBusConnection::sessionBus(), options);
+    if (!daemon.start()) {
+        fprintf(stderr, "Failed to register %s.\n",
+                qPrintable(daemon.service()));
+        return 1;
+    }
+    // The benchmarks wait for this line.
+    printf("%s\n", qPrintable(daemon.service()));
+    fflush(stdout);
+    return app.exec();
+}
@@ -64,3 +64,36 @@ const QDBusArgument &operator>>(const QDBusArgument &argument,
     preedit.setFormat(format);
     return argument;
 }
+
+void FcitxQtFormattedPreeditText::registerMetaType() {
+    FcitxQtFormattedPreedit::registerMetaType();
+    qRegisterMetaType<FcitxQtFormattedPreeditText>(
+        "FcitxQtFormattedPreeditText");
+    qDBusRegisterMetaType<FcitxQtFormattedPreeditText>();
+}
+
+FcitxQtFormattedPreeditList FcitxQtFormattedPreeditText::toList() const {
+    FcitxQtFormattedPreeditList list;
+    list.reserve(m_segments.size());
+    for (const auto &segment : m_segments) {
+        FcitxQtFormattedPreedit preedit;
+        preedit.setString(m_text.mid(segment.offset, segment.length));
+        preedit.setFormat(segment.format);
+        list << preedit;
+    }
+    return list;
+}
+
+FCITXQTDBUSADDONS_EXPORT
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxQtFormattedPreeditText &text) {
+    text.write(argument, qMetaTypeId<FcitxQtFormattedPreedit>());
+    return argument;
+}
+
+FCITXQTDBUSADDONS_EXPORT
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxQtFormattedPreeditText &text) {
+    text.read(argument);
+    return argument;
+}
@@ -21,8 +21,10 @@
 #define FCITX_QT_FORMATTED_PREEDIT_H
 
 #include "fcitxqtdbusaddons_export.h"
+#include "fcitxqtpreeditsegments.h"
 
 #include <QtCore/QMetaType>
+#include <QtCore/QVector>
 #include <QtDBus/QDBusArgument>
 
 class FCITXQTDBUSADDONS_EXPORT FcitxQtFormattedPreedit {
@@ -48,7 +50,27 @@ QDBusArgument &operator<<(QDBusArgument &argument,
 const QDBusArgument &operator>>(const QDBusArgument &argument,
                                 FcitxQtFormattedPreedit &im);
 
+/**
+ * Same wire format as FcitxQtFormattedPreeditList, a(si), but all segments
+ * share one string. It can be used in place of the list when connecting to
+ * UpdateFormattedPreedit with QDBusConnection::connect, so decoding a
+ * preedit doesn't keep one string per segment.
+ */
+class FCITXQTDBUSADDONS_EXPORT FcitxQtFormattedPreeditText
+    : public FcitxQtPreeditSegments {
+public:
+    FcitxQtFormattedPreeditList toList() const;
+
+    static void registerMetaType();
+};
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxQtFormattedPreeditText &text);
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxQtFormattedPreeditText &text);
+
 Q_DECLARE_METATYPE(FcitxQtFormattedPreedit)
 Q_DECLARE_METATYPE(FcitxQtFormattedPreeditList)
+Q_DECLARE_METATYPE(FcitxQtFormattedPreeditText)
 
 #endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#ifndef FCITX_QT_PREEDIT_SEGMENTS_H
+#define FCITX_QT_PREEDIT_SEGMENTS_H
+
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtDBus/QDBusArgument>
+
+/**
+ * A formatted preedit as one string and the offset, length and format of
+ * each segment in it, so keeping a preedit only allocates a constant number
+ * of buffers.
+ *
+ * Header only, it is shared by FcitxQtFormattedPreeditText and the platform
+ * input context plugin, which doesn't link this library.
+ */
+class FcitxQtPreeditSegments {
+public:
+    struct Segment {
+        int offset;
+        int length;
+        qint32 format;
+    };
+
+    const QString &text() const { return m_text; }
+    const QVector<Segment> &segments() const { return m_segments; }
+    bool isEmpty() const { return m_segments.isEmpty(); }
+
+    void append(const QString &str, qint32 format) {
+        // Preedit is nowhere near INT_MAX, but QString's size type is wider
+        // with Qt 6.
+        m_segments.append(Segment{static_cast<int>(m_text.length()),
+                                  static_cast<int>(str.length()), format});
+        m_text += str;
+    }
+
+    void clear() {
+        m_text.clear();
+        m_segments.clear();
+    }
+
+    bool operator==(const FcitxQtPreeditSegments &other) const {
+        if (other.m_text != m_text ||
+            other.m_segments.size() != m_segments.size()) {
+            return false;
+        }
+        for (int i = 0; i < m_segments.size(); i++) {
+            if (other.m_segments[i].length != m_segments[i].length ||
+                other.m_segments[i].format != m_segments[i].format) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Write as a(si), elementType is the meta type of the (si) structure.
+     */
+    void write(QDBusArgument &argument, int elementType) const {
+        argument.beginArray(elementType);
+        for (const auto &segment : m_segments) {
+            argument.beginStructure();
+            argument << m_text.mid(segment.offset, segment.length);
+            argument << segment.format;
+            argument.endStructure();
+        }
+        argument.endArray();
+    }
+
+    void read(const QDBusArgument &argument) {
+        QString str;
+        qint32 format;
+        clear();
+        argument.beginArray();
+        while (!argument.atEnd()) {
+            argument.beginStructure();
+            argument >> str >> format;
+            argument.endStructure();
+            append(str, format);
+        }
+        argument.endArray();
+    }
+
+protected:
+    QString m_text;
+    QVector<Segment> m_segments;
+};
+
+Q_DECLARE_TYPEINFO(FcitxQtPreeditSegments::Segment, Q_PRIMITIVE_TYPE);
+
+#endif // FCITX_QT_PREEDIT_SEGMENTS_H
@@ -0,0 +1,714 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+// Generates D-Bus proxy classes from introspection XML. The classes have the
+// same interface as the ones from qdbusxml2cpp, but the calls build their
+// QDBusMessage directly instead of going through a QList<QVariant> and
+// asyncCallWithArgumentList, and every method with a reply also gets a typed
+// message builder and reply decoder for callers that drive the connection
+// themselves.
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QXmlStreamReader>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+typedef QMap<QString, QString> Annotations;
+
+struct Argument {
+    QString name;
+    QString type;
+    bool out = false;
+};
+
+struct Method {
+    QString name;
+    QList<Argument> inputs;
+    QList<Argument> outputs;
+    Annotations annotations;
+};
+
+struct Property {
+    QString name;
+    QString type;
+    bool readable = false;
+    bool writable = false;
+    Annotations annotations;
+};
+
+struct Interface {
+    QString name;
+    QMap<QString, Method> methods;
+    QMap<QString, Method> signals_;
+    QMap<QString, Property> properties;
+};
+
+struct Options {
+    QString className;
+    QString basename;
+    QString exportMacro;
+    QStringList includes;
+    bool noNamespace = false;
+    QString input;
+    QString commandLine;
+};
+
+void error(const QString &message) {
+    fprintf(stderr, "fcitx-dbusproxygen: %s\n", qPrintable(message));
+    exit(1);
+}
+
+void readAnnotation(QXmlStreamReader &xml, Annotations &annotations) {
+    const auto attributes = xml.attributes();
+    annotations[attributes.value("name").toString()] =
+        attributes.value("value").toString();
+    xml.skipCurrentElement();
+}
+
+void readMember(QXmlStreamReader &xml, Method &method, bool isSignal) {
+    method.name = xml.attributes().value("name").toString();
+    while (xml.readNextStartElement()) {
+        if (xml.name() == QLatin1String("arg")) {
+            const auto attributes = xml.attributes();
+            Argument arg;
+            arg.name = attributes.value("name").toString();
+            arg.type = attributes.value("type").toString();
+            arg.out = !isSignal &&
+                      attributes.value("direction") == QLatin1String("out");
+            if (arg.out) {
+                method.outputs << arg;
+            } else {
+                method.inputs << arg;
+            }
+            while (xml.readNextStartElement()) {
+                if (xml.name() == QLatin1String("annotation")) {
+                    readAnnotation(xml, method.annotations);
+                } else {
+                    xml.skipCurrentElement();
+                }
+            }
+        } else if (xml.name() == QLatin1String("annotation")) {
+            readAnnotation(xml, method.annotations);
+        } else {
+            xml.skipCurrentElement();
+        }
+    }
+}
+
+void readProperty(QXmlStreamReader &xml, Property &property) {
+    const auto attributes = xml.attributes();
+    property.name = attributes.value("name").toString();
+    property.type = attributes.value("type").toString();
+    const auto access = attributes.value("access");
+    property.readable = access == QLatin1String("read") ||
+                        access == QLatin1String("readwrite");
+    property.writable = access == QLatin1String("write") ||
+                        access == QLatin1String("readwrite");
+    while (xml.readNextStartElement()) {
+        if (xml.name() == QLatin1String("annotation")) {
+            readAnnotation(xml, property.annotations);
+        } else {
+            xml.skipCurrentElement();
+        }
+    }
+}
+
+QList<Interface> parse(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error(QString("cannot open %1").arg(fileName));
+    }
+    QList<Interface> interfaces;
+    QXmlStreamReader xml(&file);
+    if (!xml.readNextStartElement() || xml.name() != QLatin1String("node")) {
+        error(QString("%1 is not an introspection file").arg(fileName));
+    }
+    while (xml.readNextStartElement()) {
+        if (xml.name() != QLatin1String("interface")) {
+            xml.skipCurrentElement();
+            continue;
+        }
+        Interface iface;
+        iface.name = xml.attributes().value("name").toString();
+        while (xml.readNextStartElement()) {
+            if (xml.name() == QLatin1String("method")) {
+                Method method;
+                readMember(xml, method, false);
+                iface.methods[method.name] = method;
+            } else if (xml.name() == QLatin1String("signal")) {
+                Method signal;
+                readMember(xml, signal, true);
+                iface.signals_[signal.name] = signal;
+            } else if (xml.name() == QLatin1String("property")) {
+                Property property;
+                readProperty(xml, property);
+                iface.properties[property.name] = property;
+            } else {
+                xml.skipCurrentElement();
+            }
+        }
+        interfaces << iface;
+    }
+    if (xml.hasError()) {
+        error(QString("%1:%2: %3")
+                  .arg(fileName)
+                  .arg(xml.lineNumber())
+                  .arg(xml.errorString()));
+    }
+    return interfaces;
+}
+
+// Types QtDBus demarshals by itself, the rest needs an annotation.
+QString basicType(const QString &signature) {
+    static const QHash<QString, QString> types = {
+        {"y", "uchar"},
+        {"b", "bool"},
+        {"n", "short"},
+        {"q", "ushort"},
+        {"i", "int"},
+        {"u", "uint"},
+        {"x", "qlonglong"},
+        {"t", "qulonglong"},
+        {"d", "double"},
+        {"h", "QDBusUnixFileDescriptor"},
+        {"s", "QString"},
+        {"o", "QDBusObjectPath"},
+        {"g", "QDBusSignature"},
+        {"v", "QDBusVariant"},
+        {"as", "QStringList"},
+        {"ay", "QByteArray"},
+        {"ao", "QList<QDBusObjectPath>"},
+        {"a{sv}", "QVariantMap"},
+    };
+    return types.value(signature);
+}
+
+// Types QVariant has a constructor for, that store the value in place
+// without the QVariant::fromValue() metatype lookup and copy.
+bool hasVariantConstructor(const QString &type) {
+    static const QStringList types = {
+        "bool",       "int",    "uint",    "qlonglong",   "qulonglong",
+        "double",     "QString", "QStringList", "QByteArray", "QVariantMap"};
+    return types.contains(type);
+}
+
+bool isPassedByValue(const QString &type) {
+    static const QStringList types = {"uchar", "bool",      "short",
+                                      "ushort", "int",       "uint",
+                                      "qlonglong", "qulonglong", "double"};
+    return types.contains(type);
+}
+
+QString qtType(const QString &signature, const Annotations &annotations,
+               const QStringList &annotationSuffixes) {
+    QString type = basicType(signature);
+    if (!type.isEmpty()) {
+        return type;
+    }
+    const QStringList prefixes = {"org.qtproject.QtDBus.QtTypeName",
+                                  "com.trolltech.QtDBus.QtTypeName"};
+    for (const auto &prefix : prefixes) {
+        for (const auto &suffix : annotationSuffixes) {
+            type = annotations.value(prefix + suffix);
+            if (!type.isEmpty()) {
+                return type;
+            }
+        }
+    }
+    error(QString("no type annotation for signature %1").arg(signature));
+    return QString();
+}
+
+QString argumentName(const Argument &arg, const QString &prefix, int index) {
+    static const QStringList keywords = {
+        "bool",   "char",     "class",   "const",  "default", "delete",
+        "double", "enum",     "float",   "int",    "long",    "new",
+        "short",  "signals",  "signed",  "slots",  "static",  "struct",
+        "switch", "template", "this",    "throw",  "typedef", "union",
+        "unsigned", "void",   "volatile"};
+    if (arg.name.isEmpty()) {
+        return QString("%1%2").arg(prefix).arg(index);
+    }
+    if (keywords.contains(arg.name)) {
+        return arg.name + QLatin1Char('_');
+    }
+    return arg.name;
+}
+
+QString constRef(const QString &type) {
+    if (isPassedByValue(type)) {
+        return type + QLatin1Char(' ');
+    }
+    return QString("const %1 &").arg(type);
+}
+
+QString upperFirst(QString name) {
+    name[0] = name[0].toUpper();
+    return name;
+}
+
+QString lowerFirst(QString name) {
+    name[0] = name[0].toLower();
+    return name;
+}
+
+QString defaultClassName(const QString &iface) {
+    QString name;
+    for (const auto &part : iface.split(QLatin1Char('.'))) {
+        name += upperFirst(part);
+    }
+    return name + QLatin1String("Interface");
+}
+
+QStringList inputTypes(const Method &method) {
+    QStringList types;
+    for (int i = 0; i < method.inputs.size(); i++) {
+        types << qtType(method.inputs[i].type, method.annotations,
+                        {QString(".In%1").arg(i)});
+    }
+    return types;
+}
+
+QStringList outputTypes(const Method &method) {
+    QStringList types;
+    for (int i = 0; i < method.outputs.size(); i++) {
+        types << qtType(method.outputs[i].type, method.annotations,
+                        {QString(".Out%1").arg(i)});
+    }
+    return types;
+}
+
+QStringList signalTypes(const Method &signal) {
+    // qdbusxml2cpp has been using both directions for signals over time.
+    QStringList types;
+    for (int i = 0; i < signal.inputs.size(); i++) {
+        types << qtType(signal.inputs[i].type, signal.annotations,
+                        {QString(".Out%1").arg(i), QString(".In%1").arg(i)});
+    }
+    return types;
+}
+
+QString inputParameters(const Method &method, const QStringList &types) {
+    QStringList parameters;
+    for (int i = 0; i < method.inputs.size(); i++) {
+        parameters << constRef(types[i]) +
+                          argumentName(method.inputs[i], "in", i);
+    }
+    return parameters.join(", ");
+}
+
+QString inputNames(const Method &method) {
+    QStringList names;
+    for (int i = 0; i < method.inputs.size(); i++) {
+        names << argumentName(method.inputs[i], "in", i);
+    }
+    return names.join(", ");
+}
+
+void writeMethod(QTextStream &out, const Method &method) {
+    const QStringList in = inputTypes(method);
+    const QStringList outTypes = outputTypes(method);
+    const QString parameters = inputParameters(method, in);
+    const QString names = inputNames(method);
+    const bool noReply =
+        method.annotations.value("org.freedesktop.DBus.Method.NoReply") ==
+        QLatin1String("true");
+
+    if (noReply) {
+        out << "    Q_NOREPLY inline void " << method.name << "(" << parameters
+            << ")\n"
+            << "    {\n"
+            << "        connection().send(create" << method.name
+            << "Message(" << names << "));\n"
+            << "    }\n\n";
+        return;
+    }
+
+    out << "    inline QDBusPendingReply<" << outTypes.join(", ") << "> "
+        << method.name << "(" << parameters << ")\n"
+        << "    {\n"
+        << "        return connection().asyncCall(create" << method.name
+        << "Message(" << names << "), timeout());\n"
+        << "    }\n";
+
+    if (outTypes.size() > 1) {
+        QStringList syncParameters;
+        if (!parameters.isEmpty()) {
+            syncParameters << parameters;
+        }
+        QStringList decodeNames;
+        decodeNames << "ret";
+        for (int i = 1; i < outTypes.size(); i++) {
+            const QString name = argumentName(method.outputs[i], "out", i);
+            syncParameters << QString("%1 &%2").arg(outTypes[i], name);
+            decodeNames << name;
+        }
+        out << "    inline QDBusReply<" << outTypes[0] << "> " << method.name
+            << "(" << syncParameters.join(", ") << ")\n"
+            << "    {\n"
+            << "        QDBusMessage reply = connection().call(create"
+            << method.name << "Message(" << names
+            << "), QDBus::Block, timeout());\n"
+            << "        " << outTypes[0] << " ret;\n"
+            << "        decode" << method.name << "Reply(reply, "
+            << decodeNames.join(", ") << ");\n"
+            << "        return reply;\n"
+            << "    }\n";
+    }
+    out << "\n";
+}
+
+void writeBuilder(QTextStream &out, const Method &method) {
+    const QStringList in = inputTypes(method);
+    out << "    inline QDBusMessage create" << method.name << "Message("
+        << inputParameters(method, in) << ") const\n"
+        << "    {\n"
+        << "        QDBusMessage message = QDBusMessage::createMethodCall("
+           "service(), path(), interface(), QStringLiteral(\""
+        << method.name << "\"));\n";
+    if (!method.inputs.isEmpty()) {
+        // QDBusMessage only takes arguments as QVariant, but the basic types
+        // don't need to be boxed through their metatype.
+        QStringList arguments;
+        for (int i = 0; i < method.inputs.size(); i++) {
+            const QString name = argumentName(method.inputs[i], "in", i);
+            arguments << (hasVariantConstructor(in[i])
+                              ? QString("QVariant(%1)").arg(name)
+                              : QString("QVariant::fromValue(%1)").arg(name));
+        }
+        out << "        message.setArguments({" << arguments.join(", ")
+            << "});\n";
+    }
+    out << "        return message;\n"
+        << "    }\n\n";
+}
+
+QString signatureOf(const QList<Argument> &args) {
+    QString signature;
+    for (const auto &arg : args) {
+        signature += arg.type;
+    }
+    return signature;
+}
+
+void writeDecoder(QTextStream &out, const Method &method) {
+    const QStringList outTypes = outputTypes(method);
+    QStringList parameters;
+    for (int i = 0; i < outTypes.size(); i++) {
+        parameters << QString("%1 &%2").arg(
+            outTypes[i], i == 0 && outTypes.size() > 1
+                             ? QString("ret")
+                             : argumentName(method.outputs[i], "out", i));
+    }
+    out << "    static inline bool decode" << method.name
+        << "Reply(const QDBusMessage &reply, " << parameters.join(", ")
+        << ")\n"
+        << "    {\n"
+        << "        if (reply.type() != QDBusMessage::ReplyMessage || "
+           "reply.signature() != QLatin1String(\""
+        << signatureOf(method.outputs) << "\")) {\n"
+        << "            return false;\n"
+        << "        }\n"
+        << "        const QList<QVariant> arguments = reply.arguments();\n";
+    for (int i = 0; i < outTypes.size(); i++) {
+        const QString name = i == 0 && outTypes.size() > 1
+                                 ? QString("ret")
+                                 : argumentName(method.outputs[i], "out", i);
+        out << "        " << name << " = qdbus_cast<" << outTypes[i]
+            << ">(arguments.at(" << i << "));\n";
+    }
+    out << "        return true;\n"
+        << "    }\n\n";
+}
+
+void writeProperty(QTextStream &out, const Property &property) {
+    const QString type =
+        qtType(property.type, property.annotations, {QString()});
+    QString getter =
+        property.annotations.value("org.qtproject.QtDBus.PropertyGetter");
+    if (getter.isEmpty()) {
+        getter = lowerFirst(property.name);
+    }
+    QString setter =
+        property.annotations.value("org.qtproject.QtDBus.PropertySetter");
+    if (setter.isEmpty()) {
+        setter = QLatin1String("set") + upperFirst(property.name);
+    }
+
+    out << "    Q_PROPERTY(" << type << " " << property.name;
+    if (property.readable) {
+        out << " READ " << getter;
+    }
+    if (property.writable) {
+        out << " WRITE " << setter;
+    }
+    out << ")\n";
+    if (property.readable) {
+        out << "    inline " << type << " " << getter << "() const\n"
+            << "    { return qvariant_cast< " << type << " >(property(\""
+            << property.name << "\")); }\n";
+    }
+    if (property.writable) {
+        out << "    inline void " << setter << "(" << constRef(type)
+            << "value)\n"
+            << "    { setProperty(\"" << property.name
+            << "\", QVariant::fromValue(value)); }\n";
+    }
+    out << "\n";
+}
+
+void writeSignal(QTextStream &out, const Method &signal) {
+    const QStringList types = signalTypes(signal);
+    QStringList parameters;
+    for (int i = 0; i < signal.inputs.size(); i++) {
+        parameters << constRef(types[i]) +
+                          argumentName(signal.inputs[i], "in", i);
+    }
+    out << "    void " << signal.name << "(" << parameters.join(", ")
+        << ");\n";
+}
+
+void writeBanner(QTextStream &out, const Options &options) {
+    out << "/*\n"
+        << " * This file was generated by fcitx-dbusproxygen\n"
+        << " * Command line was: " << options.commandLine << "\n"
+        << " *\n"
+        << " * This is an auto-generated file.\n"
+        << " * Do not edit! All changes made to it will be lost.\n"
+        << " */\n\n";
+}
+
+QString headerGuard(const QString &fileName) {
+    QString guard = fileName.toUpper();
+    for (auto &c : guard) {
+        if (!c.isLetterOrNumber()) {
+            c = QLatin1Char('_');
+        }
+    }
+    return guard;
+}
+
+QString writeHeader(const Options &options,
+                    const QList<Interface> &interfaces) {
+    QString result;
+    QTextStream out(&result);
+    const QString guard =
+        headerGuard(QFileInfo(options.basename).fileName() + ".h");
+    writeBanner(out, options);
+    out << "#ifndef " << guard << "\n"
+        << "#define " << guard << "\n\n"
+        << "#include <QtCore/QObject>\n"
+        << "#include <QtCore/QByteArray>\n"
+        << "#include <QtCore/QList>\n"
+        << "#include <QtCore/QMap>\n"
+        << "#include <QtCore/QString>\n"
+        << "#include <QtCore/QStringList>\n"
+        << "#include <QtCore/QVariant>\n"
+        << "#include <QtDBus/QtDBus>\n";
+    for (const auto &include : options.includes) {
+        if (include.startsWith(QLatin1Char('<'))) {
+            out << "#include " << include << "\n";
+        } else {
+            out << "#include \"" << include << "\"\n";
+        }
+    }
+    out << "\n";
+
+    for (const auto &iface : interfaces) {
+        const QString className = options.className.isEmpty()
+                                      ? defaultClassName(iface.name)
+                                      : options.className;
+        out << "/*\n"
+            << " * Proxy class for interface " << iface.name << "\n"
+            << " */\n"
+            << "class ";
+        if (!options.exportMacro.isEmpty()) {
+            out << options.exportMacro << " ";
+        }
+        out << className << ": public QDBusAbstractInterface\n"
+            << "{\n"
+            << "    Q_OBJECT\n"
+            << "public:\n"
+            << "    static inline const char *staticInterfaceName()\n"
+            << "    { return \"" << iface.name << "\"; }\n\n"
+            << "public:\n"
+            << "    " << className
+            << "(const QString &service, const QString &path, const "
+               "QDBusConnection &connection, QObject *parent = nullptr);\n\n"
+            << "    ~" << className << "();\n\n";
+
+        for (const auto &property : iface.properties) {
+            writeProperty(out, property);
+        }
+
+        out << "public Q_SLOTS: // METHODS\n";
+        for (const auto &method : iface.methods) {
+            writeMethod(out, method);
+        }
+
+        out << "public: // MESSAGES\n";
+        for (const auto &method : iface.methods) {
+            writeBuilder(out, method);
+        }
+        for (const auto &method : iface.methods) {
+            if (!method.outputs.isEmpty()) {
+                writeDecoder(out, method);
+            }
+        }
+
+        out << "Q_SIGNALS: // SIGNALS\n";
+        for (const auto &signal : iface.signals_) {
+            writeSignal(out, signal);
+        }
+        out << "};\n\n";
+    }
+
+    if (!options.noNamespace) {
+        for (const auto &iface : interfaces) {
+            QStringList parts = iface.name.split(QLatin1Char('.'));
+            const QString last = parts.takeLast();
+            for (const auto &part : parts) {
+                out << "namespace " << part << " {\n";
+            }
+            out << "  typedef ::"
+                << (options.className.isEmpty()
+                        ? defaultClassName(iface.name)
+                        : options.className)
+                << " " << last << ";\n";
+            for (int i = 0; i < parts.size(); i++) {
+                out << "}\n";
+            }
+        }
+    }
+    out << "#endif\n";
+    return result;
+}
+
+QString writeImplementation(const Options &options,
+                            const QList<Interface> &interfaces) {
+    QString result;
+    QTextStream out(&result);
+    const QString fileName = QFileInfo(options.basename).fileName();
+    writeBanner(out, options);
+    out << "#include \"" << fileName << ".h\"\n\n";
+    for (const auto &iface : interfaces) {
+        const QString className = options.className.isEmpty()
+                                      ? defaultClassName(iface.name)
+                                      : options.className;
+        out << "/*\n"
+            << " * Implementation of interface class " << className << "\n"
+            << " */\n\n"
+            << className << "::" << className
+            << "(const QString &service, const QString &path, const "
+               "QDBusConnection &connection, QObject *parent)\n"
+            << "    : QDBusAbstractInterface(service, path, "
+               "staticInterfaceName(), connection, parent)\n"
+            << "{\n"
+            << "}\n\n"
+            << className << "::~" << className << "()\n"
+            << "{\n"
+            << "}\n\n";
+    }
+    return result;
+}
+
+void writeFile(const QString &fileName, const QString &content) {
+    const QByteArray data = content.toUtf8();
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        file.write(data) != data.size()) {
+        error(QString("cannot write %1").arg(fileName));
+    }
+}
+
+void usage() {
+    fprintf(stderr,
+            "Usage: fcitx-dbusproxygen [-N] [-c classname] "
+            "[-e exportmacro] [-i include]... -p basename file.xml\n");
+    exit(1);
+}
+
+Options parseArguments(const QStringList &arguments) {
+    Options options;
+    QStringList commandLine;
+    for (int i = 1; i < arguments.size(); i++) {
+        const QString &arg = arguments[i];
+        auto next = [&arguments, &i]() {
+            if (i + 1 >= arguments.size()) {
+                usage();
+            }
+            return arguments[++i];
+        };
+        if (arg == QLatin1String("-N")) {
+            options.noNamespace = true;
+        } else if (arg == QLatin1String("-c")) {
+            options.className = next();
+        } else if (arg == QLatin1String("-e")) {
+            options.exportMacro = next();
+        } else if (arg == QLatin1String("-i")) {
+            options.includes << next();
+        } else if (arg == QLatin1String("-p")) {
+            options.basename = next();
+        } else if (arg.startsWith(QLatin1Char('-')) ||
+                   !options.input.isEmpty()) {
+            usage();
+        } else {
+            options.input = arg;
+        }
+    }
+    if (options.input.isEmpty() || options.basename.isEmpty()) {
+        usage();
+    }
+    // Keep the banner independent from the build directory.
+    for (int i = 1; i < arguments.size(); i++) {
+        commandLine << QFileInfo(arguments[i]).fileName();
+    }
+    options.commandLine =
+        QLatin1String("fcitx-dbusproxygen ") + commandLine.join(" ");
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    const Options options = parseArguments(app.arguments());
+    const QList<Interface> interfaces = parse(options.input);
+    if (interfaces.isEmpty()) {
+        error(QString("no interface in %1").arg(options.input));
+    }
+    if (!options.className.isEmpty() && interfaces.size() > 1) {
+        error("-c needs a file with a single interface");
+    }
+    writeFile(options.basename + ".h", writeHeader(options, interfaces));
+    writeFile(options.basename + ".cpp",
+              writeImplementation(options, interfaces));
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#include "fcitxcandidatewindow.h"
+#include <QFontMetrics>
+#include <QGuiApplication>
+#include <QPainter>
+#include <QPalette>
+#include <QScreen>
+
+namespace {
+
+constexpr int Margin = 4;
+
+} // namespace
+
+FcitxCandidateWindow::FcitxCandidateWindow() {
+    setFlags(Qt::ToolTip | Qt::FramelessWindowHint |
+             Qt::WindowDoesNotAcceptFocus);
+}
+
+FcitxCandidateWindow::~FcitxCandidateWindow() {}
+
+bool FcitxCandidateWindow::setContent(const QString &auxUp,
+                                      const QString &auxDown,
+                                      const QString &candidates) {
+    m_auxUp = auxUp;
+    m_candidates = auxDown + candidates;
+    if (m_auxUp.isEmpty() && m_candidates.isEmpty()) {
+        return false;
+    }
+
+    QFontMetrics metrics(QGuiApplication::font());
+    int width = 0;
+    int lines = 0;
+    for (const QString *line : {&m_auxUp, &m_candidates}) {
+        if (!line->isEmpty()) {
+            width = qMax(width, metrics.boundingRect(*line).width());
+            lines++;
+        }
+    }
+    resize(width + 2 * Margin, lines * metrics.height() + 2 * Margin);
+    update();
+    return true;
+}
+
+void FcitxCandidateWindow::moveToCursor(QWindow *window,
+                                        const QRect &cursorRect) {
+    setTransientParent(window);
+    QPoint pos = window->mapToGlobal(cursorRect.bottomLeft());
+    if (QScreen *screen = window->screen()) {
+        const QRect available = screen->availableGeometry();
+        if (pos.x() + width() > available.right()) {
+            pos.setX(available.right() - width());
+        }
+        // Flip above the cursor if there is no room below.
+        if (pos.y() + height() > available.bottom()) {
+            pos.setY(window->mapToGlobal(cursorRect.topLeft()).y() -
+                     height());
+        }
+        pos.setX(qMax(pos.x(), available.left()));
+        pos.setY(qMax(pos.y(), available.top()));
+    }
+    setPosition(pos);
+}
+
+void FcitxCandidateWindow::paintEvent(QPaintEvent *event) {
+    Q_UNUSED(event);
+    const QPalette palette = QGuiApplication::palette();
+    QPainter painter(this);
+    painter.setFont(QGuiApplication::font());
+    painter.fillRect(QRect(QPoint(0, 0), size()),
+                     palette.color(QPalette::ToolTipBase));
+    painter.setPen(palette.color(QPalette::ToolTipText));
+    painter.drawRect(0, 0, width() - 1, height() - 1);
+
+    QFontMetrics metrics(painter.font());
+    int y = Margin + metrics.ascent();
+    for (const QString *line : {&m_auxUp, &m_candidates}) {
+        if (!line->isEmpty()) {
+            painter.drawText(Margin, y, *line);
+            y += metrics.height();
+        }
+    }
+}
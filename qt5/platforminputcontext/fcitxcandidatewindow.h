@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXCANDIDATEWINDOW_H_
+#define FCITXCANDIDATEWINDOW_H_
+
+#include <QRasterWindow>
+#include <QString>
+
+// Candidate popup drawn by the plugin itself from UpdateClientSideUI, next
+// to the cursor of the focused window, so there is no panel process that
+// needs to follow the cursor rect.
+class FcitxCandidateWindow : public QRasterWindow {
+    Q_OBJECT
+public:
+    FcitxCandidateWindow();
+    ~FcitxCandidateWindow();
+
+    // Returns false if there is nothing to show.
+    bool setContent(const QString &auxUp, const QString &auxDown,
+                    const QString &candidates);
+    // cursorRect is in the coordinates of window.
+    void moveToCursor(QWindow *window, const QRect &cursorRect);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    QString m_auxUp;
+    QString m_candidates;
+};
+
+#endif // FCITXCANDIDATEWINDOW_H_
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxflightrecorder.h"
+#include <unistd.h>
+
+namespace {
+
+const char *eventName(FcitxFlightEventType type) {
+    switch (type) {
+    case FcitxFlightEventType::KeySend:
+    case FcitxFlightEventType::KeyReply:
+        return "ProcessKeyEvent";
+    case FcitxFlightEventType::FocusIn:
+        return "FocusIn";
+    case FcitxFlightEventType::FocusOut:
+        return "FocusOut";
+    case FcitxFlightEventType::ICCreate:
+        return "CreateInputContext";
+    case FcitxFlightEventType::ICCreated:
+        return "InputContextCreated";
+    case FcitxFlightEventType::ICDestroy:
+        return "DestroyIC";
+    case FcitxFlightEventType::Preedit:
+        return "UpdateFormattedPreedit";
+    case FcitxFlightEventType::Commit:
+        return "CommitString";
+    case FcitxFlightEventType::ForwardKey:
+        return "ForwardKey";
+    case FcitxFlightEventType::DeleteSurroundingText:
+        return "DeleteSurroundingText";
+    case FcitxFlightEventType::WatcherAvailability:
+        return "Availability";
+    case FcitxFlightEventType::EarlyInput:
+        return "EarlyInput";
+    case FcitxFlightEventType::EarlyInputFlush:
+        return "EarlyInputFlush";
+    case FcitxFlightEventType::Recovery:
+        return "Recovery";
+    case FcitxFlightEventType::AutoRepeatMerge:
+        return "AutoRepeatMerge";
+    }
+    return "Unknown";
+}
+
+void appendArg(QByteArray &out, const char *name, qint64 value) {
+    out += ",\"";
+    out += name;
+    out += "\":";
+    out += QByteArray::number(value);
+}
+
+} // namespace
+
+FcitxFlightRecorder::FcitxFlightRecorder(size_t capacity, QObject *parent)
+    : QObject(parent) {
+    if (capacity < 2) {
+        return;
+    }
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    m_events.reset(new FcitxFlightEvent[size]());
+    m_mask = size - 1;
+}
+
+FcitxFlightRecorder::~FcitxFlightRecorder() {}
+
+QByteArray FcitxFlightRecorder::toChromeTrace() const {
+    QByteArray out("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    if (!m_mask) {
+        out += "]}";
+        return out;
+    }
+
+    const QByteArray pid = QByteArray::number(getpid());
+    const quint64 end = m_next;
+    const quint64 size = m_mask + 1;
+    const quint64 begin = end > size ? end - size : 0;
+    out.reserve(out.size() + (end - begin) * 160);
+    bool first = true;
+    for (quint64 i = begin; i < end; i++) {
+        const FcitxFlightEvent &event = m_events[i & m_mask];
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += "{\"name\":\"";
+        out += eventName(event.type);
+        out += "\",\"pid\":";
+        out += pid;
+        out += ",\"tid\":";
+        out += pid;
+        out += ",\"ts\":";
+        // Trace event timestamps are in microseconds.
+        out += QByteArray::number(event.time / 1000);
+        out += '.';
+        out += QByteArray::number(event.time % 1000).rightJustified(3, '0');
+        switch (event.type) {
+        case FcitxFlightEventType::KeySend:
+        case FcitxFlightEventType::KeyReply:
+            // Pair send and reply as an async slice by serial.
+            out += ",\"cat\":\"key\",\"ph\":\"";
+            out += event.type == FcitxFlightEventType::KeySend ? 'b' : 'e';
+            out += "\",\"id\":";
+            out += QByteArray::number(event.arg1);
+            break;
+        default:
+            out += ",\"cat\":\"im\",\"ph\":\"i\",\"s\":\"t\"";
+            break;
+        }
+        out += ",\"args\":{\"ic\":";
+        out += QByteArray::number(event.ic);
+        switch (event.type) {
+        case FcitxFlightEventType::KeySend:
+        case FcitxFlightEventType::ForwardKey:
+            appendArg(out, "release", event.flags);
+            break;
+        case FcitxFlightEventType::KeyReply:
+            appendArg(out, "filtered", event.flags);
+            break;
+        case FcitxFlightEventType::Preedit:
+            appendArg(out, "segments", event.arg1);
+            appendArg(out, "cursor", event.arg2);
+            break;
+        case FcitxFlightEventType::Commit:
+            appendArg(out, "length", event.arg1);
+            break;
+        case FcitxFlightEventType::DeleteSurroundingText:
+            appendArg(out, "offset", static_cast<qint32>(event.arg1));
+            appendArg(out, "nchar", event.arg2);
+            break;
+        case FcitxFlightEventType::WatcherAvailability:
+            appendArg(out, "available", event.flags);
+            break;
+        case FcitxFlightEventType::EarlyInput:
+            appendArg(out, "buffered", event.arg1);
+            appendArg(out, "release", event.flags);
+            break;
+        case FcitxFlightEventType::EarlyInputFlush:
+            appendArg(out, "keys", event.arg1);
+            appendArg(out, "replayed", event.flags);
+            break;
+        case FcitxFlightEventType::Recovery:
+            appendArg(out, "msec", event.arg1);
+            appendArg(out, "ics", event.arg2);
+            break;
+        case FcitxFlightEventType::AutoRepeatMerge:
+            appendArg(out, "count", event.arg1);
+            appendArg(out, "forwarded", event.flags);
+            break;
+        default:
+            break;
+        }
+        out += "}}";
+    }
+    out += "]}";
+    return out;
+}
+
+QString FcitxFlightRecorder::Dump() {
+    return QString::fromUtf8(toChromeTrace());
+}
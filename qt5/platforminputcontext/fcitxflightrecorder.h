@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXFLIGHTRECORDER_H_
+#define FCITXFLIGHTRECORDER_H_
+
+#include <QObject>
+#include <memory>
+#include <time.h>
+
+enum class FcitxFlightEventType : quint16 {
+    KeySend,
+    KeyReply,
+    FocusIn,
+    FocusOut,
+    ICCreate,
+    ICCreated,
+    ICDestroy,
+    Preedit,
+    Commit,
+    ForwardKey,
+    DeleteSurroundingText,
+    WatcherAvailability,
+    EarlyInput,
+    EarlyInputFlush,
+    Recovery,
+    AutoRepeatMerge,
+};
+
+// Neither keys nor text are recorded, only what happened when, so a dump
+// never tells what was typed.
+struct FcitxFlightEvent {
+    qint64 time;
+    // The trace id of the input context, 0 for none.
+    quint32 ic;
+    quint32 arg1;
+    quint32 arg2;
+    FcitxFlightEventType type;
+    quint16 flags;
+};
+
+// A fixed size ring buffer of recent input method activity, off unless
+// FCITX_QT_FLIGHT_RECORDER is set to its capacity, and the counters below.
+// It is exported on the session bus connection the plugin uses, its own or
+// the application's, so that it can be dumped after the fact, e.g.
+// busctl --user --json=short call <unique name> /org/fcitx/FlightRecorder
+//     org.fcitx.Fcitx.FlightRecorder Dump
+// The output is Chrome trace event JSON, which can be opened in Perfetto.
+class FcitxFlightRecorder : public QObject {
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.fcitx.Fcitx.FlightRecorder")
+    // Milliseconds from plugin start to the first usable input context, -1
+    // until there is one.
+    Q_PROPERTY(qint64 TimeToFirstInputContext READ timeToFirstInputContext)
+    // Keys held back because they were typed before the input context was
+    // ready.
+    Q_PROPERTY(uint EarlyInputKeys READ earlyInputKeys)
+    // Milliseconds from losing the input contexts to having all of them
+    // back for the last daemon restart, -1 if there was none.
+    Q_PROPERTY(qint64 LastRecoveryTime READ lastRecoveryTime)
+    // Qt::ImEnabled queries answered from the cache and sent to the focus
+    // object.
+    Q_PROPERTY(quint64 ImEnabledCacheHits READ imEnabledCacheHits)
+    Q_PROPERTY(quint64 ImEnabledCacheMisses READ imEnabledCacheMisses)
+public:
+    // Capacity is rounded up to a power of two, 0 disables the recorder.
+    explicit FcitxFlightRecorder(size_t capacity, QObject *parent = nullptr);
+    ~FcitxFlightRecorder();
+
+    bool isEnabled() const { return m_mask != 0; }
+
+    static qint64 now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<qint64>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // Never allocates. Only called from the thread owning the recorder,
+    // which is also the one dumping it, other threads pass their timestamps
+    // along to it.
+    void record(FcitxFlightEventType type, quint32 ic = 0,
+                quint32 arg1 = 0, quint32 arg2 = 0, quint16 flags = 0) {
+        if (m_mask) {
+            recordAt(now(), type, ic, arg1, arg2, flags);
+        }
+    }
+    void recordAt(qint64 time, FcitxFlightEventType type, quint32 ic,
+                  quint32 arg1 = 0, quint32 arg2 = 0, quint16 flags = 0) {
+        if (!m_mask) {
+            return;
+        }
+        auto &event = m_events[m_next++ & m_mask];
+        event.time = time;
+        event.ic = ic;
+        event.arg1 = arg1;
+        event.arg2 = arg2;
+        event.type = type;
+        event.flags = flags;
+    }
+
+    QByteArray toChromeTrace() const;
+
+    qint64 timeToFirstInputContext() const { return m_timeToFirstIC; }
+    void setTimeToFirstInputContext(qint64 msec) { m_timeToFirstIC = msec; }
+    uint earlyInputKeys() const { return m_earlyInputKeys; }
+    void addEarlyInputKey() { m_earlyInputKeys++; }
+    qint64 lastRecoveryTime() const { return m_lastRecoveryTime; }
+    void setLastRecoveryTime(qint64 msec) { m_lastRecoveryTime = msec; }
+    quint64 imEnabledCacheHits() const { return m_imEnabledCacheHits; }
+    quint64 imEnabledCacheMisses() const { return m_imEnabledCacheMisses; }
+    void countImEnabledQuery(bool hit) {
+        if (hit) {
+            m_imEnabledCacheHits++;
+        } else {
+            m_imEnabledCacheMisses++;
+        }
+    }
+
+public Q_SLOTS:
+    Q_SCRIPTABLE QString Dump();
+
+private:
+    std::unique_ptr<FcitxFlightEvent[]> m_events;
+    size_t m_mask = 0;
+    quint64 m_next = 0;
+    qint64 m_timeToFirstIC = -1;
+    uint m_earlyInputKeys = 0;
+    qint64 m_lastRecoveryTime = -1;
+    quint64 m_imEnabledCacheHits = 0;
+    quint64 m_imEnabledCacheMisses = 0;
+};
+
+#endif // FCITXFLIGHTRECORDER_H_
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#include "fcitxicscheduler.h"
+#include "fcitxflightrecorder.h"
+#include "fcitxinputcontextproxy.h"
+#include "fcitxwatcher.h"
+#include <QDBusConnectionInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusReply>
+#include <QGuiApplication>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// Delay of the first attempt, doubled for each failed one up to MaxDelay.
+constexpr int BaseDelay = 100;
+constexpr int MaxDelay = 5000;
+// Give up until the availability changes again.
+constexpr int MaxAttempts = 10;
+
+} // namespace
+
+FcitxICScheduler::FcitxICScheduler(FcitxWatcher *watcher,
+                                   FcitxFlightRecorder *recorder,
+                                   QObject *parent)
+    : QObject(parent), m_watcher(watcher), m_recorder(recorder),
+      m_random(static_cast<unsigned>(getpid()) ^
+               static_cast<unsigned>(time(nullptr))),
+      m_releaseInterest(FcitxKeyReleaseInterest::Unknown) {
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this,
+            &FcitxICScheduler::createPending);
+    m_ownerWatcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&m_ownerWatcher, &QDBusServiceWatcher::serviceUnregistered, this,
+            &FcitxICScheduler::ownerUnregistered);
+    connect(m_watcher, &FcitxWatcher::availabilityChanged, this,
+            &FcitxICScheduler::availabilityChanged);
+    connect(m_watcher, &FcitxWatcher::connectionReset, this,
+            &FcitxICScheduler::connectionReset);
+}
+
+FcitxICScheduler::~FcitxICScheduler() {}
+
+void FcitxICScheduler::add(FcitxInputContextProxy *proxy) {
+    m_proxies.push_back(proxy);
+    // The QPointer is already cleared when destroyed is emitted.
+    connect(proxy, &QObject::destroyed, this, [this]() {
+        m_proxies.erase(
+            std::remove_if(m_proxies.begin(), m_proxies.end(),
+                           [](const QPointer<FcitxInputContextProxy> &proxy) {
+                               return proxy.isNull();
+                           }),
+            m_proxies.end());
+        // Let another input context ask in place of a destroyed one.
+        if (m_releaseInterest == FcitxKeyReleaseInterest::Unknown &&
+            !m_releaseInterestAsker) {
+            for (const auto &proxy : m_proxies) {
+                if (proxy && proxy->isValid() && proxy->isPortal()) {
+                    negotiateKeyReleaseInterest(proxy);
+                }
+            }
+        }
+    });
+    connect(proxy, &FcitxInputContextProxy::inputContextCreated, this,
+            &FcitxICScheduler::inputContextCreated);
+    connect(proxy, &FcitxInputContextProxy::keyReleaseInterestReplied, this,
+            &FcitxICScheduler::keyReleaseInterestReplied);
+    connect(proxy, &FcitxInputContextProxy::createInputContextFailed, this,
+            &FcitxICScheduler::inputContextFailed);
+    schedule();
+}
+
+void FcitxICScheduler::schedule() {
+    if (!m_watcher->availability() || m_timer.isActive() ||
+        m_attempt >= MaxAttempts) {
+        return;
+    }
+    int delay = BaseDelay;
+    for (int i = 0; i < m_attempt && delay < MaxDelay; i++) {
+        delay *= 2;
+    }
+    delay = std::min(delay, MaxDelay);
+    // Spread the processes of the desktop over the second half of the delay.
+    std::uniform_int_distribution<int> jitter(delay / 2, delay);
+    m_timer.start(jitter(m_random));
+}
+
+void FcitxICScheduler::availabilityChanged(bool availability) {
+    if (!availability) {
+        lost();
+    } else {
+        m_owner.clear();
+        m_attempt = 0;
+        schedule();
+    }
+}
+
+void FcitxICScheduler::ownerUnregistered() {
+    // The name may already belong to a new daemon, which doesn't change the
+    // availability.
+    lost();
+    schedule();
+}
+
+void FcitxICScheduler::connectionReset() {
+    // The input contexts went with the connection, recreate them on the
+    // connection fcitx is available on now.
+    lost();
+    schedule();
+}
+
+void FcitxICScheduler::lost() {
+    m_timer.stop();
+    m_owner.clear();
+    m_ownerWatcher.setWatchedServices(QStringList());
+    m_attempt = 0;
+    // A reply about the old daemon or connection is of no use.
+    delete m_probeWatcher;
+    m_probeWatcher = nullptr;
+    m_probed = false;
+    m_supportsBatch = false;
+    m_releaseInterest = FcitxKeyReleaseInterest::Unknown;
+    m_releaseInterestAsker = nullptr;
+
+    bool hadInputContext = false;
+    auto iter = m_proxies.begin();
+    while (iter != m_proxies.end()) {
+        if (!*iter) {
+            iter = m_proxies.erase(iter);
+            continue;
+        }
+        hadInputContext = hadInputContext || (*iter)->isValid();
+        (*iter)->cleanUp();
+        ++iter;
+    }
+    if (hadInputContext && !m_recovery.isValid()) {
+        m_recovery.start();
+    }
+}
+
+void FcitxICScheduler::createPending() {
+    if (!m_watcher->availability()) {
+        return;
+    }
+
+    // There is no bus daemon on peer connection, the disconnection of peer is
+    // reported by FcitxWatcher as connectionReset.
+    // The owner watcher clears m_owner when it goes away, so the blocking
+    // lookup is only done for the first batch after fcitx showed up.
+    if (!m_watcher->isPeer() && m_owner.isEmpty()) {
+        auto connection = m_watcher->connection();
+        QDBusReply<QString> ownerReply =
+            connection.interface()->serviceOwner(m_watcher->service());
+        if (!ownerReply.isValid()) {
+            inputContextFailed();
+            return;
+        }
+        m_owner = ownerReply.value();
+        m_ownerWatcher.setConnection(connection);
+        m_ownerWatcher.setWatchedServices(QStringList() << m_owner);
+        // Avoid race, query again.
+        if (!connection.interface()->isServiceRegistered(m_owner)) {
+            m_owner.clear();
+            m_ownerWatcher.setWatchedServices(QStringList());
+            inputContextFailed();
+            return;
+        }
+    }
+    const QString owner = m_watcher->isPeer() ? QString() : m_owner;
+
+    std::vector<FcitxInputContextProxy *> proxies;
+    proxies.reserve(m_proxies.size());
+    for (const auto &proxy : m_proxies) {
+        if (proxy && !proxy->isValid() && !proxy->isCreateInFlight()) {
+            proxies.push_back(proxy);
+        }
+    }
+    // The focused window is the one the user is waiting for.
+    QWindow *focusWindow = QGuiApplication::focusWindow();
+    std::stable_partition(proxies.begin(), proxies.end(),
+                          [focusWindow](FcitxInputContextProxy *proxy) {
+                              return proxy->window() == focusWindow;
+                          });
+    for (auto *proxy : proxies) {
+        proxy->createInputContext(owner);
+    }
+}
+
+void FcitxICScheduler::inputContextCreated() {
+    if (auto proxy = qobject_cast<FcitxInputContextProxy *>(sender())) {
+        probe(proxy);
+    }
+    m_attempt = 0;
+    if (!m_recovery.isValid()) {
+        return;
+    }
+    int count = 0;
+    for (const auto &proxy : m_proxies) {
+        if (!proxy) {
+            continue;
+        }
+        if (!proxy->isValid()) {
+            return;
+        }
+        count++;
+    }
+    const qint64 elapsed = m_recovery.elapsed();
+    m_recovery.invalidate();
+    m_recorder->setLastRecoveryTime(elapsed);
+    m_recorder->record(FcitxFlightEventType::Recovery, 0,
+                       static_cast<quint32>(elapsed), count);
+}
+
+void FcitxICScheduler::probe(FcitxInputContextProxy *proxy) {
+    // Only fcitx 5 has ProcessKeyEventBatch.
+    if (!proxy->isPortal()) {
+        return;
+    }
+    negotiateKeyReleaseInterest(proxy);
+    if (m_probed) {
+        proxy->setSupportsBatch(m_supportsBatch);
+        return;
+    }
+    // The reply goes to every input context.
+    if (m_probeWatcher) {
+        return;
+    }
+    m_probeWatcher = new QDBusPendingCallWatcher(proxy->introspect(), this);
+    connect(m_probeWatcher, &QDBusPendingCallWatcher::finished, this,
+            &FcitxICScheduler::probeFinished);
+}
+
+void FcitxICScheduler::probeFinished(QDBusPendingCallWatcher *watcher) {
+    watcher->deleteLater();
+    m_probeWatcher = nullptr;
+    QDBusPendingReply<QString> reply(*watcher);
+    // Without an answer keys stay on ProcessKeyEvent, which every fcitx 5
+    // has, rather than asking again for each input context.
+    m_probed = true;
+    m_supportsBatch =
+        !reply.isError() &&
+        reply.value().contains(QLatin1String("\"ProcessKeyEventBatch\""));
+    for (const auto &proxy : m_proxies) {
+        if (proxy && proxy->isValid() && proxy->isPortal()) {
+            proxy->setSupportsBatch(m_supportsBatch);
+        }
+    }
+}
+
+void FcitxICScheduler::negotiateKeyReleaseInterest(
+    FcitxInputContextProxy *proxy) {
+    switch (m_releaseInterest) {
+    case FcitxKeyReleaseInterest::Unknown:
+        // Wait for the input context that is already asking.
+        if (!m_releaseInterestAsker && proxy->negotiateKeyReleaseInterest()) {
+            m_releaseInterestAsker = proxy;
+        }
+        break;
+    case FcitxKeyReleaseInterest::Supported:
+        // The interest belongs to each input context.
+        proxy->negotiateKeyReleaseInterest();
+        break;
+    case FcitxKeyReleaseInterest::Unsupported:
+        break;
+    }
+}
+
+void FcitxICScheduler::keyReleaseInterestReplied(
+    FcitxKeyReleaseInterest interest) {
+    if (!m_releaseInterestAsker || sender() != m_releaseInterestAsker) {
+        return;
+    }
+    m_releaseInterestAsker = nullptr;
+    // After another error the next input context asks again, an old fcitx
+    // is never asked again until it is replaced.
+    m_releaseInterest = interest;
+    if (interest == FcitxKeyReleaseInterest::Unsupported) {
+        return;
+    }
+    for (const auto &proxy : m_proxies) {
+        if (proxy && proxy->isValid() && proxy->isPortal()) {
+            negotiateKeyReleaseInterest(proxy);
+        }
+    }
+}
+
+void FcitxICScheduler::inputContextFailed() {
+    // Count a failed batch only once.
+    if (m_timer.isActive()) {
+        return;
+    }
+    m_attempt++;
+    schedule();
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXICSCHEDULER_H_
+#define FCITXICSCHEDULER_H_
+
+#include <QDBusServiceWatcher>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <random>
+#include <vector>
+
+class FcitxFlightRecorder;
+class QDBusPendingCallWatcher;
+class FcitxInputContextProxy;
+enum class FcitxKeyReleaseInterest;
+class FcitxWatcher;
+
+// Creates the input contexts of all windows of the process. When fcitx goes
+// away or its owner changes, every input context is dropped at once and
+// recreated in a single batch after a jittered exponential backoff, focused
+// window first, so that a restarted daemon isn't hit by every window of
+// every process at the same moment.
+class FcitxICScheduler : public QObject {
+    Q_OBJECT
+public:
+    FcitxICScheduler(FcitxWatcher *watcher, FcitxFlightRecorder *recorder,
+                     QObject *parent = nullptr);
+    ~FcitxICScheduler();
+
+    void add(FcitxInputContextProxy *proxy);
+
+private Q_SLOTS:
+    void availabilityChanged(bool availability);
+    void ownerUnregistered();
+    void connectionReset();
+    void createPending();
+    void inputContextCreated();
+    void inputContextFailed();
+    void probeFinished(QDBusPendingCallWatcher *watcher);
+    void keyReleaseInterestReplied(FcitxKeyReleaseInterest interest);
+
+private:
+    void schedule();
+    void lost();
+    void probe(FcitxInputContextProxy *proxy);
+    void negotiateKeyReleaseInterest(FcitxInputContextProxy *proxy);
+
+    FcitxWatcher *m_watcher;
+    FcitxFlightRecorder *m_recorder;
+    QDBusServiceWatcher m_ownerWatcher;
+    QTimer m_timer;
+    // Unique name of fcitx, looked up once after it became available and
+    // kept until it goes away.
+    QString m_owner;
+    std::vector<QPointer<FcitxInputContextProxy>> m_proxies;
+    // What the input contexts of this fcitx support is introspected once,
+    // with the first one created, and kept until the owner or the
+    // connection changes.
+    QDBusPendingCallWatcher *m_probeWatcher = nullptr;
+    bool m_probed = false;
+    bool m_supportsBatch = false;
+    // Likewise, the first input context that asks for its key release
+    // interest finds out whether fcitx has the method, the others wait for
+    // the answer and don't ask a fcitx that doesn't have it.
+    FcitxKeyReleaseInterest m_releaseInterest;
+    QPointer<FcitxInputContextProxy> m_releaseInterestAsker;
+    int m_attempt = 0;
+    std::minstd_rand m_random;
+    // Started when input contexts are lost, until all of them are back.
+    QElapsedTimer m_recovery;
+};
+
+#endif // FCITXICSCHEDULER_H_
@@ -19,26 +19,26 @@
  */
 
 #include "fcitxinputcontextproxy.h"
+#include "fcitxoutboundqueue.h"
+#include "fcitxshmtransport.h"
 #include "fcitxwatcher.h"
 #include <QCoreApplication>
-#include <QDBusConnectionInterface>
 #include <QDBusInterface>
+#include <QDBusMessage>
 #include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
 #include <QFileInfo>
-#include <QTimer>
+#include <X11/keysym.h>
 #include <unistd.h>
 
 FcitxInputContextProxy::FcitxInputContextProxy(FcitxWatcher *watcher,
                                                QObject *parent)
     : QObject(parent), m_fcitxWatcher(watcher), m_portal(false) {
-    FcitxFormattedPreedit::registerMetaType();
+    static quint32 nextTraceId = 0;
+    m_traceId = ++nextTraceId;
+    FcitxFormattedPreeditText::registerMetaType();
     FcitxInputContextArgument::registerMetaType();
-    connect(m_fcitxWatcher, SIGNAL(availabilityChanged(bool)), this,
-            SLOT(availabilityChanged()));
-    m_watcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
-    connect(&m_watcher, SIGNAL(serviceUnregistered(QString)), this,
-            SLOT(serviceUnregistered()));
-    availabilityChanged();
+    FcitxInputContextEvent::registerMetaType();
 }
 
 FcitxInputContextProxy::~FcitxInputContextProxy() {
@@ -55,30 +55,43 @@ void FcitxInputContextProxy::setDisplay(const QString &display) {
     m_display = display;
 }
 
-void FcitxInputContextProxy::serviceUnregistered() {
-    cleanUp();
-    availabilityChanged();
+void FcitxInputContextProxy::setICData(FcitxQtICData *data, QWindow *window) {
+    m_icData = data;
+    m_window = window;
 }
 
-void FcitxInputContextProxy::availabilityChanged() {
-    QTimer::singleShot(100, this, SLOT(recheck()));
+void FcitxInputContextProxy::setUseSharedMemoryTransport(bool use,
+                                                         int keyTimeout) {
+    m_useShm = use;
+    m_shmKeyTimeout = keyTimeout;
 }
 
-void FcitxInputContextProxy::recheck() {
-    if (!isValid() && m_fcitxWatcher->availability()) {
-        createInputContext();
-    }
-    if (!m_fcitxWatcher->availability()) {
-        cleanUp();
+void FcitxInputContextProxy::setOutboundQueue(FcitxOutboundQueue *queue) {
+    m_outboundQueue = queue;
+}
+
+bool FcitxInputContextProxy::hasSharedMemoryTransport() const {
+    return m_shmTransport && m_shmTransport->isActive();
+}
+
+bool FcitxInputContextProxy::usesSharedMemoryTransport() const {
+    return m_shmTransport &&
+           (m_shmTransport->isActive() || m_shmTransport->isSettingUp());
+}
+
+void FcitxInputContextProxy::callSent() {
+    if (m_shmTransport) {
+        m_shmTransport->callSent();
     }
 }
 
-void FcitxInputContextProxy::cleanUp() {
-    auto services = m_watcher.watchedServices();
-    for (const auto &service : services) {
-        m_watcher.removeWatchedService(service);
+void FcitxInputContextProxy::icSignalReceived() {
+    if (m_shmTransport) {
+        m_shmTransport->signalReceived();
     }
+}
 
+void FcitxInputContextProxy::cleanUp() {
     delete m_improxy;
     m_improxy = nullptr;
     delete m_im1proxy;
@@ -89,9 +102,22 @@ void FcitxInputContextProxy::cleanUp() {
     m_ic1proxy = nullptr;
     delete m_createInputContextWatcher;
     m_createInputContextWatcher = nullptr;
+    delete m_shmTransport;
+    m_shmTransport = nullptr;
+    m_pendingState = 0;
+    m_pendingSurroundingText.clear();
+    m_enabled = true;
+    m_hasTriggerKeys = false;
+    m_releaseInterestAsked = false;
+    m_releaseInterestKnown = false;
+    m_releaseModifiers = true;
+    m_releaseKeyvals.clear();
+    m_supportsBatch = false;
+    m_keyMessage = QDBusMessage();
+    m_keyArguments.clear();
 }
 
-void FcitxInputContextProxy::createInputContext() {
+void FcitxInputContextProxy::createInputContext(const QString &owner) {
     if (!m_fcitxWatcher->availability()) {
         return;
     }
@@ -101,21 +127,9 @@ void FcitxInputContextProxy::createInputContext() {
     auto service = m_fcitxWatcher->service();
     auto connection = m_fcitxWatcher->connection();
 
-    auto owner = connection.interface()->serviceOwner(service);
-    if (!owner.isValid()) {
-        return;
-    }
-
-    m_watcher.setConnection(connection);
-    m_watcher.setWatchedServices(QStringList() << owner);
-    // Avoid race, query again.
-    if (!connection.interface()->isServiceRegistered(owner)) {
-        cleanUp();
-        return;
-    }
-
     QFileInfo info(QCoreApplication::applicationFilePath());
-    if (service == "org.freedesktop.portal.Fcitx") {
+    if (m_fcitxWatcher->isPeer() ||
+        service == "org.freedesktop.portal.Fcitx") {
         m_portal = true;
         m_im1proxy = new org::fcitx::Fcitx::InputMethod1(
             owner, "/org/freedesktop/portal/inputmethod", connection, this);
@@ -151,6 +165,7 @@ void FcitxInputContextProxy::createInputContext() {
 void FcitxInputContextProxy::createInputContextFinished() {
     if (m_createInputContextWatcher->isError()) {
         cleanUp();
+        Q_EMIT createInputContextFailed();
         return;
     }
 
@@ -160,6 +175,19 @@ void FcitxInputContextProxy::createInputContextFinished() {
         m_ic1proxy = new org::fcitx::Fcitx::InputContext1(
             m_im1proxy->service(), reply.value().path(),
             m_im1proxy->connection(), this);
+        if (m_useShm) {
+            // Connected ahead of the relays below, so the results fcitx
+            // wrote before a signal are delivered before it.
+            for (const char *signal :
+                 {SIGNAL(CommitString(QString)),
+                  SIGNAL(CurrentIM(QString, QString, QString)),
+                  SIGNAL(DeleteSurroundingText(int, uint)),
+                  SIGNAL(ForwardKey(uint, uint, bool)),
+                  SIGNAL(UpdateFormattedPreedit(FcitxFormattedPreeditText,
+                                                int))}) {
+                connect(m_ic1proxy, signal, this, SLOT(icSignalReceived()));
+            }
+        }
         connect(m_ic1proxy, SIGNAL(CommitString(QString)), this,
                 SIGNAL(commitString(QString)));
         connect(m_ic1proxy, SIGNAL(CurrentIM(QString, QString, QString)), this,
@@ -169,15 +197,37 @@ void FcitxInputContextProxy::createInputContextFinished() {
         connect(m_ic1proxy, SIGNAL(ForwardKey(uint, uint, bool)), this,
                 SIGNAL(forwardKey(uint, uint, bool)));
         connect(m_ic1proxy,
-                SIGNAL(UpdateFormattedPreedit(FcitxFormattedPreeditList, int)),
+                SIGNAL(UpdateFormattedPreedit(FcitxFormattedPreeditText, int)),
                 this,
-                SIGNAL(updateFormattedPreedit(FcitxFormattedPreeditList, int)));
+                SIGNAL(updateFormattedPreedit(FcitxFormattedPreeditText, int)));
+        if (m_useShm) {
+            m_shmTransport = new FcitxShmTransport(this);
+            m_shmTransport->setKeyTimeout(m_shmKeyTimeout);
+            connect(m_shmTransport, &FcitxShmTransport::keyEventResult, this,
+                    &FcitxInputContextProxy::processKeyEventSharedFinished);
+            connect(m_shmTransport, &FcitxShmTransport::deactivated, this,
+                    &FcitxInputContextProxy::sharedMemoryTransportClosed);
+            if (!m_shmTransport->setup(m_ic1proxy->connection(),
+                                       m_ic1proxy->service(),
+                                       m_ic1proxy->path())) {
+                delete m_shmTransport;
+                m_shmTransport = nullptr;
+            }
+        }
     } else {
         QDBusPendingReply<int, bool, uint, uint, uint, uint> reply(
             *m_createInputContextWatcher);
         QString path = QString("/inputcontext_%1").arg(reply.value());
         m_icproxy = new org::fcitx::Fcitx::InputContext(
             m_improxy->service(), path, m_improxy->connection(), this);
+        m_enabled = reply.argumentAt<1>();
+        m_triggerKeyval[0] = reply.argumentAt<2>();
+        m_triggerState[0] = reply.argumentAt<3>();
+        m_triggerKeyval[1] = reply.argumentAt<4>();
+        m_triggerState[1] = reply.argumentAt<5>();
+        m_hasTriggerKeys = m_triggerKeyval[0] || m_triggerKeyval[1];
+        connect(m_icproxy, SIGNAL(EnableIM()), this, SLOT(imEnabled()));
+        connect(m_icproxy, SIGNAL(CloseIM()), this, SLOT(imClosed()));
         connect(m_icproxy, SIGNAL(CommitString(QString)), this,
                 SIGNAL(commitString(QString)));
         connect(m_icproxy, SIGNAL(CurrentIM(QString, QString, QString)), this,
@@ -187,10 +237,16 @@ void FcitxInputContextProxy::createInputContextFinished() {
         connect(m_icproxy, SIGNAL(ForwardKey(uint, uint, int)), this,
                 SLOT(forwardKeyWrapper(uint, uint, int)));
         connect(m_icproxy,
-                SIGNAL(UpdateFormattedPreedit(FcitxFormattedPreeditList, int)),
+                SIGNAL(UpdateFormattedPreedit(FcitxFormattedPreeditText, int)),
                 this,
-                SLOT(updateFormattedPreeditWrapper(FcitxFormattedPreeditList,
+                SLOT(updateFormattedPreeditWrapper(FcitxFormattedPreeditText,
                                                    int)));
+        connect(m_icproxy,
+                SIGNAL(UpdateClientSideUI(QString, QString, QString, QString,
+                                          QString, int)),
+                this,
+                SLOT(updateClientSideUIWrapper(QString, QString, QString,
+                                               QString, QString, int)));
     }
 
     delete m_createInputContextWatcher;
@@ -203,25 +259,136 @@ bool FcitxInputContextProxy::isValid() const {
            (m_ic1proxy && m_ic1proxy->isValid());
 }
 
+bool FcitxInputContextProxy::isCreatingInputContext() const {
+    return !isValid() && m_fcitxWatcher->availability();
+}
+
 void FcitxInputContextProxy::forwardKeyWrapper(uint keyval, uint state,
                                                int type) {
     Q_EMIT forwardKey(keyval, state, type == 1);
 }
 
-void FcitxInputContextProxy::updateFormattedPreeditWrapper(
-    const FcitxFormattedPreeditList &list, int cursorpos) {
-    auto newList = list;
-    for (auto item : newList) {
-        const qint32 underlineBit = (1 << 3);
-        // revert non underline and "underline"
-        item.setFormat(item.format() ^ underlineBit);
+void FcitxInputContextProxy::imEnabled() { m_enabled = true; }
+
+void FcitxInputContextProxy::imClosed() { m_enabled = false; }
+
+bool FcitxInputContextProxy::supportsClientSideControlState() const {
+    return !m_portal && m_hasTriggerKeys;
+}
+
+bool FcitxInputContextProxy::isIMEnabled() const { return m_enabled; }
+
+bool FcitxInputContextProxy::isTriggerKey(uint keyval, uint state) const {
+    // Same as FcitxKeyState_SimpleMask in fcitx.
+    const uint simpleMask = (1 << 0) | (1 << 2) | (1 << 3) | (1 << 6) |
+                            (1 << 26) | (1 << 27) | (1 << 28);
+    for (int i = 0; i < 2; i++) {
+        if (m_triggerKeyval[i] && m_triggerKeyval[i] == keyval &&
+            (m_triggerState[i] & simpleMask) == (state & simpleMask)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FcitxInputContextProxy::setNegotiateKeyReleaseInterest(bool negotiate) {
+    m_negotiateReleaseInterest = negotiate;
+}
+
+bool FcitxInputContextProxy::negotiateKeyReleaseInterest() {
+    if (!m_negotiateReleaseInterest || !m_ic1proxy || m_releaseInterestAsked) {
+        return false;
+    }
+    m_releaseInterestAsked = true;
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        m_ic1proxy->service(), m_ic1proxy->path(), m_ic1proxy->interface(),
+        "GetKeyReleaseInterest");
+    auto watcher = new QDBusPendingCallWatcher(
+        m_ic1proxy->connection().asyncCall(message), m_ic1proxy);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher *)), this,
+            SLOT(keyReleaseInterestFinished(QDBusPendingCallWatcher *)));
+    return true;
+}
+
+void FcitxInputContextProxy::keyReleaseInterestFinished(
+    QDBusPendingCallWatcher *watcher) {
+    watcher->deleteLater();
+    QDBusPendingReply<QList<uint>, bool> reply(*watcher);
+    if (reply.isError()) {
+        // Old fcitx simply doesn't know it, and we'll keep sending every
+        // release.
+        Q_EMIT keyReleaseInterestReplied(
+            reply.error().type() == QDBusError::UnknownMethod
+                ? FcitxKeyReleaseInterest::Unsupported
+                : FcitxKeyReleaseInterest::Unknown);
+        return;
     }
+    m_releaseKeyvals = reply.argumentAt<0>();
+    m_releaseModifiers = reply.argumentAt<1>();
+    m_releaseInterestKnown = true;
+    Q_EMIT keyReleaseInterestReplied(FcitxKeyReleaseInterest::Supported);
+}
 
-    Q_EMIT updateFormattedPreedit(newList, cursorpos);
+QDBusPendingCall FcitxInputContextProxy::introspect() const {
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        m_ic1proxy->service(), m_ic1proxy->path(),
+        "org.freedesktop.DBus.Introspectable", "Introspect");
+    return m_ic1proxy->connection().asyncCall(message);
+}
+
+void FcitxInputContextProxy::setSupportsBatch(bool supportsBatch) {
+    if (m_supportsBatch != supportsBatch) {
+        m_supportsBatch = supportsBatch;
+        // Built again with the method to use.
+        m_keyMessage = QDBusMessage();
+    }
+}
+
+bool FcitxInputContextProxy::wantsKeyRelease(uint keyval) const {
+    if (!m_releaseInterestKnown) {
+        return true;
+    }
+    if (m_releaseModifiers &&
+        ((keyval >= XK_Shift_L && keyval <= XK_Hyper_R) ||
+         (keyval >= XK_ISO_Lock && keyval <= XK_ISO_Last_Group_Lock) ||
+         keyval == XK_Mode_switch || keyval == XK_Num_Lock)) {
+        return true;
+    }
+    return m_releaseKeyvals.contains(keyval);
+}
+
+void FcitxInputContextProxy::updateFormattedPreeditWrapper(
+    const FcitxFormattedPreeditText &text, int cursorpos) {
+    auto newText = text;
+    const qint32 underlineBit = (1 << 3);
+    // revert non underline and "underline"
+    newText.toggleFormat(underlineBit);
+
+    Q_EMIT updateFormattedPreedit(newText, cursorpos);
+}
+
+void FcitxInputContextProxy::updateClientSideUIWrapper(
+    const QString &auxUp, const QString &auxDown, const QString &preedit,
+    const QString &candidates, const QString &imName, int cursorPos) {
+    Q_UNUSED(preedit);
+    Q_UNUSED(imName);
+    Q_UNUSED(cursorPos);
+    Q_EMIT updateClientSideUI(auxUp, auxDown, candidates);
+}
+
+QDBusPendingReply<> FcitxInputContextProxy::enableIC() {
+    if (m_portal) {
+        return QDBusPendingReply<>();
+    }
+    flushState(false);
+    m_enabled = true;
+    return m_icproxy->EnableIC();
 }
 
 QDBusPendingReply<> FcitxInputContextProxy::focusIn() {
+    flushState(false);
     if (m_portal) {
+        callSent();
         return m_ic1proxy->FocusIn();
     } else {
         return m_icproxy->FocusIn();
@@ -229,7 +396,9 @@ QDBusPendingReply<> FcitxInputContextProxy::focusIn() {
 }
 
 QDBusPendingReply<> FcitxInputContextProxy::focusOut() {
+    flushState(false);
     if (m_portal) {
+        callSent();
         return m_ic1proxy->FocusOut();
     } else {
         return m_icproxy->FocusOut();
@@ -240,7 +409,13 @@ QDBusPendingCall FcitxInputContextProxy::processKeyEvent(uint keyval,
                                                          uint keycode,
                                                          uint state, bool type,
                                                          uint time) {
+    flushState(false);
     if (m_portal) {
+        callSent();
+        if (m_supportsBatch) {
+            return m_ic1proxy->ProcessKeyEventBatch(keyval, keycode, state,
+                                                    type, time);
+        }
         return m_ic1proxy->ProcessKeyEvent(keyval, keycode, state, type, time);
     } else {
         return m_icproxy->ProcessKeyEvent(keyval, keycode, state, type ? 1 : 0,
@@ -248,60 +423,276 @@ QDBusPendingCall FcitxInputContextProxy::processKeyEvent(uint keyval,
     }
 }
 
-QDBusPendingReply<> FcitxInputContextProxy::reset() {
+quint32 FcitxInputContextProxy::processKeyEventShared(uint keyval,
+                                                      uint keycode, uint state,
+                                                      bool type, uint time) {
+    if (!hasSharedMemoryTransport()) {
+        return 0;
+    }
+    flushState(false);
+    return m_shmTransport->sendKeyEvent(keyval, keycode, state, type, time);
+}
+
+bool FcitxInputContextProxy::processKeyEventAsync(uint keyval, uint keycode,
+                                                  uint state, bool type,
+                                                  uint time) {
+    flushState(false);
+    QDBusConnection connection = m_portal ? m_ic1proxy->connection()
+                                          : m_icproxy->connection();
     if (m_portal) {
-        return m_ic1proxy->Reset();
-    } else {
-        return m_icproxy->Reset();
+        callSent();
+    }
+    if (m_keyMessage.type() != QDBusMessage::MethodCallMessage) {
+        if (m_portal) {
+            m_keyMessage = m_supportsBatch
+                               ? m_ic1proxy->createProcessKeyEventBatchMessage(
+                                     0, 0, 0, false, 0)
+                               : m_ic1proxy->createProcessKeyEventMessage(
+                                     0, 0, 0, false, 0);
+        } else {
+            m_keyMessage =
+                m_icproxy->createProcessKeyEventMessage(0, 0, 0, 0, 0);
+        }
+        m_keyArguments = m_keyMessage.arguments();
     }
+    // The message of the previous key is shared with its pending call, but
+    // that no longer needs the arguments. Dropping them from the message
+    // lets the list and its values be written in place.
+    m_keyMessage.setArguments(QList<QVariant>());
+    m_keyArguments[0] = keyval;
+    m_keyArguments[1] = keycode;
+    m_keyArguments[2] = state;
+    m_keyArguments[3] = m_portal ? QVariant(type) : QVariant(type ? 1 : 0);
+    m_keyArguments[4] = time;
+    m_keyMessage.setArguments(m_keyArguments);
+    // Unlike a QDBusPendingCallWatcher, nothing is allocated per key for
+    // the caller to find its key again.
+    return connection.callWithCallback(m_keyMessage, this,
+                                       SLOT(keyEventReplied(QDBusMessage)),
+                                       SLOT(keyEventFailed(QDBusError)));
+}
+
+void FcitxInputContextProxy::keyEventReplied(const QDBusMessage &reply) {
+    const bool processed = processKeyEventResult(reply);
+    Q_EMIT processKeyEventFinished(processed, false);
 }
 
-QDBusPendingReply<> FcitxInputContextProxy::setCapability(qulonglong caps) {
+void FcitxInputContextProxy::keyEventFailed(const QDBusError &error) {
+    Q_UNUSED(error);
+    Q_EMIT processKeyEventFinished(false, true);
+}
+
+QDBusMessage FcitxInputContextProxy::processKeyEventMessage(uint keyval,
+                                                           uint keycode,
+                                                           uint state,
+                                                           bool type,
+                                                           uint time) const {
     if (m_portal) {
-        return m_ic1proxy->SetCapability(caps);
+        return m_ic1proxy->createProcessKeyEventMessage(keyval, keycode, state,
+                                                        type, time);
     } else {
-        return m_icproxy->SetCapacity(static_cast<uint>(caps));
+        return m_icproxy->createProcessKeyEventMessage(keyval, keycode, state,
+                                                       type ? 1 : 0, time);
     }
 }
 
-QDBusPendingReply<> FcitxInputContextProxy::setCursorRect(int x, int y, int w,
-                                                          int h) {
-    if (m_portal) {
-        return m_ic1proxy->SetCursorRect(x, y, w, h);
+bool FcitxInputContextProxy::processKeyEventReply(const QDBusMessage &reply,
+                                                  bool portal) {
+    if (portal) {
+        bool ret = false;
+        return org::fcitx::Fcitx::InputContext1::decodeProcessKeyEventReply(
+                   reply, ret) &&
+               ret;
     } else {
-        return m_icproxy->SetCursorRect(x, y, w, h);
+        int ret = 0;
+        return org::fcitx::Fcitx::InputContext::decodeProcessKeyEventReply(
+                   reply, ret) &&
+               ret > 0;
     }
 }
 
-QDBusPendingReply<>
-FcitxInputContextProxy::setSurroundingText(const QString &text, uint cursor,
-                                           uint anchor) {
+QString FcitxInputContextProxy::connectionName() const {
     if (m_portal) {
-        return m_ic1proxy->SetSurroundingText(text, cursor, anchor);
+        return m_ic1proxy->connection().name();
     } else {
-        return m_icproxy->SetSurroundingText(text, cursor, anchor);
+        return m_icproxy->connection().name();
     }
 }
 
-QDBusPendingReply<>
-FcitxInputContextProxy::setSurroundingTextPosition(uint cursor, uint anchor) {
+bool FcitxInputContextProxy::isPortal() const { return m_portal; }
+
+QDBusPendingReply<> FcitxInputContextProxy::reset() {
+    flushState(false);
     if (m_portal) {
-        return m_ic1proxy->SetSurroundingTextPosition(cursor, anchor);
+        callSent();
+        return m_ic1proxy->Reset();
+    } else {
+        return m_icproxy->Reset();
+    }
+}
+
+void FcitxInputContextProxy::setCapability(qulonglong caps) {
+    m_pendingCapability = caps;
+    queueState(PendingCapability);
+}
+
+void FcitxInputContextProxy::setCursorRect(int x, int y, int w, int h) {
+    m_pendingCursorRect = QRect(x, y, w, h);
+    queueState(PendingCursorRect);
+}
+
+void FcitxInputContextProxy::setSurroundingText(const QString &text,
+                                                uint cursor, uint anchor) {
+    m_pendingSurroundingText = text;
+    m_pendingCursor = cursor;
+    m_pendingAnchor = anchor;
+    m_pendingState &= ~PendingSurroundingTextPosition;
+    queueState(PendingSurroundingText);
+}
+
+void FcitxInputContextProxy::setSurroundingTextPosition(uint cursor,
+                                                        uint anchor) {
+    m_pendingCursor = cursor;
+    m_pendingAnchor = anchor;
+    // The text that is not sent yet already carries the position.
+    queueState(m_pendingState & PendingSurroundingText
+                   ? PendingSurroundingText
+                   : PendingSurroundingTextPosition);
+}
+
+void FcitxInputContextProxy::queueState(int state) {
+    m_pendingState |= state;
+    if (m_outboundQueue) {
+        m_outboundQueue->schedule(this);
     } else {
-        return m_icproxy->SetSurroundingTextPosition(cursor, anchor);
+        flushState(true);
     }
 }
 
+void FcitxInputContextProxy::flushState(bool all) {
+    if (!m_pendingState || (!all && m_pendingState == PendingCursorRect)) {
+        return;
+    }
+    if (!isValid()) {
+        m_pendingState = 0;
+        return;
+    }
+
+    if (m_pendingState & PendingCapability) {
+        if (!hasSharedMemoryTransport() ||
+            !m_shmTransport->sendCapability(m_pendingCapability)) {
+            if (m_portal) {
+                callSent();
+                m_ic1proxy->SetCapability(m_pendingCapability);
+            } else {
+                m_icproxy->SetCapacity(
+                    static_cast<uint>(m_pendingCapability));
+            }
+        }
+    }
+
+    if (m_pendingState & PendingSurroundingText) {
+        if (m_portal) {
+            callSent();
+            m_ic1proxy->SetSurroundingText(m_pendingSurroundingText,
+                                           m_pendingCursor, m_pendingAnchor);
+        } else {
+            m_icproxy->SetSurroundingText(m_pendingSurroundingText,
+                                          m_pendingCursor, m_pendingAnchor);
+        }
+        m_pendingSurroundingText.clear();
+    } else if (m_pendingState & PendingSurroundingTextPosition) {
+        if (m_portal) {
+            callSent();
+            m_ic1proxy->SetSurroundingTextPosition(m_pendingCursor,
+                                                   m_pendingAnchor);
+        } else {
+            m_icproxy->SetSurroundingTextPosition(m_pendingCursor,
+                                                  m_pendingAnchor);
+        }
+    }
+
+    if (all && (m_pendingState & PendingCursorRect)) {
+        const QRect &r = m_pendingCursorRect;
+        if (!hasSharedMemoryTransport() ||
+            !m_shmTransport->sendCursorRect(r.x(), r.y(), r.width(),
+                                            r.height())) {
+            if (m_portal) {
+                callSent();
+                m_ic1proxy->SetCursorRect(r.x(), r.y(), r.width(), r.height());
+            } else {
+                m_icproxy->SetCursorRect(r.x(), r.y(), r.width(), r.height());
+            }
+        }
+    }
+
+    m_pendingState = all ? 0 : (m_pendingState & PendingCursorRect);
+}
+
 bool FcitxInputContextProxy::processKeyEventResult(
     const QDBusPendingCall &call) {
     if (call.isError()) {
         return false;
     }
-    if (m_portal) {
-        QDBusPendingReply<bool> reply = call;
-        return reply.value();
-    } else {
-        QDBusPendingReply<int> reply = call;
-        return reply.value() > 0;
+    return processKeyEventResult(call.reply());
+}
+
+bool FcitxInputContextProxy::processKeyEventResult(const QDBusMessage &reply) {
+    // Decided by the reply, keys sent before the introspection finished
+    // still use ProcessKeyEvent.
+    FcitxInputContextEventList events;
+    bool ret = false;
+    if (m_portal &&
+        org::fcitx::Fcitx::InputContext1::decodeProcessKeyEventBatchReply(
+            reply, events, ret)) {
+        emitEvents(events);
+        return ret;
+    }
+    return processKeyEventReply(reply, m_portal);
+}
+
+void FcitxInputContextProxy::emitEvents(
+    const FcitxInputContextEventList &events) {
+    for (const auto &event : events) {
+        switch (event.type()) {
+        case FcitxInputContextEvent::UpdatePreedit: {
+            const QDBusArgument argument =
+                event.data().value<QDBusArgument>();
+            FcitxFormattedPreeditText text;
+            int cursor = 0;
+            argument.beginStructure();
+            argument >> text >> cursor;
+            argument.endStructure();
+            Q_EMIT updateFormattedPreedit(text, cursor);
+            break;
+        }
+        case FcitxInputContextEvent::DeleteSurroundingText: {
+            const QDBusArgument argument =
+                event.data().value<QDBusArgument>();
+            int offset = 0;
+            uint nchar = 0;
+            argument.beginStructure();
+            argument >> offset >> nchar;
+            argument.endStructure();
+            Q_EMIT deleteSurroundingText(offset, nchar);
+            break;
+        }
+        case FcitxInputContextEvent::CommitString:
+            Q_EMIT commitString(event.data().toString());
+            break;
+        case FcitxInputContextEvent::ForwardKey: {
+            const QDBusArgument argument =
+                event.data().value<QDBusArgument>();
+            uint keyval = 0, state = 0;
+            bool isRelease = false;
+            argument.beginStructure();
+            argument >> keyval >> state >> isRelease;
+            argument.endStructure();
+            Q_EMIT forwardKey(keyval, state, isRelease);
+            break;
+        }
+        default:
+            break;
+        }
     }
 }
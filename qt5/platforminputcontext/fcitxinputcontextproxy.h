@@ -26,11 +26,21 @@
 #include "inputmethod1proxy.h"
 #include "inputmethodproxy.h"
 #include <QDBusConnection>
-#include <QDBusServiceWatcher>
+#include <QDBusError>
+#include <QDBusMessage>
 #include <QObject>
+#include <QRect>
 
 class QDBusPendingCallWatcher;
+class QWindow;
+class FcitxOutboundQueue;
+class FcitxShmTransport;
 class FcitxWatcher;
+struct FcitxQtICData;
+
+// Whether fcitx has GetKeyReleaseInterest, Unknown if asking it failed for
+// another reason than not knowing the method.
+enum class FcitxKeyReleaseInterest { Unknown, Supported, Unsupported };
 
 class FcitxInputContextProxy : public QObject {
     Q_OBJECT
@@ -39,18 +49,89 @@ public:
     ~FcitxInputContextProxy();
 
     bool isValid() const;
+    // Whether fcitx is there but the input context is not created yet, i.e.
+    // it is either scheduled or waiting for the reply of the daemon.
+    bool isCreatingInputContext() const;
+    bool isCreateInFlight() const {
+        return m_createInputContextWatcher != nullptr;
+    }
+    // Ask fcitx for an input context, owner is the unique name of fcitx on
+    // the bus, empty for a peer connection. Creation is driven by
+    // FcitxICScheduler.
+    void createInputContext(const QString &owner);
+    // Drop the input context without telling fcitx, e.g. because it's gone.
+    void cleanUp();
+    void setICData(FcitxQtICData *data, QWindow *window);
+    FcitxQtICData *icData() const { return m_icData; }
+    QWindow *window() const { return m_window; }
+    // keyTimeout is passed to FcitxShmTransport::setKeyTimeout.
+    void setUseSharedMemoryTransport(bool use, int keyTimeout);
+    // Without a queue, state updates are sent right away.
+    void setOutboundQueue(FcitxOutboundQueue *queue);
+    // Trigger keys are only known with fcitx 4, which is the only one that
+    // supports client side control state.
+    bool supportsClientSideControlState() const;
+    bool isIMEnabled() const;
+    bool isTriggerKey(uint keyval, uint state) const;
+    void setNegotiateKeyReleaseInterest(bool negotiate);
+    // Ask fcitx 5 which releases it needs, once per input context and only
+    // if enabled, returns whether it was asked. FcitxICScheduler decides
+    // when, the answer comes with keyReleaseInterestReplied.
+    bool negotiateKeyReleaseInterest();
+    // Whether the release of keyval needs to be sent to fcitx, always true
+    // unless fcitx told us which releases it cares about.
+    bool wantsKeyRelease(uint keyval) const;
+    bool hasSharedMemoryTransport() const;
+    // Also true while fcitx is still attaching the rings, keys have to stay
+    // on this thread then so that the transport counts them.
+    bool usesSharedMemoryTransport() const;
 
+    QDBusPendingReply<> enableIC();
     QDBusPendingReply<> focusIn();
     QDBusPendingReply<> focusOut();
+    // Uses ProcessKeyEventBatch if fcitx has it, the actions caused by the
+    // key then come with the reply instead of as signals.
     QDBusPendingCall processKeyEvent(uint keyval, uint keycode, uint state,
                                      bool type, uint time);
+    // Same as processKeyEvent without a pending call to watch, the result
+    // comes with processKeyEventFinished in the order the keys were sent.
+    // Returns false if the key couldn't be sent.
+    bool processKeyEventAsync(uint keyval, uint keycode, uint state,
+                              bool type, uint time);
+    // Emits the actions that came with the reply, in order, before
+    // returning whether the key is filtered.
     bool processKeyEventResult(const QDBusPendingCall &call);
+    bool processKeyEventResult(const QDBusMessage &reply);
+    // Same call as processKeyEvent, for sending from another thread. Unlike
+    // processKeyEvent it doesn't flush the queued state, the caller has to.
+    QDBusMessage processKeyEventMessage(uint keyval, uint keycode, uint state,
+                                        bool type, uint time) const;
+    // Decode the reply of processKeyEvent, usable from any thread.
+    static bool processKeyEventReply(const QDBusMessage &reply, bool portal);
+    QString connectionName() const;
+    bool isPortal() const;
+    // Identifies the input context in a flight recorder dump, counting from
+    // 1 in the order they were made, so that a dump doesn't show addresses.
+    quint32 traceId() const { return m_traceId; }
+    // Introspection of the fcitx 5 input context. FcitxICScheduler asks the
+    // first input context of a daemon and tells every one of them whether
+    // ProcessKeyEventBatch is there, until then keys use ProcessKeyEvent.
+    QDBusPendingCall introspect() const;
+    void setSupportsBatch(bool supportsBatch);
+    // Send key over shared memory transport, returns 0 if it's not possible
+    // to do so, otherwise the result is delivered by
+    // processKeyEventSharedFinished with the returned serial.
+    quint32 processKeyEventShared(uint keyval, uint keycode, uint state,
+                                  bool type, uint time);
     QDBusPendingReply<> reset();
-    QDBusPendingReply<> setCapability(qulonglong caps);
-    QDBusPendingReply<> setCursorRect(int x, int y, int w, int h);
-    QDBusPendingReply<> setSurroundingText(const QString &text, uint cursor,
-                                           uint anchor);
-    QDBusPendingReply<> setSurroundingTextPosition(uint cursor, uint anchor);
+    // State updates, only the latest value of each is sent by flushState.
+    void setCapability(qulonglong caps);
+    void setCursorRect(int x, int y, int w, int h);
+    void setSurroundingText(const QString &text, uint cursor, uint anchor);
+    void setSurroundingTextPosition(uint cursor, uint anchor);
+    // Send the queued state updates. The cursor rect doesn't change how a
+    // key is handled, so it's left for the idle flush unless all is true.
+    void flushState(bool all);
     void setDisplay(const QString &display);
 
 Q_SIGNALS:
@@ -59,32 +140,84 @@ Q_SIGNALS:
                    const QString &langCode);
     void deleteSurroundingText(int offset, uint nchar);
     void forwardKey(uint keyval, uint state, bool isRelease);
-    void updateFormattedPreedit(const FcitxFormattedPreeditList &str,
+    void updateFormattedPreedit(const FcitxFormattedPreeditText &str,
                                 int cursorpos);
     void inputContextCreated();
+    void createInputContextFailed();
+    void keyReleaseInterestReplied(FcitxKeyReleaseInterest interest);
+    void processKeyEventFinished(bool processed, bool isError);
+    void processKeyEventSharedFinished(quint32 serial, bool processed);
+    void sharedMemoryTransportClosed();
+    // Only with fcitx 4 and CAPACITY_CLIENT_SIDE_UI, the preedit still comes
+    // with updateFormattedPreedit.
+    void updateClientSideUI(const QString &auxUp, const QString &auxDown,
+                            const QString &candidates);
 
 private Q_SLOTS:
-    void availabilityChanged();
-    void createInputContext();
     void createInputContextFinished();
-    void serviceUnregistered();
-    void recheck();
     void forwardKeyWrapper(uint keyval, uint state, int type);
-    void updateFormattedPreeditWrapper(const FcitxFormattedPreeditList &str,
+    void imEnabled();
+    void imClosed();
+    void keyReleaseInterestFinished(QDBusPendingCallWatcher *watcher);
+    void icSignalReceived();
+    void keyEventReplied(const QDBusMessage &reply);
+    void keyEventFailed(const QDBusError &error);
+    void updateFormattedPreeditWrapper(const FcitxFormattedPreeditText &str,
                                        int cursorpos);
+    void updateClientSideUIWrapper(const QString &auxUp,
+                                   const QString &auxDown,
+                                   const QString &preedit,
+                                   const QString &candidates,
+                                   const QString &imName, int cursorPos);
 
 private:
-    void cleanUp();
+    enum PendingState {
+        PendingCapability = (1 << 0),
+        PendingCursorRect = (1 << 1),
+        PendingSurroundingText = (1 << 2),
+        PendingSurroundingTextPosition = (1 << 3),
+    };
+    void queueState(int state);
+    // Every org.fcitx.Fcitx.InputContext1 call but DestroyIC goes through
+    // here, the shared memory transport orders its records after them.
+    void callSent();
+    void emitEvents(const FcitxInputContextEventList &events);
 
-    QDBusServiceWatcher m_watcher;
     FcitxWatcher *m_fcitxWatcher;
     org::fcitx::Fcitx::InputMethod *m_improxy = nullptr;
     org::fcitx::Fcitx::InputMethod1 *m_im1proxy = nullptr;
     org::fcitx::Fcitx::InputContext *m_icproxy = nullptr;
     org::fcitx::Fcitx::InputContext1 *m_ic1proxy = nullptr;
     QDBusPendingCallWatcher *m_createInputContextWatcher = nullptr;
+    FcitxShmTransport *m_shmTransport = nullptr;
+    FcitxOutboundQueue *m_outboundQueue = nullptr;
+    int m_pendingState = 0;
+    qulonglong m_pendingCapability = 0;
+    QRect m_pendingCursorRect;
+    QString m_pendingSurroundingText;
+    uint m_pendingCursor = 0;
+    uint m_pendingAnchor = 0;
+    FcitxQtICData *m_icData = nullptr;
+    QWindow *m_window = nullptr;
     QString m_display;
     bool m_portal;
+    quint32 m_traceId;
+    bool m_useShm = false;
+    int m_shmKeyTimeout = 0;
+    bool m_enabled = true;
+    bool m_hasTriggerKeys = false;
+    uint m_triggerKeyval[2] = {0, 0};
+    uint m_triggerState[2] = {0, 0};
+    bool m_negotiateReleaseInterest = false;
+    bool m_releaseInterestAsked = false;
+    bool m_releaseInterestKnown = false;
+    bool m_releaseModifiers = true;
+    QList<uint> m_releaseKeyvals;
+    bool m_supportsBatch = false;
+    // Reused by processKeyEventAsync, so a key doesn't build its message
+    // and argument list from scratch.
+    QDBusMessage m_keyMessage;
+    QList<QVariant> m_keyArguments;
 };
 
 #endif // FCITXINPUTCONTEXTPROXY_H_
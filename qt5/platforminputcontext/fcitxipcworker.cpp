@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxipcworker.h"
+#include "fcitxflightrecorder.h"
+#include "fcitxinputcontextproxy.h"
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QTimer>
+#include <algorithm>
+#include <vector>
+
+FcitxIPCWorker::FcitxIPCWorker(int deadline) : m_deadline(deadline) {}
+
+FcitxIPCWorker::~FcitxIPCWorker() {}
+
+bool FcitxIPCWorker::send(FcitxIPCRequest &&request) {
+    if (!m_requests.push(std::move(request))) {
+        return false;
+    }
+    if (!m_requestsScheduled.exchange(true)) {
+        QMetaObject::invokeMethod(this, "processRequests",
+                                  Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void FcitxIPCWorker::acknowledgeResults() {
+    m_resultsScheduled.store(false);
+}
+
+bool FcitxIPCWorker::takeResult(FcitxIPCResult &result) {
+    return m_results.pop(result);
+}
+
+void FcitxIPCWorker::processRequests() {
+    m_requestsScheduled.store(false);
+    FcitxIPCRequest request;
+    while (m_requests.pop(request)) {
+        const quint64 id = request.id;
+        const bool portal = request.portal;
+        auto watcher = new QDBusPendingCallWatcher(
+            QDBusConnection(request.connectionName).asyncCall(request.message),
+            this);
+        m_calls[id] = Call{watcher, request.connectionName, request.message};
+        connect(watcher, &QDBusPendingCallWatcher::finished, this,
+                [this, id, portal](QDBusPendingCallWatcher *watcher) {
+                    const bool processed =
+                        FcitxInputContextProxy::processKeyEventReply(
+                            watcher->reply(), portal);
+                    finish(id, processed, watcher->isError());
+                });
+        const int deadline = m_deadline.load(std::memory_order_relaxed);
+        if (deadline > 0) {
+            // Give up on the reply, the key will be handled locally.
+            QTimer::singleShot(deadline, watcher,
+                               [this, id]() { expire(id); });
+        }
+    }
+}
+
+void FcitxIPCWorker::expire(quint64 id) {
+    auto iter = m_calls.find(id);
+    // The reply is already there, it is on its way to finish.
+    if (iter == m_calls.end() || iter->second.watcher->isFinished()) {
+        return;
+    }
+    const Call call = iter->second;
+    // Everything fcitx does for this key from now on is dropped, so the keys
+    // sent to the same input context after it are given up on along with
+    // it, otherwise what they commit would be lost.
+    std::vector<quint64> later;
+    for (const auto &other : m_calls) {
+        if (other.first > id &&
+            other.second.connectionName == call.connectionName &&
+            other.second.message.path() == call.message.path()) {
+            later.push_back(other.first);
+        }
+    }
+    std::sort(later.begin(), later.end());
+    finish(id, false, true, FcitxIPCResult::Expired);
+    for (quint64 laterId : later) {
+        finish(laterId, false, true);
+    }
+
+    // fcitx handles messages in order, so once it answers the Reset it has
+    // sent everything caused by the keys, and forgotten about them.
+    QDBusMessage reset = QDBusMessage::createMethodCall(
+        call.message.service(), call.message.path(), call.message.interface(),
+        QStringLiteral("Reset"));
+    auto watcher = new QDBusPendingCallWatcher(
+        QDBusConnection(call.connectionName).asyncCall(reset), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, id](QDBusPendingCallWatcher *watcher) {
+                watcher->deleteLater();
+                FcitxIPCResult result;
+                result.id = id;
+                result.type = FcitxIPCResult::ResetFinished;
+                pushResult(std::move(result));
+            });
+}
+
+void FcitxIPCWorker::finish(quint64 id, bool processed, bool error,
+                            FcitxIPCResult::Type type) {
+    auto iter = m_calls.find(id);
+    if (iter == m_calls.end()) {
+        return;
+    }
+    iter->second.watcher->deleteLater();
+    m_calls.erase(iter);
+
+    FcitxIPCResult result;
+    result.id = id;
+    result.type = type;
+    result.processed = processed;
+    result.error = error;
+    result.replyTime = FcitxFlightRecorder::now();
+    pushResult(std::move(result));
+}
+
+void FcitxIPCWorker::pushResult(FcitxIPCResult &&result) {
+    // Never fails, the GUI thread keeps at most MaxInFlight keys in flight.
+    m_results.push(std::move(result));
+    if (!m_resultsScheduled.exchange(true)) {
+        Q_EMIT resultsReady();
+    }
+}
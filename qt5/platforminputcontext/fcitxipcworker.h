@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#ifndef FCITXIPCWORKER_H_
+#define FCITXIPCWORKER_H_
+
+#include "fcitxspscqueue.h"
+#include <QDBusMessage>
+#include <QObject>
+#include <unordered_map>
+
+class QDBusPendingCallWatcher;
+
+struct FcitxIPCRequest {
+    quint64 id = 0;
+    QString connectionName;
+    QDBusMessage message;
+    bool portal = false;
+};
+
+struct FcitxIPCResult {
+    enum Type {
+        Reply,
+        // No reply within the deadline. fcitx still gets the key, so what it
+        // does for the key has to be dropped until the ResetFinished with the
+        // same id.
+        Expired,
+        // fcitx answered the Reset sent for an expired key, everything it
+        // did for the keys before has arrived.
+        ResetFinished,
+    };
+    quint64 id = 0;
+    Type type = Reply;
+    bool processed = false;
+    bool error = false;
+    // When the reply arrived, for the flight recorder.
+    qint64 replyTime = 0;
+};
+
+// Sends ProcessKeyEvent and waits for its reply on its own thread, so the
+// reply is received, timed and checked against the deadline even if the GUI
+// thread is busy. Results are handed back with a single resultsReady per
+// batch. send/takeResult/acknowledgeResults are only called from the GUI
+// thread.
+class FcitxIPCWorker : public QObject {
+    Q_OBJECT
+public:
+    static constexpr size_t MaxInFlight = 256;
+
+    // deadline is in milliseconds, 0 means waiting for reply forever.
+    explicit FcitxIPCWorker(int deadline);
+    ~FcitxIPCWorker();
+
+    // Can be called from any thread, applies to keys sent afterwards.
+    void setDeadline(int deadline) {
+        m_deadline.store(deadline, std::memory_order_relaxed);
+    }
+    bool send(FcitxIPCRequest &&request);
+    void acknowledgeResults();
+    bool takeResult(FcitxIPCResult &result);
+
+Q_SIGNALS:
+    void resultsReady();
+
+private Q_SLOTS:
+    void processRequests();
+
+private:
+    void finish(quint64 id, bool processed, bool error,
+                FcitxIPCResult::Type type = FcitxIPCResult::Reply);
+    void expire(quint64 id);
+    void pushResult(FcitxIPCResult &&result);
+
+    std::atomic<int> m_deadline;
+    FcitxSpscQueue<FcitxIPCRequest, MaxInFlight> m_requests;
+    // Every expired key adds a ResetFinished to its own result.
+    FcitxSpscQueue<FcitxIPCResult, MaxInFlight * 2> m_results;
+    std::atomic<bool> m_requestsScheduled{false};
+    std::atomic<bool> m_resultsScheduled{false};
+    struct Call {
+        QDBusPendingCallWatcher *watcher;
+        QString connectionName;
+        QDBusMessage message;
+    };
+    // Only touched by the worker thread.
+    std::unordered_map<quint64, Call> m_calls;
+};
+
+#endif // FCITXIPCWORKER_H_
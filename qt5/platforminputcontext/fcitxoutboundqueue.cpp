@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#include "fcitxoutboundqueue.h"
+#include "fcitxinputcontextproxy.h"
+#include <algorithm>
+
+FcitxOutboundQueue::FcitxOutboundQueue(QObject *parent) : QObject(parent) {
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(0);
+    connect(&m_timer, &QTimer::timeout, this, &FcitxOutboundQueue::flush);
+}
+
+FcitxOutboundQueue::~FcitxOutboundQueue() {}
+
+void FcitxOutboundQueue::schedule(FcitxInputContextProxy *proxy) {
+    if (std::find(m_proxies.begin(), m_proxies.end(), proxy) ==
+        m_proxies.end()) {
+        m_proxies.push_back(proxy);
+    }
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+void FcitxOutboundQueue::flush() {
+    auto proxies = std::move(m_proxies);
+    m_proxies.clear();
+    for (const auto &proxy : proxies) {
+        if (proxy) {
+            proxy->flushState(true);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXOUTBOUNDQUEUE_H_
+#define FCITXOUTBOUNDQUEUE_H_
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <vector>
+
+class FcitxInputContextProxy;
+
+// Sends the state updates of the input contexts on the fcitx connection
+// once the event loop is idle. Proxies keep only the latest value of each
+// kind until then, and send the ones a key depends on right before the key,
+// so a burst of update() doesn't delay the keys behind it.
+class FcitxOutboundQueue : public QObject {
+    Q_OBJECT
+public:
+    explicit FcitxOutboundQueue(QObject *parent = nullptr);
+    ~FcitxOutboundQueue();
+
+    void schedule(FcitxInputContextProxy *proxy);
+
+private Q_SLOTS:
+    void flush();
+
+private:
+    QTimer m_timer;
+    std::vector<QPointer<FcitxInputContextProxy>> m_proxies;
+};
+
+#endif // FCITXOUTBOUNDQUEUE_H_
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#include "fcitxpolicy.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QStandardPaths>
+#include <QTextStream>
+
+FcitxPolicy::FcitxPolicy(const QString &program, QObject *parent)
+    : QObject(parent), m_fsWatcher(new QFileSystemWatcher(this)),
+      m_program(program), m_programName(QFileInfo(program).fileName()) {
+    QByteArray path = qgetenv("FCITX_QT_POLICY_FILE");
+    if (!path.isEmpty()) {
+        m_path = QString::fromLocal8Bit(path);
+    } else {
+        m_path = QStandardPaths::writableLocation(
+                     QStandardPaths::GenericConfigLocation) +
+                 QStringLiteral("/fcitx/qt-policy.conf");
+    }
+    load();
+    connect(m_fsWatcher, SIGNAL(fileChanged(QString)), this,
+            SLOT(fileChanged()));
+    connect(m_fsWatcher, SIGNAL(directoryChanged(QString)), this,
+            SLOT(fileChanged()));
+    watch();
+}
+
+FcitxPolicy::~FcitxPolicy() {}
+
+void FcitxPolicy::watch() {
+    QFileInfo info(m_path);
+    if (info.exists()) {
+        if (!m_fsWatcher->directories().isEmpty()) {
+            m_fsWatcher->removePaths(m_fsWatcher->directories());
+        }
+        // A file replaced by rename drops out of the watcher, add it again.
+        if (!m_fsWatcher->files().contains(info.filePath())) {
+            m_fsWatcher->addPath(info.filePath());
+        }
+    } else {
+        // Not there yet, or removed, e.g. by an editor writing a new one, the
+        // directory is only watched until the file is there. Like
+        // FcitxWatcher, a missing directory is waited for in its parent
+        // rather than created.
+        const QString directory = info.dir().exists()
+                                      ? info.path()
+                                      : QFileInfo(info.path()).path();
+        if (!m_fsWatcher->directories().contains(directory)) {
+            if (!m_fsWatcher->directories().isEmpty()) {
+                m_fsWatcher->removePaths(m_fsWatcher->directories());
+            }
+            m_fsWatcher->addPath(directory);
+        }
+    }
+}
+
+void FcitxPolicy::fileChanged() {
+    watch();
+    if (load()) {
+        Q_EMIT changed();
+    }
+}
+
+bool FcitxPolicy::load() {
+    QFileInfo info(m_path);
+    const QDateTime lastModified =
+        info.exists() ? info.lastModified() : QDateTime();
+    const qint64 size = info.exists() ? info.size() : -1;
+    if (lastModified == m_lastModified && size == m_size) {
+        return false;
+    }
+    m_lastModified = lastModified;
+    m_size = size;
+
+    QHash<QString, QString> values;
+    QFile file(m_path);
+    if (file.open(QIODevice::ReadOnly)) {
+        QTextStream stream(&file);
+        QString line;
+        while (!(line = stream.readLine()).isNull()) {
+            const int comment = line.indexOf(QLatin1Char('#'));
+            if (comment >= 0) {
+                line.truncate(comment);
+            }
+            QStringList fields = line.simplified().split(QLatin1Char(' '));
+            const QString program = fields.takeFirst();
+            if (program.isEmpty() ||
+                (program != QLatin1String("*") && program != m_program &&
+                 program != m_programName)) {
+                continue;
+            }
+            for (const auto &field : fields) {
+                const int equal = field.indexOf(QLatin1Char('='));
+                if (equal <= 0) {
+                    continue;
+                }
+                values[field.left(equal)] = field.mid(equal + 1);
+            }
+        }
+    }
+    if (values == m_values) {
+        return false;
+    }
+    m_values = values;
+    return true;
+}
+
+bool FcitxPolicy::boolValue(const QString &key, bool defval) const {
+    auto iter = m_values.constFind(key);
+    if (iter == m_values.constEnd()) {
+        return defval;
+    }
+    return !(iter->isEmpty() || *iter == QLatin1String("0") ||
+             iter->compare(QLatin1String("false"), Qt::CaseInsensitive) == 0);
+}
+
+int FcitxPolicy::intValue(const QString &key, int defval) const {
+    auto iter = m_values.constFind(key);
+    if (iter == m_values.constEnd()) {
+        return defval;
+    }
+    bool ok = false;
+    const int value = iter->toInt(&ok);
+    return ok && value >= 0 ? value : defval;
+}
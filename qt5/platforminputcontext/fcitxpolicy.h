@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXPOLICY_H_
+#define FCITXPOLICY_H_
+
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+
+class QFileSystemWatcher;
+
+// Per program settings, read from $XDG_CONFIG_HOME/fcitx/qt-policy.conf or
+// FCITX_QT_POLICY_FILE. Each line is a program followed by key=value pairs,
+// the program is either the file name sent as "program" to fcitx, its full
+// path, or * for every program. All matching lines apply in order, e.g.
+//     *          suppress-key-release=true
+//     kate       sync=false key-deadline=50 surrounding-text-limit=1024
+// Only the settings of the current program are kept, and they are reloaded
+// when the file changes, also when it's created after the program started.
+// Environment variables still take precedence.
+// suppress-key-release, asking fcitx 5 which key releases it needs and
+// keeping the others, is off by default.
+class FcitxPolicy : public QObject {
+    Q_OBJECT
+public:
+    explicit FcitxPolicy(const QString &program, QObject *parent = nullptr);
+    ~FcitxPolicy();
+
+    bool boolValue(const QString &key, bool defval) const;
+    int intValue(const QString &key, int defval) const;
+
+Q_SIGNALS:
+    void changed();
+
+private Q_SLOTS:
+    void fileChanged();
+
+private:
+    void watch();
+    bool load();
+
+    QFileSystemWatcher *m_fsWatcher;
+    QString m_path;
+    QString m_program;
+    QString m_programName;
+    QHash<QString, QString> m_values;
+    QDateTime m_lastModified;
+    qint64 m_size = -1;
+};
+
+#endif // FCITXPOLICY_H_
@@ -63,6 +63,32 @@ const QDBusArgument &operator>>(const QDBusArgument &argument,
     return argument;
 }
 
+void FcitxFormattedPreeditText::registerMetaType() {
+    // The array is declared with the element type, which has to be known
+    // when the signature is computed.
+    FcitxFormattedPreedit::registerMetaType();
+    qRegisterMetaType<FcitxFormattedPreeditText>("FcitxFormattedPreeditText");
+    qDBusRegisterMetaType<FcitxFormattedPreeditText>();
+}
+
+void FcitxFormattedPreeditText::toggleFormat(qint32 bits) {
+    for (auto &segment : m_segments) {
+        segment.format ^= bits;
+    }
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxFormattedPreeditText &text) {
+    text.write(argument, qMetaTypeId<FcitxFormattedPreedit>());
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxFormattedPreeditText &text) {
+    text.read(argument);
+    return argument;
+}
+
 void FcitxInputContextArgument::registerMetaType() {
     qRegisterMetaType<FcitxInputContextArgument>("FcitxInputContextArgument");
     qDBusRegisterMetaType<FcitxInputContextArgument>();
@@ -100,3 +126,32 @@ const QDBusArgument &operator>>(const QDBusArgument &argument,
     arg.setValue(value);
     return argument;
 }
+
+void FcitxInputContextEvent::registerMetaType() {
+    qRegisterMetaType<FcitxInputContextEvent>("FcitxInputContextEvent");
+    qDBusRegisterMetaType<FcitxInputContextEvent>();
+    qRegisterMetaType<FcitxInputContextEventList>(
+        "FcitxInputContextEventList");
+    qDBusRegisterMetaType<FcitxInputContextEventList>();
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxInputContextEvent &event) {
+    argument.beginStructure();
+    argument << event.type();
+    argument << QDBusVariant(event.data());
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxInputContextEvent &event) {
+    quint32 type;
+    QDBusVariant data;
+    argument.beginStructure();
+    argument >> type >> data;
+    argument.endStructure();
+    event.setType(type);
+    event.setData(data.variant());
+    return argument;
+}
@@ -21,9 +21,11 @@
 #ifndef _DBUSADDONS_FCITXQTDBUSTYPES_H_
 #define _DBUSADDONS_FCITXQTDBUSTYPES_H_
 
+#include "fcitxqtpreeditsegments.h"
 #include <QDBusArgument>
 #include <QList>
 #include <QMetaType>
+#include <QVector>
 
 class FcitxFormattedPreedit {
 public:
@@ -48,6 +50,21 @@ QDBusArgument &operator<<(QDBusArgument &argument,
 const QDBusArgument &operator>>(const QDBusArgument &argument,
                                 FcitxFormattedPreedit &im);
 
+// Same wire format as FcitxFormattedPreeditList, a(si), but the segments
+// share a single string, the implementation is shared with dbusaddons.
+class FcitxFormattedPreeditText : public FcitxQtPreeditSegments {
+public:
+    // Toggle the given bits of the format of every segment.
+    void toggleFormat(qint32 bits);
+
+    static void registerMetaType();
+};
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxFormattedPreeditText &text);
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxFormattedPreeditText &text);
+
 class FcitxInputContextArgument {
 public:
     FcitxInputContextArgument() {}
@@ -73,10 +90,48 @@ QDBusArgument &operator<<(QDBusArgument &argument,
 const QDBusArgument &operator>>(const QDBusArgument &argument,
                                 FcitxInputContextArgument &im);
 
+// One of the actions caused by a key, in the reply of ProcessKeyEventBatch.
+// The data is a QDBusArgument for the structures.
+class FcitxInputContextEvent {
+public:
+    enum Type : quint32 {
+        // (a(si)i) preedit and cursor
+        UpdatePreedit = 0,
+        // (iu) offset and nchar
+        DeleteSurroundingText = 1,
+        // s
+        CommitString = 2,
+        // (uub) keyval, state and isRelease
+        ForwardKey = 3,
+    };
+
+    static void registerMetaType();
+
+    quint32 type() const { return m_type; }
+    const QVariant &data() const { return m_data; }
+    void setType(quint32 type) { m_type = type; }
+    void setData(const QVariant &data) { m_data = data; }
+
+private:
+    quint32 m_type = 0;
+    QVariant m_data;
+};
+
+typedef QList<FcitxInputContextEvent> FcitxInputContextEventList;
+
+QDBusArgument &operator<<(QDBusArgument &argument,
+                          const FcitxInputContextEvent &event);
+const QDBusArgument &operator>>(const QDBusArgument &argument,
+                                FcitxInputContextEvent &event);
+
 Q_DECLARE_METATYPE(FcitxFormattedPreedit)
 Q_DECLARE_METATYPE(FcitxFormattedPreeditList)
+Q_DECLARE_METATYPE(FcitxFormattedPreeditText)
 
 Q_DECLARE_METATYPE(FcitxInputContextArgument)
 Q_DECLARE_METATYPE(FcitxInputContextArgumentList)
 
+Q_DECLARE_METATYPE(FcitxInputContextEvent)
+Q_DECLARE_METATYPE(FcitxInputContextEventList)
+
 #endif // _DBUSADDONS_FCITXQTDBUSTYPES_H_
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxsessionrecorder.h"
+#include <QCoreApplication>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <xkbcommon/xkbcommon.h>
+
+namespace {
+
+const char magic[] = "FCITXREC";
+const quint32 version = 1;
+// Written out at focus changes and when this much piled up.
+const int bufferSize = 4096;
+
+qint64 monotonicTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+} // namespace
+
+FcitxSessionRecorder::FcitxSessionRecorder(const QString &path,
+                                           bool keepKeysyms)
+    : m_keepKeysyms(keepKeysyms) {
+    QString fileName = path;
+    fileName.replace(QLatin1String("%p"),
+                     QString::number(QCoreApplication::applicationPid()));
+    // Not with the umask, the timing of keys is enough to guess some.
+    const int fd = open(QFile::encodeName(fileName).constData(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    // The mode of open only applies if the file is new.
+    if (fchmod(fd, 0600) < 0 ||
+        !m_file.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        close(fd);
+        return;
+    }
+    m_buffer.reserve(bufferSize + sizeof(FcitxSessionRecord));
+    m_buffer.append(magic, sizeof(magic) - 1);
+    m_buffer.append(reinterpret_cast<const char *>(&version),
+                    sizeof(version));
+    m_last = monotonicTime();
+}
+
+FcitxSessionRecorder::~FcitxSessionRecorder() { flush(); }
+
+void FcitxSessionRecorder::record(FcitxSessionRecordType type,
+                                  const QWindow *window, quint32 arg0,
+                                  quint32 arg1, quint32 arg2, quint16 flags) {
+    if (!isOpen()) {
+        return;
+    }
+    const qint64 now = monotonicTime();
+    FcitxSessionRecord record;
+    record.delta = static_cast<quint32>(
+        std::min<qint64>(now - m_last, std::numeric_limits<quint32>::max()));
+    record.type = type;
+    record.window = windowId(window);
+    record.flags = flags;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    m_last = now;
+    m_buffer.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    if (type == FcitxSessionRecordType::Focus ||
+        m_buffer.size() >= bufferSize) {
+        flush();
+    }
+}
+
+void FcitxSessionRecorder::recordKey(FcitxSessionRecordType type,
+                                     const QWindow *window, quint32 keyval,
+                                     quint32 state, quint32 keycode,
+                                     quint16 flags) {
+    // Which key it was matters to the timing only for the keys that don't
+    // type anything. Space separates words, so it is masked too.
+    const quint32 unicode = xkb_keysym_to_utf32(keyval);
+    if (!m_keepKeysyms && unicode >= 0x20 && unicode != 0x7f) {
+        keyval = 'a';
+        keycode = 0;
+    }
+    record(type, window, keyval, state, keycode, flags);
+}
+
+void FcitxSessionRecorder::forgetWindow(const QObject *window) {
+    m_windows.erase(window);
+}
+
+void FcitxSessionRecorder::flush() {
+    if (!isOpen() || m_buffer.isEmpty()) {
+        return;
+    }
+    m_file.write(m_buffer);
+    m_file.flush();
+    m_buffer.clear();
+}
+
+quint8 FcitxSessionRecorder::windowId(const QWindow *window) {
+    if (!window) {
+        return 0;
+    }
+    auto iter = m_windows.find(window);
+    if (iter != m_windows.end()) {
+        return iter->second;
+    }
+    const quint8 id = m_nextWindow;
+    // 0 is no window.
+    m_nextWindow = m_nextWindow == 255 ? 1 : m_nextWindow + 1;
+    m_windows.emplace(window, id);
+    return id;
+}
+
+bool FcitxSessionRecorder::load(const QString &path,
+                                std::vector<FcitxSessionRecord> &records) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    const int headerSize = sizeof(magic) - 1 + sizeof(version);
+    quint32 fileVersion;
+    if (data.size() < headerSize || !data.startsWith(magic)) {
+        return false;
+    }
+    memcpy(&fileVersion, data.constData() + sizeof(magic) - 1,
+           sizeof(fileVersion));
+    if (fileVersion != version) {
+        return false;
+    }
+    // A record cut short by a crash is dropped.
+    const int count = (data.size() - headerSize) / sizeof(FcitxSessionRecord);
+    records.resize(count);
+    memcpy(records.data(), data.constData() + headerSize,
+           count * sizeof(FcitxSessionRecord));
+    return true;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#ifndef FCITXSESSIONRECORDER_H_
+#define FCITXSESSIONRECORDER_H_
+
+#include <QByteArray>
+#include <QFile>
+#include <unordered_map>
+#include <vector>
+
+// The file starts with the magic "FCITXREC" and the version as a quint32,
+// followed by records, all in the byte order of the recording machine.
+enum class FcitxSessionRecordType : quint8 {
+    // Input of the im module.
+    // args: keyval, state, keycode, flags: release 1, autorepeat 2
+    Key = 1,
+    // window is 0 if no window has the focus, flags: accepts input method 1,
+    // hidden text 2
+    Focus = 2,
+    // args: queries, hints
+    Query = 3,
+    // Comes before the Query that asked for it. Only lengths are kept.
+    // args: text length, cursor, anchor, in UTF-16
+    SurroundingText = 4,
+    // Responses of fcitx.
+    // args: keyval, state, flags: release 1, processed 2, error 4
+    KeyResult = 5,
+    // args: length
+    Commit = 6,
+    // args: segments, length, cursor
+    Preedit = 7,
+    // args: offset, nchar
+    DeleteSurroundingText = 8,
+    // args: keyval, state, flags: release 1
+    ForwardKey = 9,
+};
+
+struct FcitxSessionRecord {
+    // Microseconds since the previous record.
+    quint32 delta;
+    FcitxSessionRecordType type;
+    // Windows are numbered from 1 in the order they show up.
+    quint8 window;
+    quint16 flags;
+    quint32 args[3];
+};
+
+class QWindow;
+
+// Writes what goes in and out of the im module to a file, for
+// fcitx-qt5-replay to feed it through the im module again. Enabled by
+// FCITX_QT_RECORD=<path>, %p in path is replaced by the process id. Text is
+// never recorded, printable keys and space are recorded as 'a' unless
+// FCITX_QT_RECORD_KEYSYMS is set, and keys typed into a field with
+// Qt::ImhHiddenText or Qt::ImhSensitiveData are left out. Only the user
+// can read the file.
+class FcitxSessionRecorder {
+public:
+    FcitxSessionRecorder(const QString &path, bool keepKeysyms);
+    ~FcitxSessionRecorder();
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    void record(FcitxSessionRecordType type, const QWindow *window,
+                quint32 arg0 = 0, quint32 arg1 = 0, quint32 arg2 = 0,
+                quint16 flags = 0);
+    // Key, KeyResult and ForwardKey, with keyval anonymized.
+    void recordKey(FcitxSessionRecordType type, const QWindow *window,
+                   quint32 keyval, quint32 state, quint32 keycode,
+                   quint16 flags);
+    void forgetWindow(const QObject *window);
+    void flush();
+
+    static bool load(const QString &path,
+                     std::vector<FcitxSessionRecord> &records);
+
+private:
+    quint8 windowId(const QWindow *window);
+
+    QFile m_file;
+    QByteArray m_buffer;
+    qint64 m_last = 0;
+    bool m_keepKeysyms;
+    std::unordered_map<const void *, quint8> m_windows;
+    quint8 m_nextWindow = 1;
+};
+
+#endif // FCITXSESSIONRECORDER_H_
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+
+#include "fcitxshmtransport.h"
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusUnixFileDescriptor>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+namespace {
+
+constexpr quint32 RING_SIZE = 256;
+
+size_t ringBytes() {
+    return sizeof(FcitxShmRing) + (RING_SIZE - 1) * sizeof(FcitxShmRecord);
+}
+
+FcitxShmRing *createRing(int *fd) {
+#if defined(__linux__)
+    *fd = memfd_create("fcitx-qt-ring", MFD_CLOEXEC);
+    if (*fd < 0) {
+        return nullptr;
+    }
+    if (ftruncate(*fd, ringBytes()) < 0) {
+        return nullptr;
+    }
+    void *data = mmap(nullptr, ringBytes(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                      *fd, 0);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    // The memory is zero filled, which is a valid state for the atomics.
+    auto ring = static_cast<FcitxShmRing *>(data);
+    ring->size = RING_SIZE;
+    return ring;
+#else
+    Q_UNUSED(fd);
+    return nullptr;
+#endif
+}
+
+// Whether count reached sequence, the counters may wrap around.
+bool reached(quint32 count, quint32 sequence) {
+    return static_cast<qint32>(sequence - count) <= 0;
+}
+
+int createEventFd() {
+#if defined(__linux__)
+    return eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#else
+    return -1;
+#endif
+}
+
+} // namespace
+
+FcitxShmTransport::FcitxShmTransport(QObject *parent)
+    : QObject(parent), m_keyTimer(new QTimer(this)) {
+    m_keyTimer->setSingleShot(true);
+    connect(m_keyTimer, &QTimer::timeout, this,
+            &FcitxShmTransport::keyTimeout);
+    m_clock.start();
+}
+
+FcitxShmTransport::~FcitxShmTransport() { cleanUp(); }
+
+void FcitxShmTransport::setKeyTimeout(int msec) {
+    m_keyTimeout = msec > 0 ? msec : DefaultKeyTimeout;
+}
+
+bool FcitxShmTransport::setup(const QDBusConnection &connection,
+                              const QString &service, const QString &path) {
+    cleanUp();
+    if (!(connection.connectionCapabilities() &
+          QDBusConnection::UnixFileDescriptorPassing)) {
+        return false;
+    }
+
+    m_mapSize = ringBytes();
+    m_out = createRing(&m_outFd);
+    m_in = createRing(&m_inFd);
+    m_outEventFd = createEventFd();
+    m_inEventFd = createEventFd();
+    if (!m_out || !m_in || m_outEventFd < 0 || m_inEventFd < 0) {
+        cleanUp();
+        return false;
+    }
+
+    // Both sides count from here.
+    m_calls = m_signals = 0;
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        service, path, "org.fcitx.Fcitx.InputContext1",
+        "SetupSharedMemoryTransport");
+    message << QVariant::fromValue(QDBusUnixFileDescriptor(m_outFd))
+            << QVariant::fromValue(QDBusUnixFileDescriptor(m_outEventFd))
+            << QVariant::fromValue(QDBusUnixFileDescriptor(m_inFd))
+            << QVariant::fromValue(QDBusUnixFileDescriptor(m_inEventFd));
+    auto watcher =
+        new QDBusPendingCallWatcher(connection.asyncCall(message), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            &FcitxShmTransport::setupFinished);
+    return true;
+}
+
+void FcitxShmTransport::setupFinished(QDBusPendingCallWatcher *watcher) {
+    watcher->deleteLater();
+    // Old daemon will simply reply with UnknownMethod.
+    if (watcher->isError() || !m_in) {
+        cleanUp();
+        return;
+    }
+    // Signals before the reply were emitted before the daemon started
+    // counting.
+    m_signals = 0;
+    m_notifier = new QSocketNotifier(m_inEventFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this,
+            &FcitxShmTransport::readEvents);
+    m_active = true;
+}
+
+void FcitxShmTransport::cleanUp() {
+    bool wasActive = m_active;
+    m_active = false;
+    delete m_notifier;
+    m_notifier = nullptr;
+    for (auto ring : {m_out, m_in}) {
+        if (ring) {
+            munmap(ring, m_mapSize);
+        }
+    }
+    m_out = m_in = nullptr;
+    for (auto fd : {m_outFd, m_outEventFd, m_inFd, m_inEventFd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    m_outFd = m_outEventFd = m_inFd = m_inEventFd = -1;
+    m_backlog.clear();
+    m_results.clear();
+    m_pendingKeys.clear();
+    m_keyTimer->stop();
+    if (wasActive) {
+        Q_EMIT deactivated();
+    }
+}
+
+void FcitxShmTransport::callSent() { ++m_calls; }
+
+void FcitxShmTransport::signalReceived() {
+    // Results written before the signal was emitted go first.
+    if (m_active && readRing()) {
+        deliverResults();
+    }
+    ++m_signals;
+    if (m_active && !m_results.empty()) {
+        // The ones waiting for this signal go after it is delivered.
+        QMetaObject::invokeMethod(
+            this,
+            [this]() {
+                if (m_active) {
+                    deliverResults();
+                }
+            },
+            Qt::QueuedConnection);
+    }
+}
+
+bool FcitxShmTransport::push(FcitxShmRecord record) {
+    if (!m_active) {
+        return false;
+    }
+    record.sequence = m_calls;
+    m_backlog.push_back(record);
+    flushBacklog();
+    return true;
+}
+
+void FcitxShmTransport::flushBacklog() {
+    quint32 tail = m_out->tail.load(std::memory_order_relaxed);
+    const quint32 head = m_out->head.load(std::memory_order_acquire);
+    size_t count = 0;
+    while (count < m_backlog.size() && tail - head < RING_SIZE) {
+        m_out->records[tail % RING_SIZE] = m_backlog[count];
+        ++tail;
+        ++count;
+    }
+    if (!count) {
+        return;
+    }
+    m_backlog.erase(m_backlog.begin(), m_backlog.begin() + count);
+    m_out->tail.store(tail, std::memory_order_release);
+
+    quint64 one = 1;
+    ssize_t ret;
+    do {
+        ret = write(m_outEventFd, &one, sizeof(one));
+    } while (ret < 0 && errno == EINTR);
+}
+
+quint32 FcitxShmTransport::sendKeyEvent(uint keyval, uint keycode, uint state,
+                                        bool isRelease, uint time) {
+    FcitxShmRecord record;
+    record.type = FcitxShmRecordType::KeyEvent;
+    // 0 is reserved for failure.
+    if (++m_serial == 0) {
+        ++m_serial;
+    }
+    record.serial = m_serial;
+    record.args[0] = keyval;
+    record.args[1] = keycode;
+    record.args[2] = state;
+    record.args[3] = isRelease;
+    record.args[4] = time;
+    record.args[5] = 0;
+    if (!push(record)) {
+        return 0;
+    }
+    m_pendingKeys.emplace_back(record.serial, m_clock.elapsed());
+    if (!m_keyTimer->isActive()) {
+        startKeyTimer();
+    }
+    return record.serial;
+}
+
+void FcitxShmTransport::startKeyTimer() {
+    if (m_pendingKeys.empty()) {
+        m_keyTimer->stop();
+        return;
+    }
+    const qint64 waited = m_clock.elapsed() - m_pendingKeys.front().second;
+    m_keyTimer->start(static_cast<int>(qMax<qint64>(0, m_keyTimeout - waited)));
+}
+
+void FcitxShmTransport::keyTimeout() {
+    if (m_pendingKeys.empty()) {
+        return;
+    }
+    if (m_clock.elapsed() - m_pendingKeys.front().second < m_keyTimeout) {
+        startKeyTimer();
+        return;
+    }
+    // The daemon stopped answering, the pending keys are finished as errors
+    // once the transport is gone.
+    cleanUp();
+}
+
+bool FcitxShmTransport::sendCapability(qulonglong caps) {
+    FcitxShmRecord record{};
+    record.type = FcitxShmRecordType::Capability;
+    record.args[0] = static_cast<quint32>(caps);
+    record.args[1] = static_cast<quint32>(caps >> 32);
+    return push(record);
+}
+
+bool FcitxShmTransport::sendCursorRect(int x, int y, int w, int h) {
+    FcitxShmRecord record{};
+    record.type = FcitxShmRecordType::CursorRect;
+    record.args[0] = x;
+    record.args[1] = y;
+    record.args[2] = w;
+    record.args[3] = h;
+    return push(record);
+}
+
+void FcitxShmTransport::readEvents() {
+    quint64 value;
+    while (read(m_inEventFd, &value, sizeof(value)) > 0) {
+    }
+    if (!readRing()) {
+        return;
+    }
+    deliverResults();
+    // The daemon made room by reading the records the results are for.
+    if (m_active) {
+        flushBacklog();
+    }
+}
+
+bool FcitxShmTransport::readRing() {
+    quint32 head = m_in->head.load(std::memory_order_relaxed);
+    quint32 tail = m_in->tail.load(std::memory_order_acquire);
+    // Never trust the other side too much.
+    if (tail - head > RING_SIZE) {
+        cleanUp();
+        return false;
+    }
+    while (head != tail) {
+        const FcitxShmRecord record = m_in->records[head % RING_SIZE];
+        ++head;
+        if (record.type == FcitxShmRecordType::KeyResult) {
+            m_results.push_back(record);
+        }
+    }
+    m_in->head.store(head, std::memory_order_release);
+    return true;
+}
+
+void FcitxShmTransport::deliverResults() {
+    while (!m_results.empty() &&
+           reached(m_signals, m_results.front().sequence)) {
+        const FcitxShmRecord record = m_results.front();
+        m_results.erase(m_results.begin());
+        // Results come in order, anything before serial is lost.
+        auto iter = m_pendingKeys.begin();
+        while (iter != m_pendingKeys.end() && iter->first != record.serial) {
+            ++iter;
+        }
+        if (iter != m_pendingKeys.end()) {
+            m_pendingKeys.erase(m_pendingKeys.begin(), iter + 1);
+            startKeyTimer();
+        }
+        Q_EMIT keyEventResult(record.serial, record.args[0]);
+        // Receiver may tear us down.
+        if (!m_active) {
+            return;
+        }
+    }
+}
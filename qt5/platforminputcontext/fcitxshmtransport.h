@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2026 by agent
+ * agent@local
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above Copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above Copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ */
+
+#ifndef FCITXSHMTRANSPORT_H_
+#define FCITXSHMTRANSPORT_H_
+
+#include <QDBusConnection>
+#include <QElapsedTimer>
+#include <QObject>
+#include <atomic>
+#include <vector>
+
+class QDBusPendingCallWatcher;
+class QSocketNotifier;
+class QTimer;
+
+enum class FcitxShmRecordType : quint32 {
+    // client -> daemon, args: keyval, keycode, state, isRelease, time
+    KeyEvent = 1,
+    // client -> daemon, args: low 32 bits, high 32 bits
+    Capability = 2,
+    // client -> daemon, args: x, y, w, h
+    CursorRect = 3,
+    // daemon -> client, serial of the key event, args: processed
+    KeyResult = 16,
+};
+
+struct FcitxShmRecord {
+    FcitxShmRecordType type;
+    quint32 serial;
+    // client -> daemon: input context calls sent on D-Bus since
+    // SetupSharedMemoryTransport, daemon -> client: input context signals
+    // emitted on D-Bus since then. The record is handled after those.
+    quint32 sequence;
+    quint32 args[6];
+};
+
+// Single producer single consumer ring, it lives at the start of the memfd.
+struct FcitxShmRing {
+    alignas(64) std::atomic<quint32> head;
+    alignas(64) std::atomic<quint32> tail;
+    alignas(64) quint32 size;
+    FcitxShmRecord records[1];
+};
+
+// An optional transport for the hot part of the input context, negotiated
+// with SetupSharedMemoryTransport(h ring, h event, h ring, h event) on
+// org.fcitx.Fcitx.InputContext1. The first ring and eventfd are written by
+// the client, the second ones by the daemon. D-Bus stays the control plane,
+// and both sides keep one order over the two channels with the sequence of
+// each record: a record waits for the D-Bus messages counted in it, and
+// every D-Bus message of the input context is handled after the records
+// written before it was sent. Records that don't fit the ring wait for
+// room in order. A key without result after the key timeout tears the
+// transport down, like a D-Bus call that times out.
+class FcitxShmTransport : public QObject {
+    Q_OBJECT
+public:
+    // Same as the default timeout of QtDBus.
+    static constexpr int DefaultKeyTimeout = 25000;
+
+    FcitxShmTransport(QObject *parent = nullptr);
+    ~FcitxShmTransport();
+
+    // Create the rings and ask the daemon to attach them.
+    bool setup(const QDBusConnection &connection, const QString &service,
+               const QString &path);
+    bool isActive() const { return m_active; }
+    // Milliseconds a key waits for its result, <= 0 is the D-Bus default.
+    void setKeyTimeout(int msec);
+    // Waiting for the daemon to attach the rings.
+    bool isSettingUp() const { return m_out && !m_active; }
+    // Count an org.fcitx.Fcitx.InputContext1 call sent on D-Bus.
+    void callSent();
+    // Has to run when a signal of the input context arrives, before it is
+    // delivered, to deliver the results written ahead of it first.
+    void signalReceived();
+
+    // Returns 0 if the ring is not usable, the serial of the key otherwise.
+    quint32 sendKeyEvent(uint keyval, uint keycode, uint state, bool isRelease,
+                         uint time);
+    bool sendCapability(qulonglong caps);
+    bool sendCursorRect(int x, int y, int w, int h);
+
+Q_SIGNALS:
+    void keyEventResult(quint32 serial, bool processed);
+    void deactivated();
+
+private Q_SLOTS:
+    void setupFinished(QDBusPendingCallWatcher *watcher);
+    void readEvents();
+    void keyTimeout();
+
+private:
+    bool push(FcitxShmRecord record);
+    void flushBacklog();
+    bool readRing();
+    void deliverResults();
+    void cleanUp();
+    void startKeyTimer();
+
+    int m_outFd = -1;
+    int m_outEventFd = -1;
+    int m_inFd = -1;
+    int m_inEventFd = -1;
+    FcitxShmRing *m_out = nullptr;
+    FcitxShmRing *m_in = nullptr;
+    size_t m_mapSize = 0;
+    QSocketNotifier *m_notifier = nullptr;
+    quint32 m_serial = 0;
+    quint32 m_calls = 0;
+    quint32 m_signals = 0;
+    int m_keyTimeout = DefaultKeyTimeout;
+    QTimer *m_keyTimer;
+    QElapsedTimer m_clock;
+    // Records that didn't fit the ring, and results read from it but still
+    // waiting for signals.
+    std::vector<FcitxShmRecord> m_backlog;
+    std::vector<FcitxShmRecord> m_results;
+    // Serial and send time of the keys without result, oldest first.
+    std::vector<std::pair<quint32, qint64>> m_pendingKeys;
+    bool m_active = false;
+};
+
+#endif // FCITXSHMTRANSPORT_H_
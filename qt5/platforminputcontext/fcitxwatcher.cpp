@@ -71,10 +71,20 @@ QString socketFile() {
     return QString("%1/fcitx/dbus/%2").arg(home).arg(filename);
 }
 
+// fcitx 5 may advertise a peer to peer address here.
+QString peerSocketFile() {
+    QString runtime = QString::fromLocal8Bit(qgetenv("XDG_RUNTIME_DIR"));
+    if (runtime.isEmpty()) {
+        return QString();
+    }
+    return QString("%1/fcitx5/dbus-peer-%2").arg(runtime).arg(displayNumber());
+}
+
 FcitxWatcher::FcitxWatcher(QDBusConnection sessionBus, QObject *parent)
     : QObject(parent), m_fsWatcher(new QFileSystemWatcher(this)),
       m_serviceWatcher(new QDBusServiceWatcher(this)), m_connection(nullptr),
       m_sessionBus(sessionBus), m_socketFile(socketFile()),
+      m_peerSocketFile(peerSocketFile()),
       m_serviceName(QString("org.fcitx.Fcitx-%1").arg(displayNumber())),
       m_availability(false) {}
 
@@ -94,6 +104,9 @@ QDBusConnection FcitxWatcher::connection() const {
 }
 
 QString FcitxWatcher::service() const {
+    if (m_peer) {
+        return QString();
+    }
     if (m_connection) {
         return m_serviceName;
     }
@@ -106,6 +119,8 @@ QString FcitxWatcher::service() const {
     return QString();
 }
 
+bool FcitxWatcher::isPeer() const { return m_peer; }
+
 void FcitxWatcher::setAvailability(bool availability) {
     if (m_availability != availability) {
         m_availability = availability;
@@ -191,19 +206,62 @@ QString FcitxWatcher::address() {
     return addr;
 }
 
+QString FcitxWatcher::peerAddress() {
+    QByteArray addrVar = qgetenv("FCITX_DBUS_PEER_ADDRESS");
+    if (!addrVar.isNull())
+        return QString::fromLocal8Bit(addrVar);
+
+    if (m_peerSocketFile.isEmpty())
+        return QString();
+
+    QFile file(m_peerSocketFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    const int BUFSIZE = 1024;
+    QByteArray addr = file.readLine(BUFSIZE).trimmed();
+    file.close();
+    if (addr.isEmpty())
+        return QString();
+
+    return QString::fromLocal8Bit(addr);
+}
+
 void FcitxWatcher::cleanUpConnection() {
-    QDBusConnection::disconnectFromBus("fcitx");
+    if (m_peer) {
+        QDBusConnection::disconnectFromPeer("fcitx-peer");
+    } else {
+        QDBusConnection::disconnectFromBus("fcitx");
+    }
     delete m_connection;
     m_connection = nullptr;
+    m_peer = false;
 }
 
 void FcitxWatcher::socketFileChanged() {
     cleanUpConnection();
     createConnection();
+    // The directory of the peer socket file may have shown up.
+    if (!m_connection) {
+        watchSocketFile();
+    }
 }
 
 void FcitxWatcher::createConnection() {
-    QString addr = address();
+    // Prefer the direct connection, which skips the dbus-daemon hop.
+    QString peerAddr = peerAddress();
+    if (!peerAddr.isNull()) {
+        QDBusConnection connection(
+            QDBusConnection::connectToPeer(peerAddr, "fcitx-peer"));
+        if (connection.isConnected()) {
+            m_connection = new QDBusConnection(connection);
+            m_peer = true;
+        } else {
+            QDBusConnection::disconnectFromPeer("fcitx-peer");
+        }
+    }
+
+    QString addr = m_connection ? QString() : address();
     // qDebug() << addr;
     if (!addr.isNull()) {
         QDBusConnection connection(
@@ -227,25 +285,44 @@ void FcitxWatcher::createConnection() {
 }
 
 void FcitxWatcher::dbusDisconnected() {
+    const bool wasAvailable = m_availability;
     cleanUpConnection();
     watchSocketFile();
     // Try recreation immediately to avoid race.
     createConnection();
+    // The availability doesn't change if fcitx is still on the session bus,
+    // but nothing created on the dead connection works anymore.
+    if (wasAvailable && m_availability) {
+        Q_EMIT connectionReset();
+    }
 }
 
 void FcitxWatcher::watchSocketFile() {
-    if (m_socketFile.isEmpty()) {
-        return;
-    }
-    QFileInfo info(m_socketFile);
-    QDir dir(info.path());
-    if (!dir.exists()) {
-        QDir rt(QDir::root());
-        rt.mkpath(info.path());
+    unwatchSocketFile();
+    if (!m_socketFile.isEmpty()) {
+        QFileInfo info(m_socketFile);
+        QDir dir(info.path());
+        if (!dir.exists()) {
+            QDir rt(QDir::root());
+            rt.mkpath(info.path());
+        }
+        m_fsWatcher->addPath(info.path());
+        if (info.exists()) {
+            m_fsWatcher->addPath(info.filePath());
+        }
     }
-    m_fsWatcher->addPath(info.path());
-    if (info.exists()) {
-        m_fsWatcher->addPath(info.filePath());
+    // The directory belongs to fcitx 5, wait in $XDG_RUNTIME_DIR for it
+    // instead of creating it.
+    if (!m_peerSocketFile.isEmpty()) {
+        QFileInfo info(m_peerSocketFile);
+        if (QFileInfo(info.path()).isDir()) {
+            m_fsWatcher->addPath(info.path());
+            if (info.exists()) {
+                m_fsWatcher->addPath(info.filePath());
+            }
+        } else {
+            m_fsWatcher->addPath(QFileInfo(info.path()).path());
+        }
     }
 
     connect(m_fsWatcher, SIGNAL(fileChanged(QString)), this,
@@ -44,9 +44,16 @@ public:
 
     QDBusConnection connection() const;
     QString service() const;
+    // Whether connection() is a direct connection to fcitx without a bus
+    // daemon in between, object paths need to be called without service.
+    bool isPeer() const;
 
 Q_SIGNALS:
     void availabilityChanged(bool);
+    // The private or peer connection was lost and fcitx is still available,
+    // e.g. through the session bus or a new connection. Input contexts
+    // created on the old connection are gone.
+    void connectionReset();
 
 private Q_SLOTS:
     void dbusDisconnected();
@@ -56,6 +63,7 @@ private Q_SLOTS:
 
 private:
     QString address();
+    QString peerAddress();
     void watchSocketFile();
     void unwatchSocketFile();
     void createConnection();
@@ -68,10 +76,12 @@ private:
     QDBusConnection *m_connection;
     QDBusConnection m_sessionBus;
     QString m_socketFile;
+    QString m_peerSocketFile;
     QString m_serviceName;
     bool m_availability = false;
     bool m_mainPresent = false;
     bool m_portalPresent = false;
+    bool m_peer = false;
     bool m_watched = false;
 };
 
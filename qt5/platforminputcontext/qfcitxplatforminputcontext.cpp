@@ -25,14 +25,22 @@
 #include <QKeyEvent>
 #include <QPalette>
 #include <QTextCharFormat>
+#include <QThread>
+#include <QTimer>
 #include <QWindow>
+#include <climits>
 #include <qpa/qplatformcursor.h>
 #include <qpa/qplatformscreen.h>
 #include <qpa/qwindowsysteminterface.h>
 
 #include "qtkey.h"
 
+#include "fcitxcandidatewindow.h"
+#include "fcitxicscheduler.h"
 #include "fcitxinputcontextproxy.h"
+#include "fcitxoutboundqueue.h"
+#include "fcitxpolicy.h"
+#include "fcitxsessionrecorder.h"
 #include "fcitxwatcher.h"
 #include "qfcitxplatforminputcontext.h"
 
@@ -50,6 +58,20 @@ static bool get_boolean_env(const char *name, bool defval) {
     return true;
 }
 
+static int get_int_env(const char *name, int defval) {
+    const char *value = getenv(name);
+
+    if (value == nullptr)
+        return defval;
+
+    char *end = nullptr;
+    long result = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || result < 0 || result > INT_MAX)
+        return defval;
+
+    return static_cast<int>(result);
+}
+
 static inline const char *get_locale() {
     const char *locale = getenv("LC_ALL");
     if (!locale)
@@ -62,18 +84,6 @@ static inline const char *get_locale() {
     return locale;
 }
 
-static bool objectAcceptsInputMethod() {
-    bool enabled = false;
-    QObject *object = qApp->focusObject();
-    if (object) {
-        QInputMethodQueryEvent query(Qt::ImEnabled);
-        QGuiApplication::sendEvent(object, &query);
-        enabled = query.value(Qt::ImEnabled).toBool();
-    }
-
-    return enabled;
-}
-
 struct xkb_context *_xkb_context_new_helper() {
     struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     if (context) {
@@ -83,32 +93,138 @@ struct xkb_context *_xkb_context_new_helper() {
     return context;
 }
 
+// The connection of the application is there anyway most of the time, a
+// private one costs another socket, authentication and Hello on startup.
+static const char privateSessionBusName[] = "fcitx-platform-input-context";
+
+static QDBusConnection sessionBusConnection(bool shared) {
+    if (shared) {
+        QDBusConnection bus = QDBusConnection::sessionBus();
+        if (bus.isConnected()) {
+            return bus;
+        }
+    }
+    return QDBusConnection::connectToBus(QDBusConnection::SessionBus,
+                                         privateSessionBusName);
+}
+
+static quint32 traceId(const FcitxInputContextProxy *proxy) {
+    return proxy ? proxy->traceId() : 0;
+}
+
+static quint32 traceId(const QObject *proxy) {
+    return traceId(qobject_cast<const FcitxInputContextProxy *>(proxy));
+}
+
 QFcitxPlatformInputContext::QFcitxPlatformInputContext()
-    : m_watcher(new FcitxWatcher(
-          QDBusConnection::connectToBus(QDBusConnection::SessionBus,
-                                        "fcitx-platform-input-context"),
-          this)),
-      m_cursorPos(0), m_useSurroundingText(false),
-      m_syncMode(get_boolean_env("FCITX_QT_USE_SYNC", false)), m_destroy(false),
-      m_xkbContext(_xkb_context_new_helper()),
-      m_xkbComposeTable(m_xkbContext ? xkb_compose_table_new_from_locale(
-                                           m_xkbContext.data(), get_locale(),
-                                           XKB_COMPOSE_COMPILE_NO_FLAGS)
-                                     : 0),
-      m_xkbComposeState(m_xkbComposeTable
-                            ? xkb_compose_state_new(m_xkbComposeTable.data(),
-                                                    XKB_COMPOSE_STATE_NO_FLAGS)
-                            : 0) {
+    : m_watcher(nullptr), m_cursorPos(0), m_destroy(false),
+      m_recorder(new FcitxFlightRecorder(
+          get_int_env("FCITX_QT_FLIGHT_RECORDER", 0), this)),
+      m_policy(
+          new FcitxPolicy(QCoreApplication::applicationFilePath(), this)) {
+    m_uptime.start();
+    const QString recordPath =
+        QString::fromLocal8Bit(qgetenv("FCITX_QT_RECORD"));
+    if (!recordPath.isEmpty()) {
+        m_sessionRecorder.reset(new FcitxSessionRecorder(
+            recordPath, get_boolean_env("FCITX_QT_RECORD_KEYSYMS", false)));
+        if (!m_sessionRecorder->isOpen()) {
+            qWarning() << "Failed to open" << recordPath;
+            m_sessionRecorder.reset();
+        }
+    }
+    QDBusConnection bus = sessionBusConnection(
+        get_boolean_env("FCITX_QT_SHARE_SESSION_BUS",
+                        m_policy->boolValue("share-session-bus", true)));
+    m_watcher = new FcitxWatcher(bus, this);
+    m_icScheduler = new FcitxICScheduler(m_watcher, m_recorder, this);
+    m_outboundQueue = new FcitxOutboundQueue(this);
+    applyPolicy();
+    connect(m_policy, &FcitxPolicy::changed, this,
+            &QFcitxPlatformInputContext::applyPolicy);
+    // Also without the ring buffer for the counters. The unique name of
+    // the connection in use tells the process, whether it is the private
+    // one or the application's.
+    if (!bus.registerObject(QStringLiteral("/org/fcitx/FlightRecorder"),
+                            m_recorder,
+                            QDBusConnection::ExportScriptableSlots |
+                                QDBusConnection::ExportScriptableProperties)) {
+        qWarning() << "Failed to export the flight recorder on"
+                   << bus.name();
+    }
+    if (m_recorder->isEnabled()) {
+        connect(m_watcher, &FcitxWatcher::availabilityChanged, this,
+                [this](bool availability) {
+                    m_recorder->record(
+                        FcitxFlightEventType::WatcherAvailability, 0, 0, 0,
+                        availability);
+                });
+    }
+    if (!m_syncMode &&
+        get_boolean_env("FCITX_QT_USE_IPC_THREAD",
+                        m_policy->boolValue("ipc-thread", false))) {
+        m_ipcThread = new QThread(this);
+        m_ipcWorker = new FcitxIPCWorker(m_keyDeadline);
+        m_ipcWorker->moveToThread(m_ipcThread);
+        connect(m_ipcThread, &QThread::finished, m_ipcWorker,
+                &QObject::deleteLater);
+        connect(m_ipcWorker, &FcitxIPCWorker::resultsReady, this,
+                &QFcitxPlatformInputContext::processIPCResults,
+                Qt::QueuedConnection);
+        m_ipcThread->start();
+    }
     m_watcher->watch();
 }
 
 QFcitxPlatformInputContext::~QFcitxPlatformInputContext() {
     m_destroy = true;
+    // Input contexts are going away with us, not because fcitx did.
+    delete m_icScheduler;
+    if (m_ipcThread) {
+        m_ipcThread->quit();
+        m_ipcThread->wait();
+    }
     m_watcher->unwatch();
     cleanUp();
     delete m_watcher;
 }
 
+void QFcitxPlatformInputContext::applyPolicy() {
+    m_syncMode = get_boolean_env("FCITX_QT_USE_SYNC",
+                                 m_policy->boolValue("sync", false));
+    m_useSharedMemory = get_boolean_env(
+        "FCITX_QT_USE_SHM", m_policy->boolValue("shared-memory", false));
+    m_suppressKeyRelease =
+        get_boolean_env("FCITX_QT_SUPPRESS_KEY_RELEASE",
+                        m_policy->boolValue("suppress-key-release", false));
+    m_useSurroundingText =
+        get_boolean_env("FCITX_QT_ENABLE_SURROUNDING_TEXT",
+                        m_policy->boolValue("surrounding-text", true));
+    m_surroundingTextLimit =
+        get_int_env("FCITX_QT_SURROUNDING_TEXT_LIMIT",
+                    m_policy->intValue("surrounding-text-limit", 4096));
+    m_keyDeadline = get_int_env("FCITX_QT_KEY_DEADLINE",
+                                m_policy->intValue("key-deadline", 0));
+    m_earlyInputTimeout =
+        get_int_env("FCITX_QT_EARLY_INPUT_TIMEOUT",
+                    m_policy->intValue("early-input-timeout", 300));
+    m_passwordFastPath =
+        get_boolean_env("FCITX_QT_PASSWORD_FAST_PATH",
+                        m_policy->boolValue("password-fast-path", true));
+    m_autoRepeatBacklog =
+        get_int_env("FCITX_QT_AUTOREPEAT_BACKLOG",
+                    m_policy->intValue("autorepeat-backlog", 2));
+    m_clientSideUI =
+        get_boolean_env("FCITX_QT_CLIENT_SIDE_UI",
+                        m_policy->boolValue("client-side-ui", false));
+    m_clientSideControlState = get_boolean_env(
+        "FCITX_QT_CLIENT_SIDE_CONTROL_STATE",
+        m_policy->boolValue("client-side-control-state", false));
+    if (m_ipcWorker) {
+        m_ipcWorker->setDeadline(m_keyDeadline);
+    }
+}
+
 void QFcitxPlatformInputContext::cleanUp() {
     m_icMap.clear();
 
@@ -119,6 +235,39 @@ void QFcitxPlatformInputContext::cleanUp() {
 
 bool QFcitxPlatformInputContext::isValid() const { return true; }
 
+bool QFcitxPlatformInputContext::queryFocusObject() {
+    QObject *object = qApp->focusObject();
+    if (!object) {
+        return false;
+    }
+    if (object == m_imEnabledObject) {
+        m_recorder->countImEnabledQuery(true);
+        return true;
+    }
+
+    QInputMethodQueryEvent query(Qt::ImEnabled | Qt::ImHints);
+    QGuiApplication::sendEvent(object, &query);
+    m_imEnabled = query.value(Qt::ImEnabled).toBool();
+    m_imHints = Qt::InputMethodHints(query.value(Qt::ImHints).toUInt());
+    m_imEnabledObject = object;
+    m_recorder->countImEnabledQuery(false);
+    return true;
+}
+
+bool QFcitxPlatformInputContext::objectAcceptsInputMethod() {
+    return queryFocusObject() && m_imEnabled;
+}
+
+bool QFcitxPlatformInputContext::isPasswordFocus() {
+    return m_passwordFastPath && queryFocusObject() &&
+           m_imHints.testFlag(Qt::ImhHiddenText);
+}
+
+bool QFcitxPlatformInputContext::isSensitiveFocus() {
+    return queryFocusObject() &&
+           (m_imHints & (Qt::ImhHiddenText | Qt::ImhSensitiveData));
+}
+
 void QFcitxPlatformInputContext::invokeAction(QInputMethod::Action action,
                                               int cursorPosition) {
     if (action == QInputMethod::Click &&
@@ -137,7 +286,7 @@ void QFcitxPlatformInputContext::commitPreedit(QPointer<QObject> input) {
     e.setCommitString(m_commitPreedit);
     QCoreApplication::sendEvent(input, &e);
     m_commitPreedit.clear();
-    m_preeditList.clear();
+    m_preeditText.clear();
 }
 
 bool checkUtf8(const QByteArray &byteArray) {
@@ -149,6 +298,7 @@ void QFcitxPlatformInputContext::reset() {
     commitPreedit();
     if (FcitxInputContextProxy *proxy = validIC()) {
         proxy->reset();
+        proxy->icData()->clearMergedRepeats();
     }
     if (m_xkbComposeState) {
         xkb_compose_state_reset(m_xkbComposeState.data());
@@ -157,6 +307,25 @@ void QFcitxPlatformInputContext::reset() {
 }
 
 void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
+    if (queries & (Qt::ImEnabled | Qt::ImHints)) {
+        m_imEnabledObject.clear();
+        const bool passwordFocus = isPasswordFocus();
+        if (passwordFocus != m_passwordFocus) {
+            m_passwordFocus = passwordFocus;
+            if (FcitxInputContextProxy *proxy = validIC()) {
+                if (passwordFocus) {
+                    proxy->focusOut();
+                } else {
+                    proxy->focusIn();
+                }
+            }
+        }
+    }
+    // Nothing about a password field is sent to fcitx.
+    if (m_passwordFocus) {
+        return;
+    }
+
     // ignore the boring query
     if (!(queries & (Qt::ImCursorRectangle | Qt::ImHints |
                      Qt::ImSurroundingText | Qt::ImCursorPosition))) {
@@ -168,8 +337,7 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
     if (!proxy)
         return;
 
-    FcitxQtICData &data = *static_cast<FcitxQtICData *>(
-        proxy->property("icData").value<void *>());
+    FcitxQtICData &data = *proxy->icData();
 
     QObject *input = qApp->focusObject();
     if (!input)
@@ -177,6 +345,18 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
 
     QInputMethodQueryEvent query(queries);
     QGuiApplication::sendEvent(input, &query);
+    if (m_sessionRecorder) {
+        if (queries & Qt::ImSurroundingText) {
+            m_sessionRecorder->record(
+                FcitxSessionRecordType::SurroundingText, window,
+                query.value(Qt::ImSurroundingText).toString().length(),
+                query.value(Qt::ImCursorPosition).toInt(),
+                query.value(Qt::ImAnchorPosition).toInt());
+        }
+        m_sessionRecorder->record(FcitxSessionRecordType::Query, window,
+                                  queries,
+                                  query.value(Qt::ImHints).toUInt());
+    }
 
     if (queries & Qt::ImCursorRectangle) {
         cursorRectChanged();
@@ -221,9 +401,8 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
         if (!var.isValid() || !var1.isValid())
             break;
         QString text = var.toString();
-/* we don't want to waste too much memory here */
-#define SURROUNDING_THRESHOLD 4096
-        if (text.length() < SURROUNDING_THRESHOLD) {
+        /* we don't want to waste too much memory here */
+        if (text.length() < m_surroundingTextLimit) {
             if (checkUtf8(text.toUtf8())) {
                 addCapability(data, CAPACITY_SURROUNDING_TEXT);
 
@@ -234,11 +413,7 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
                 else
                     anchor = cursor;
 
-                // adjust it to real character size
-                QVector<uint> tempUCS4 = text.left(cursor).toUcs4();
-                cursor = tempUCS4.size();
-                tempUCS4 = text.left(anchor).toUcs4();
-                anchor = tempUCS4.size();
+                surroundingTextPosition(text, cursor, anchor);
                 if (data.surroundingText != text) {
                     data.surroundingText = text;
                     proxy->setSurroundingText(text, cursor, anchor);
@@ -264,11 +439,16 @@ void QFcitxPlatformInputContext::update(Qt::InputMethodQueries queries) {
 void QFcitxPlatformInputContext::commit() { QPlatformInputContext::commit(); }
 
 void QFcitxPlatformInputContext::setFocusObject(QObject *object) {
-    Q_UNUSED(object);
+    m_imEnabledObject.clear();
+    if (m_candidateWindow) {
+        m_candidateWindow->hide();
+    }
     FcitxInputContextProxy *proxy = validICByWindow(m_lastWindow);
     commitPreedit(m_lastObject);
     if (proxy) {
+        m_recorder->record(FcitxFlightEventType::FocusOut, traceId(proxy));
         proxy->focusOut();
+        proxy->icData()->clearMergedRepeats();
     }
 
     QWindow *window = qApp->focusWindow();
@@ -281,12 +461,25 @@ void QFcitxPlatformInputContext::setFocusObject(QObject *object) {
             createICData(window);
         }
     }
+    m_passwordFocus = false;
     if (!window || (!inputMethodAccepted() && !objectAcceptsInputMethod())) {
+        if (m_sessionRecorder) {
+            m_sessionRecorder->record(FcitxSessionRecordType::Focus, window);
+        }
         m_lastWindow = nullptr;
         m_lastObject = nullptr;
         return;
     }
-    if (proxy) {
+    // fcitx stays focused out until focus leaves the password field.
+    m_passwordFocus = isPasswordFocus();
+    if (m_sessionRecorder) {
+        const bool hidden =
+            queryFocusObject() && m_imHints.testFlag(Qt::ImhHiddenText);
+        m_sessionRecorder->record(FcitxSessionRecordType::Focus, window, 0, 0,
+                                  0, hidden ? 3 : 1);
+    }
+    if (proxy && !m_passwordFocus) {
+        m_recorder->record(FcitxFlightEventType::FocusIn, traceId(proxy));
         proxy->focusIn();
         // We need to delegate this otherwise it may cause self-recursion in
         // certain application like libreoffice.
@@ -306,8 +499,17 @@ void QFcitxPlatformInputContext::setFocusObject(QObject *object) {
 }
 
 void QFcitxPlatformInputContext::windowDestroyed(QObject *object) {
+    if (m_sessionRecorder) {
+        m_sessionRecorder->forgetWindow(object);
+    }
     /* access QWindow is not possible here, so we use our own map to do so */
-    m_icMap.erase(reinterpret_cast<QWindow *>(object));
+    auto iter = m_icMap.find(reinterpret_cast<QWindow *>(object));
+    if (iter == m_icMap.end()) {
+        return;
+    }
+    m_recorder->record(FcitxFlightEventType::ICDestroy,
+                       traceId(iter->second.proxy));
+    m_icMap.erase(iter);
     // qDebug() << "Window Destroyed and we destroy IC correctly, horray!";
 }
 
@@ -319,13 +521,20 @@ void QFcitxPlatformInputContext::cursorRectChanged() {
     if (!proxy)
         return;
 
-    FcitxQtICData &data = *static_cast<FcitxQtICData *>(
-        proxy->property("icData").value<void *>());
+    FcitxQtICData &data = *proxy->icData();
 
     QRect r = qApp->inputMethod()->cursorRectangle().toRect();
     if (!r.isValid())
         return;
 
+    // fcitx has no window to place then, only our own popup follows it.
+    if (data.capability & CAPACITY_CLIENT_SIDE_UI) {
+        if (m_candidateWindow && m_candidateWindow->isVisible()) {
+            m_candidateWindow->moveToCursor(inputWindow, r);
+        }
+        return;
+    }
+
     // not sure if this is necessary but anyway, qt's screen used to be buggy.
     if (!inputWindow->screen()) {
         return;
@@ -360,27 +569,16 @@ void QFcitxPlatformInputContext::createInputContextFinished() {
     if (!proxy) {
         return;
     }
-    auto w = static_cast<QWindow *>(proxy->property("wid").value<void *>());
-    FcitxQtICData *data =
-        static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>());
-    data->rect = QRect();
-
-    if (proxy->isValid()) {
-        QWindow *window = qApp->focusWindow();
-        if (window && window == w && inputMethodAccepted() &&
-            objectAcceptsInputMethod()) {
-            cursorRectChanged();
-            proxy->focusIn();
-        }
-    }
+    auto w = proxy->window();
+    FcitxQtICData *data = proxy->icData();
+    m_recorder->record(FcitxFlightEventType::ICCreated, traceId(proxy), 0, 0,
+                       proxy->isValid());
 
     QFlags<FcitxCapabilityFlags> flag;
     flag |= CAPACITY_PREEDIT;
     flag |= CAPACITY_FORMATTED_PREEDIT;
     flag |= CAPACITY_CLIENT_UNFOCUS_COMMIT;
     flag |= CAPACITY_GET_IM_INFO_ON_FOCUS;
-    m_useSurroundingText =
-        get_boolean_env("FCITX_QT_ENABLE_SURROUNDING_TEXT", true);
     if (m_useSurroundingText) {
         flag |= CAPACITY_SURROUNDING_TEXT;
     }
@@ -389,20 +587,71 @@ void QFcitxPlatformInputContext::createInputContextFinished() {
         flag |= CAPACITY_RELATIVE_CURSOR_RECT;
     }
 
+    if (m_clientSideControlState && proxy->supportsClientSideControlState()) {
+        flag |= CAPACITY_CLIENT_SIDE_CONTROL_STATE;
+    }
+
+    // Only fcitx 4 sends UpdateClientSideUI.
+    if (m_clientSideUI && !proxy->isPortal()) {
+        flag |= CAPACITY_CLIENT_SIDE_UI;
+    }
+
+    // Replay what the previous input context of this window knew, after a
+    // restart of fcitx that is the state right before it. None of these
+    // calls waits for its reply, so they go out as one burst.
     addCapability(*data, flag, true);
+    if (!proxy->isValid()) {
+        return;
+    }
+    if (data->rect.isValid()) {
+        proxy->setCursorRect(data->rect.x(), data->rect.y(),
+                             data->rect.width(), data->rect.height());
+    }
+    if (data->capability.testFlag(CAPACITY_SURROUNDING_TEXT) &&
+        data->surroundingCursor >= 0) {
+        proxy->setSurroundingText(data->surroundingText,
+                                  data->surroundingCursor,
+                                  data->surroundingAnchor);
+    }
+
+    QWindow *window = qApp->focusWindow();
+    const bool focused = window && window == w && !m_passwordFocus &&
+                         inputMethodAccepted() && objectAcceptsInputMethod();
+    if (focused) {
+        cursorRectChanged();
+        proxy->focusIn();
+    }
+
+    if (m_recorder->timeToFirstInputContext() < 0) {
+        m_recorder->setTimeToFirstInputContext(m_uptime.elapsed());
+    }
+    data->earlyInputExpired = false;
+    // Repeats held back for a key of the previous input context.
+    data->clearMergedRepeats();
+    // Keys typed meanwhile only make sense to fcitx if they are still meant
+    // for the focused input.
+    flushEarlyInput(proxy, focused);
 }
 
 void QFcitxPlatformInputContext::updateCapability(const FcitxQtICData &data) {
     if (!data.proxy || !data.proxy->isValid())
         return;
 
-    QDBusPendingReply<void> result =
-        data.proxy->setCapability((uint)data.capability);
+    data.proxy->setCapability((uint)data.capability);
 }
 
 void QFcitxPlatformInputContext::commitString(const QString &str) {
+    m_recorder->record(FcitxFlightEventType::Commit, traceId(sender()),
+                       str.length());
+    if (dropsActions(sender())) {
+        return;
+    }
+    if (m_sessionRecorder) {
+        m_sessionRecorder->record(FcitxSessionRecordType::Commit,
+                                  qApp->focusWindow(), str.length());
+    }
     m_cursorPos = 0;
-    m_preeditList.clear();
+    m_preeditText.clear();
     m_commitPreedit.clear();
     QObject *input = qApp->focusObject();
     if (!input)
@@ -414,17 +663,27 @@ void QFcitxPlatformInputContext::commitString(const QString &str) {
 }
 
 void QFcitxPlatformInputContext::updateFormattedPreedit(
-    const FcitxFormattedPreeditList &preeditList, int cursorPos) {
+    const FcitxFormattedPreeditText &preeditText, int cursorPos) {
+    m_recorder->record(FcitxFlightEventType::Preedit, traceId(sender()),
+                       preeditText.segments().size(), cursorPos);
+    if (m_sessionRecorder) {
+        m_sessionRecorder->record(
+            FcitxSessionRecordType::Preedit, qApp->focusWindow(),
+            preeditText.segments().size(), preeditText.text().length(),
+            cursorPos);
+    }
     QObject *input = qApp->focusObject();
     if (!input)
         return;
-    if (cursorPos == m_cursorPos && preeditList == m_preeditList)
+    if (cursorPos == m_cursorPos && preeditText == m_preeditText)
         return;
-    m_preeditList = preeditList;
+    m_preeditText = preeditText;
     m_cursorPos = cursorPos;
-    QString str, commitStr;
-    int pos = 0;
+    const QString &str = preeditText.text();
+    QString commitStr;
+    bool commitAll = true;
     QList<QInputMethodEvent::Attribute> attrList;
+    attrList.reserve(preeditText.segments().size() + 1);
 
     // Fcitx 5's flags support.
     enum TextFormatFlag : int {
@@ -436,24 +695,29 @@ void QFcitxPlatformInputContext::updateFormattedPreedit(
         TextFormatFlag_Italic = (1 << 8),
     };
 
-    Q_FOREACH (const FcitxFormattedPreedit &preedit, preeditList) {
-        str += preedit.string();
-        if (!(preedit.format() & TextFormatFlag_DontCommit))
-            commitStr += preedit.string();
+    for (const auto &preedit : preeditText.segments()) {
+        if (preedit.format & TextFormatFlag_DontCommit) {
+            if (commitAll) {
+                commitStr = str.left(preedit.offset);
+                commitAll = false;
+            }
+        } else if (!commitAll) {
+            commitStr += str.mid(preedit.offset, preedit.length);
+        }
         QTextCharFormat format;
-        if (preedit.format() & TextFormatFlag_Underline) {
+        if (preedit.format & TextFormatFlag_Underline) {
             format.setUnderlineStyle(QTextCharFormat::DashUnderline);
         }
-        if (preedit.format() & TextFormatFlag_Strike) {
+        if (preedit.format & TextFormatFlag_Strike) {
             format.setFontStrikeOut(true);
         }
-        if (preedit.format() & TextFormatFlag_Bold) {
+        if (preedit.format & TextFormatFlag_Bold) {
             format.setFontWeight(QFont::Bold);
         }
-        if (preedit.format() & TextFormatFlag_Italic) {
+        if (preedit.format & TextFormatFlag_Italic) {
             format.setFontItalic(true);
         }
-        if (preedit.format() & TextFormatFlag_HighLight) {
+        if (preedit.format & TextFormatFlag_HighLight) {
             QBrush brush;
             QPalette palette;
             palette = QGuiApplication::palette();
@@ -462,10 +726,13 @@ void QFcitxPlatformInputContext::updateFormattedPreedit(
             format.setForeground(QBrush(QColor(
                 palette.color(QPalette::Active, QPalette::HighlightedText))));
         }
-        attrList.append(
-            QInputMethodEvent::Attribute(QInputMethodEvent::TextFormat, pos,
-                                         preedit.string().length(), format));
-        pos += preedit.string().length();
+        attrList.append(QInputMethodEvent::Attribute(
+            QInputMethodEvent::TextFormat, preedit.offset, preedit.length,
+            format));
+    }
+    // Most of the time everything is committed, share the string then.
+    if (commitAll) {
+        commitStr = str;
     }
 
     QByteArray array = str.toUtf8();
@@ -481,63 +748,106 @@ void QFcitxPlatformInputContext::updateFormattedPreedit(
     update(Qt::ImCursorRectangle);
 }
 
+void QFcitxPlatformInputContext::updateClientSideUI(const QString &auxUp,
+                                                    const QString &auxDown,
+                                                    const QString &candidates) {
+    auto proxy = qobject_cast<FcitxInputContextProxy *>(sender());
+    if (!proxy) {
+        return;
+    }
+    QWindow *window = qApp->focusWindow();
+    if (!window || window != proxy->window()) {
+        return;
+    }
+    if (!m_candidateWindow) {
+        if (auxUp.isEmpty() && auxDown.isEmpty() && candidates.isEmpty()) {
+            return;
+        }
+        m_candidateWindow.reset(new FcitxCandidateWindow);
+    }
+    if (!m_candidateWindow->setContent(auxUp, auxDown, candidates)) {
+        m_candidateWindow->hide();
+        return;
+    }
+    m_candidateWindow->moveToCursor(
+        window, qApp->inputMethod()->cursorRectangle().toRect());
+    m_candidateWindow->show();
+}
+
 void QFcitxPlatformInputContext::deleteSurroundingText(int offset,
                                                        uint _nchar) {
+    m_recorder->record(FcitxFlightEventType::DeleteSurroundingText,
+                       traceId(sender()), offset, _nchar);
+    if (dropsActions(sender())) {
+        return;
+    }
+    if (m_sessionRecorder) {
+        m_sessionRecorder->record(FcitxSessionRecordType::DeleteSurroundingText,
+                                  qApp->focusWindow(), offset, _nchar);
+    }
     QObject *input = qApp->focusObject();
     if (!input)
         return;
 
-    QInputMethodEvent event;
-
     FcitxInputContextProxy *proxy =
         qobject_cast<FcitxInputContextProxy *>(sender());
     if (!proxy) {
         return;
     }
 
-    FcitxQtICData *data =
-        static_cast<FcitxQtICData *>(proxy->property("icData").value<void *>());
-    auto ucsText = data->surroundingText.toStdU32String();
-
-    int cursor = data->surroundingCursor;
+    FcitxQtICData *data = proxy->icData();
     // make nchar signed so we are safer
     int nchar = _nchar;
+    if (surroundingTextDeletion(data->surroundingText, data->surroundingCursor,
+                                data->surroundingAnchor, offset, nchar)) {
+        QInputMethodEvent event;
+        event.setCommitString("", offset, nchar);
+        QCoreApplication::sendEvent(input, &event);
+    }
+}
+
+bool QFcitxPlatformInputContext::surroundingTextDeletion(const QString &text,
+                                                         int cursor,
+                                                         int anchor,
+                                                         int &offset,
+                                                         int &nchar) {
+    auto ucsText = text.toStdU32String();
+
     // Qt's reconvert semantics is different from gtk's. It doesn't count the
     // current
     // selection. Discard selection from nchar.
-    if (data->surroundingAnchor < data->surroundingCursor) {
-        nchar -= data->surroundingCursor - data->surroundingAnchor;
-        offset += data->surroundingCursor - data->surroundingAnchor;
-        cursor = data->surroundingAnchor;
-    } else if (data->surroundingAnchor > data->surroundingCursor) {
-        nchar -= data->surroundingAnchor - data->surroundingCursor;
-        cursor = data->surroundingCursor;
+    if (anchor < cursor) {
+        nchar -= cursor - anchor;
+        offset += cursor - anchor;
+        cursor = anchor;
+    } else if (anchor > cursor) {
+        nchar -= anchor - cursor;
     }
 
     // validates
-    if (nchar >= 0 && cursor + offset >= 0 &&
-        cursor + offset + nchar <= static_cast<int>(ucsText.size())) {
-        // order matters
-        auto replacedChars = ucsText.substr(cursor + offset, nchar);
-        nchar = QString::fromUcs4(replacedChars.data(), replacedChars.size())
-                    .size();
-
-        int start, len;
-        if (offset >= 0) {
-            start = cursor;
-            len = offset;
-        } else {
-            start = cursor + offset;
-            len = -offset;
-        }
-
-        auto prefixedChars = ucsText.substr(start, len);
-        offset = QString::fromUcs4(prefixedChars.data(), prefixedChars.size())
-                     .size() *
-                 (offset >= 0 ? 1 : -1);
-        event.setCommitString("", offset, nchar);
-        QCoreApplication::sendEvent(input, &event);
+    if (nchar < 0 || cursor + offset < 0 ||
+        cursor + offset + nchar > static_cast<int>(ucsText.size())) {
+        return false;
     }
+    // order matters
+    auto replacedChars = ucsText.substr(cursor + offset, nchar);
+    nchar =
+        QString::fromUcs4(replacedChars.data(), replacedChars.size()).size();
+
+    int start, len;
+    if (offset >= 0) {
+        start = cursor;
+        len = offset;
+    } else {
+        start = cursor + offset;
+        len = -offset;
+    }
+
+    auto prefixedChars = ucsText.substr(start, len);
+    offset =
+        QString::fromUcs4(prefixedChars.data(), prefixedChars.size()).size() *
+        (offset >= 0 ? 1 : -1);
+    return true;
 }
 
 void QFcitxPlatformInputContext::forwardKey(uint keyval, uint state,
@@ -546,16 +856,21 @@ void QFcitxPlatformInputContext::forwardKey(uint keyval, uint state,
     if (!proxy) {
         return;
     }
-    FcitxQtICData &data = *static_cast<FcitxQtICData *>(
-        proxy->property("icData").value<void *>());
-    auto w = static_cast<QWindow *>(proxy->property("wid").value<void *>());
+    m_recorder->record(FcitxFlightEventType::ForwardKey, traceId(proxy), 0, 0,
+                       type);
+    if (dropsActions(proxy)) {
+        return;
+    }
+    if (m_sessionRecorder && !isSensitiveFocus()) {
+        m_sessionRecorder->recordKey(FcitxSessionRecordType::ForwardKey,
+                                     proxy->window(), keyval, state, 0, type);
+    }
+    FcitxQtICData &data = *proxy->icData();
+    auto w = proxy->window();
     QObject *input = qApp->focusObject();
     auto window = qApp->focusWindow();
     if (input && window && w == window) {
-        std::unique_ptr<QKeyEvent> keyevent{
-            createKeyEvent(keyval, state, type, data.event.get())};
-
-        forwardEvent(window, *keyevent);
+        forwardEvent(window, createKeyEvent(keyval, state, type, data.event));
     }
 }
 
@@ -578,11 +893,16 @@ void QFcitxPlatformInputContext::createICData(QWindow *w) {
     if (iter == m_icMap.end()) {
         auto result =
             m_icMap.emplace(std::piecewise_construct, std::forward_as_tuple(w),
-                            std::forward_as_tuple(m_watcher));
+                            std::forward_as_tuple(m_watcher, w));
         connect(w, &QObject::destroyed, this,
                 &QFcitxPlatformInputContext::windowDestroyed);
         iter = result.first;
         auto &data = iter->second;
+        m_recorder->record(FcitxFlightEventType::ICCreate, traceId(data.proxy));
+        data.proxy->setUseSharedMemoryTransport(m_useSharedMemory,
+                                                m_keyDeadline);
+        data.proxy->setOutboundQueue(m_outboundQueue);
+        data.proxy->setNegotiateKeyReleaseInterest(m_suppressKeyRelease);
 
         if (QGuiApplication::platformName() == QLatin1String("xcb")) {
             data.proxy->setDisplay("x11:");
@@ -590,10 +910,6 @@ void QFcitxPlatformInputContext::createICData(QWindow *w) {
                    QLatin1String("wayland")) {
             data.proxy->setDisplay("wayland:");
         }
-        data.proxy->setProperty("wid",
-                                QVariant::fromValue(static_cast<void *>(w)));
-        data.proxy->setProperty(
-            "icData", QVariant::fromValue(static_cast<void *>(&data)));
         connect(data.proxy, &FcitxInputContextProxy::inputContextCreated, this,
                 &QFcitxPlatformInputContext::createInputContextFinished);
         connect(data.proxy, &FcitxInputContextProxy::commitString, this,
@@ -604,77 +920,91 @@ void QFcitxPlatformInputContext::createICData(QWindow *w) {
                 this, &QFcitxPlatformInputContext::updateFormattedPreedit);
         connect(data.proxy, &FcitxInputContextProxy::deleteSurroundingText,
                 this, &QFcitxPlatformInputContext::deleteSurroundingText);
+        connect(data.proxy, &FcitxInputContextProxy::updateClientSideUI, this,
+                &QFcitxPlatformInputContext::updateClientSideUI);
         connect(data.proxy, &FcitxInputContextProxy::currentIM, this,
                 &QFcitxPlatformInputContext::updateCurrentIM);
+        connect(data.proxy, &FcitxInputContextProxy::processKeyEventFinished,
+                this, &QFcitxPlatformInputContext::processKeyEventFinished);
+        connect(data.proxy,
+                &FcitxInputContextProxy::processKeyEventSharedFinished, this,
+                &QFcitxPlatformInputContext::processKeyEventSharedFinished);
+        connect(data.proxy,
+                &FcitxInputContextProxy::sharedMemoryTransportClosed, this,
+                &QFcitxPlatformInputContext::sharedMemoryTransportClosed);
+        m_icScheduler->add(data.proxy);
     }
 }
 
-QKeyEvent *QFcitxPlatformInputContext::createKeyEvent(uint keyval, uint state,
-                                                      bool isRelease,
-                                                      const QKeyEvent *event) {
-    QKeyEvent *newEvent = nullptr;
-    if (event && event->nativeVirtualKey() == keyval &&
-        event->nativeModifiers() == state &&
-        isRelease == (event->type() == QEvent::KeyRelease)) {
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-        newEvent = new QKeyEvent(
-            event->type(), event->key(), event->modifiers(),
-            event->nativeScanCode(), event->nativeVirtualKey(),
-            event->nativeModifiers(), event->text(), event->isAutoRepeat(),
-            event->count(), event->device());
-#else
-        newEvent = new QKeyEvent(*event);
-#endif
-    } else {
-        Qt::KeyboardModifiers qstate = Qt::NoModifier;
+void QFcitxPlatformInputContext::surroundingTextPosition(const QString &text,
+                                                         int &cursor,
+                                                         int &anchor) {
+    // adjust it to real character size
+    QVector<uint> tempUCS4 = text.left(cursor).toUcs4();
+    cursor = tempUCS4.size();
+    tempUCS4 = text.left(anchor).toUcs4();
+    anchor = tempUCS4.size();
+}
 
-        int count = 1;
-        if (state & FcitxKeyState_Alt) {
-            qstate |= Qt::AltModifier;
-            count++;
-        }
+FcitxKeyEventData
+QFcitxPlatformInputContext::createKeyEvent(uint keyval, uint state,
+                                           bool isRelease,
+                                           const FcitxKeyEventData &event) {
+    if (event.type != QEvent::None && event.nativeVirtualKey == keyval &&
+        event.nativeModifiers == state &&
+        isRelease == (event.type == QEvent::KeyRelease)) {
+        return event;
+    }
 
-        if (state & FcitxKeyState_Shift) {
-            qstate |= Qt::ShiftModifier;
-            count++;
-        }
+    Qt::KeyboardModifiers qstate = Qt::NoModifier;
 
-        if (state & FcitxKeyState_Ctrl) {
-            qstate |= Qt::ControlModifier;
-            count++;
-        }
+    int count = 1;
+    if (state & FcitxKeyState_Alt) {
+        qstate |= Qt::AltModifier;
+        count++;
+    }
 
-        char32_t unicode = xkb_keysym_to_utf32(keyval);
-        QString text;
-        if (unicode) {
-            text = QString::fromUcs4(&unicode, 1);
-        }
+    if (state & FcitxKeyState_Shift) {
+        qstate |= Qt::ShiftModifier;
+        count++;
+    }
 
-        int key = keysymToQtKey(keyval, text);
+    if (state & FcitxKeyState_Ctrl) {
+        qstate |= Qt::ControlModifier;
+        count++;
+    }
 
-        newEvent =
-            new QKeyEvent(isRelease ? (QEvent::KeyRelease) : (QEvent::KeyPress),
-                          key, qstate, 0, keyval, state, text, false, count);
-        if (event) {
-            newEvent->setTimestamp(event->timestamp());
-        }
+    char32_t unicode = xkb_keysym_to_utf32(keyval);
+    QString text;
+    if (unicode) {
+        text = QString::fromUcs4(&unicode, 1);
     }
 
+    FcitxKeyEventData newEvent;
+    newEvent.type = isRelease ? QEvent::KeyRelease : QEvent::KeyPress;
+    newEvent.key = keysymToQtKey(keyval, text);
+    newEvent.modifiers = qstate;
+    newEvent.nativeVirtualKey = keyval;
+    newEvent.nativeModifiers = state;
+    newEvent.text = text;
+    newEvent.count = count;
+    newEvent.timestamp = event.timestamp;
+
     return newEvent;
 }
 
-void QFcitxPlatformInputContext::forwardEvent(QWindow *window,
-                                              const QKeyEvent &keyEvent) {
+void QFcitxPlatformInputContext::forwardEvent(
+    QWindow *window, const FcitxKeyEventData &keyEvent) {
     // use same variable name as in QXcbKeyboard::handleKeyEvent
-    QEvent::Type type = keyEvent.type();
-    int qtcode = keyEvent.key();
-    Qt::KeyboardModifiers modifiers = keyEvent.modifiers();
-    quint32 code = keyEvent.nativeScanCode();
-    quint32 sym = keyEvent.nativeVirtualKey();
-    quint32 state = keyEvent.nativeModifiers();
-    QString string = keyEvent.text();
-    bool isAutoRepeat = keyEvent.isAutoRepeat();
-    ulong time = keyEvent.timestamp();
+    QEvent::Type type = keyEvent.type;
+    int qtcode = keyEvent.key;
+    Qt::KeyboardModifiers modifiers = keyEvent.modifiers;
+    quint32 code = keyEvent.nativeScanCode;
+    quint32 sym = keyEvent.nativeVirtualKey;
+    quint32 state = keyEvent.nativeModifiers;
+    const QString &string = keyEvent.text;
+    bool isAutoRepeat = keyEvent.isAutoRepeat;
+    ulong time = keyEvent.timestamp;
     // copied from QXcbKeyboard::handleKeyEvent()
     if (type == QEvent::KeyPress && qtcode == Qt::Key_Menu) {
         QPoint globalPos, pos;
@@ -703,6 +1033,15 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
         quint32 state = keyEvent->nativeModifiers();
         bool isRelease = keyEvent->type() == QEvent::KeyRelease;
 
+        // Not even the timing of keys typed into a password field is kept,
+        // whether or not they are handled in process.
+        if (m_sessionRecorder && !isSensitiveFocus()) {
+            m_sessionRecorder->recordKey(
+                FcitxSessionRecordType::Key, qApp->focusWindow(), keyval,
+                state, keycode,
+                (isRelease ? 1 : 0) | (keyEvent->isAutoRepeat() ? 2 : 0));
+        }
+
         if (!inputMethodAccepted() && !objectAcceptsInputMethod())
             break;
 
@@ -712,9 +1051,21 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
             break;
         }
 
+        // Keys typed into a password field never leave the process.
+        if (m_passwordFocus) {
+            if (filterEventFallback(keyval, keycode, state, isRelease)) {
+                return true;
+            } else {
+                break;
+            }
+        }
+
         FcitxInputContextProxy *proxy = validICByWindow(qApp->focusWindow());
 
         if (!proxy) {
+            if (bufferEarlyInput(qApp->focusWindow(), *keyEvent)) {
+                return true;
+            }
             if (filterEventFallback(keyval, keycode, state, isRelease)) {
                 return true;
             } else {
@@ -722,15 +1073,90 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
             }
         }
 
+        FcitxQtICData &data = *proxy->icData();
+        // While input method is off, only the trigger key needs to reach
+        // fcitx.
+        if (data.capability.testFlag(CAPACITY_CLIENT_SIDE_CONTROL_STATE) &&
+            !proxy->isIMEnabled()) {
+            if (!isRelease && proxy->isTriggerKey(keyval, state)) {
+                proxy->focusIn();
+                proxy->enableIC();
+                return true;
+            }
+            if (filterEventFallback(keyval, keycode, state, isRelease)) {
+                return true;
+            } else {
+                break;
+            }
+        }
+
+        // Release that fcitx doesn't care about, pass it through unless some
+        // earlier key is still waiting for reply, to keep the key order.
+        if (isRelease && data.pendingKeys == 0 &&
+            data.pendingSharedKeys.empty() && !proxy->wantsKeyRelease(keyval)) {
+            break;
+        }
+
+        // fcitx is behind, hold autorepeat presses back and let the reply of
+        // the same key decide for all of them, so they stop with the key.
+        // Once some are held, the later ones join them to stay in order.
+        const int backlog =
+            data.pendingKeys + static_cast<int>(data.pendingSharedKeys.size());
+        if (keyEvent->isAutoRepeat() && data.lastSentKeyval == keyval &&
+            !data.mergedRepeatsEnded &&
+            (data.mergedRepeats ||
+             (m_autoRepeatBacklog > 0 && backlog >= m_autoRepeatBacklog))) {
+            // Beyond that the repeats are dropped.
+            if (!isRelease && data.mergedRepeats < MaxMergedRepeats) {
+                data.mergedRepeat = FcitxKeyEventData(*keyEvent);
+                data.mergedRepeats++;
+            }
+            return true;
+        }
+        // The release of the key, or any other key, goes to fcitx ahead of
+        // the repeats held back, so they are too late for fcitx now.
+        if (data.mergedRepeats) {
+            data.mergedRepeatsEnded = true;
+        }
+
         proxy->focusIn();
+        data.lastSentKeyval = keyval;
+
+        // Replies of keys sent on D-Bus before the transport came up are
+        // not ordered against the results in the ring, keep using D-Bus
+        // until they are answered.
+        if (!m_syncMode && data.pendingKeys == 0) {
+            if (quint32 shmSerial = proxy->processKeyEventShared(
+                    keyval, keycode, state, isRelease, keyEvent->timestamp())) {
+                const quint32 serial = ++m_keySerial;
+                m_recorder->record(FcitxFlightEventType::KeySend,
+                                   traceId(proxy), serial, 0, isRelease);
+                data.pendingSharedKeys.push_back(FcitxPendingKeyEvent{
+                    shmSerial, serial, FcitxKeyEventData(*keyEvent),
+                    qApp->focusWindow()});
+                return true;
+            }
+        }
 
-        auto reply = proxy->processKeyEvent(keyval, keycode, state, isRelease,
-                                            keyEvent->timestamp());
+        // While the worker has keys of this input context, the key goes
+        // through it too, or fcitx could see it first.
+        if (m_ipcWorker && sendThreadedKeyEvent(proxy, qApp->focusWindow(),
+                                                FcitxKeyEventData(*keyEvent))) {
+            return true;
+        }
 
         if (Q_UNLIKELY(m_syncMode)) {
+            auto reply = proxy->processKeyEvent(keyval, keycode, state,
+                                                isRelease,
+                                                keyEvent->timestamp());
+            const quint32 serial = ++m_keySerial;
+            m_recorder->record(FcitxFlightEventType::KeySend, traceId(proxy),
+                               serial, 0, isRelease);
             reply.waitForFinished();
 
             auto filtered = proxy->processKeyEventResult(reply);
+            m_recorder->record(FcitxFlightEventType::KeyReply, traceId(proxy),
+                               serial, 0, filtered);
             if (!filtered) {
                 if (filterEventFallback(keyval, keycode, state, isRelease)) {
                     return true;
@@ -741,70 +1167,216 @@ bool QFcitxPlatformInputContext::filterEvent(const QEvent *event) {
                 update(Qt::ImCursorRectangle);
                 return true;
             }
-        } else {
-            ProcessKeyWatcher *watcher = new ProcessKeyWatcher(
-                *keyEvent, qApp->focusWindow(), reply, proxy);
-            connect(watcher, &QDBusPendingCallWatcher::finished, this,
-                    &QFcitxPlatformInputContext::processKeyEventFinished);
-            return true;
         }
+
+        if (!proxy->processKeyEventAsync(keyval, keycode, state, isRelease,
+                                         keyEvent->timestamp())) {
+            if (filterEventFallback(keyval, keycode, state, isRelease)) {
+                return true;
+            } else {
+                break;
+            }
+        }
+        const quint32 serial = ++m_keySerial;
+        m_recorder->record(FcitxFlightEventType::KeySend, traceId(proxy),
+                           serial, 0, isRelease);
+        data.pendingDBusKeys.push_back(FcitxPendingKeyEvent{
+            0, serial, FcitxKeyEventData(*keyEvent), qApp->focusWindow()});
+        data.pendingKeys++;
+        return true;
     } while (0);
     return QPlatformInputContext::filterEvent(event);
 }
 
-void QFcitxPlatformInputContext::processKeyEventFinished(
-    QDBusPendingCallWatcher *w) {
-    ProcessKeyWatcher *watcher = static_cast<ProcessKeyWatcher *>(w);
-    auto proxy = qobject_cast<FcitxInputContextProxy *>(watcher->parent());
-    bool filtered = false;
+void QFcitxPlatformInputContext::processKeyEventFinished(bool processed,
+                                                         bool isError) {
+    auto proxy = qobject_cast<FcitxInputContextProxy *>(sender());
+    if (!proxy) {
+        return;
+    }
+    FcitxQtICData &data = *proxy->icData();
+    if (data.pendingDBusKeys.empty()) {
+        return;
+    }
+    FcitxPendingKeyEvent pending = std::move(data.pendingDBusKeys.front());
+    data.pendingDBusKeys.erase(data.pendingDBusKeys.begin());
+    data.pendingKeys--;
 
-    QWindow *window = watcher->window();
+    m_recorder->record(FcitxFlightEventType::KeyReply, traceId(proxy),
+                       pending.traceSerial, 0, processed);
     // if window is already destroyed, we can only throw this event away.
-    if (!window) {
-        delete watcher;
+    if (!pending.window) {
+        return;
+    }
+    finishKeyEvent(proxy, pending.window, pending.event, processed, isError);
+}
+
+void QFcitxPlatformInputContext::processKeyEventSharedFinished(quint32 serial,
+                                                               bool processed) {
+    auto proxy = qobject_cast<FcitxInputContextProxy *>(sender());
+    if (!proxy) {
+        return;
+    }
+    FcitxQtICData &data = *proxy->icData();
+    // Results are delivered in order, anything before serial is lost.
+    while (!data.pendingSharedKeys.empty()) {
+        FcitxPendingKeyEvent pending =
+            std::move(data.pendingSharedKeys.front());
+        data.pendingSharedKeys.erase(data.pendingSharedKeys.begin());
+        const bool matched = pending.serial == serial;
+        m_recorder->record(FcitxFlightEventType::KeyReply, traceId(proxy),
+                           pending.traceSerial, 0, matched && processed);
+        if (pending.window) {
+            finishKeyEvent(proxy, pending.window, pending.event,
+                           matched && processed, !matched);
+        }
+        if (matched) {
+            break;
+        }
+    }
+}
+
+void QFcitxPlatformInputContext::sharedMemoryTransportClosed() {
+    auto proxy = qobject_cast<FcitxInputContextProxy *>(sender());
+    if (!proxy) {
         return;
     }
+    FcitxQtICData &data = *proxy->icData();
+    auto pendingKeys = std::move(data.pendingSharedKeys);
+    data.pendingSharedKeys.clear();
+    data.clearMergedRepeats();
+    for (auto &pending : pendingKeys) {
+        if (pending.window) {
+            finishKeyEvent(proxy, pending.window, pending.event, false, true);
+        }
+    }
+}
+
+void QFcitxPlatformInputContext::processIPCResults() {
+    m_ipcWorker->acknowledgeResults();
+    FcitxIPCResult result;
+    while (m_ipcWorker->takeResult(result)) {
+        if (result.type == FcitxIPCResult::ResetFinished) {
+            for (auto iter = m_expiredKeys.begin();
+                 iter != m_expiredKeys.end(); ++iter) {
+                if (iter->first == result.id) {
+                    if (iter->second) {
+                        iter->second->icData()->expiredKeys--;
+                    }
+                    m_expiredKeys.erase(iter);
+                    break;
+                }
+            }
+            continue;
+        }
+        auto &slot =
+            m_threadedKeys[result.id % FcitxIPCWorker::MaxInFlight];
+        if (slot.id != result.id) {
+            continue;
+        }
+        FcitxThreadedKeyEvent pending = std::move(slot);
+        slot.id = 0;
+        slot.proxy.clear();
+        slot.window.clear();
+        FcitxInputContextProxy *proxy = pending.proxy.data();
+        m_recorder->recordAt(result.replyTime, FcitxFlightEventType::KeyReply,
+                             traceId(proxy), pending.traceSerial, 0,
+                             result.processed);
+        if (proxy) {
+            FcitxQtICData &data = *proxy->icData();
+            data.pendingKeys--;
+            data.threadedKeys--;
+            if (result.type == FcitxIPCResult::Expired) {
+                // Handled locally below, so whatever fcitx still does with
+                // it would be done twice.
+                data.expiredKeys++;
+                m_expiredKeys.emplace_back(result.id, pending.proxy);
+            }
+        }
+        // if window is already destroyed, we can only throw this event away.
+        if (pending.window) {
+            finishKeyEvent(proxy, pending.window, pending.event,
+                           result.processed, result.error);
+        }
+    }
+
+    if (m_waitingKeys > 0) {
+        m_waitingKeys = 0;
+        for (auto &item : m_icMap) {
+            sendWaitingKeys(item.second);
+            m_waitingKeys += item.second.waitingKeys.size();
+        }
+    }
+}
 
-    const QKeyEvent &keyEvent = watcher->keyEvent();
+void QFcitxPlatformInputContext::finishKeyEvent(
+    FcitxInputContextProxy *proxy, QWindow *window,
+    const FcitxKeyEventData &keyEvent, bool processed, bool isError) {
+    bool filtered = false;
 
     // use same variable name as in QXcbKeyboard::handleKeyEvent
-    QEvent::Type type = keyEvent.type();
-    quint32 code = keyEvent.nativeScanCode();
-    quint32 sym = keyEvent.nativeVirtualKey();
-    quint32 state = keyEvent.nativeModifiers();
-    QString string = keyEvent.text();
+    QEvent::Type type = keyEvent.type;
+    quint32 code = keyEvent.nativeScanCode;
+    quint32 sym = keyEvent.nativeVirtualKey;
+    quint32 state = keyEvent.nativeModifiers;
+
+    if (m_sessionRecorder && !isSensitiveFocus()) {
+        m_sessionRecorder->recordKey(
+            FcitxSessionRecordType::KeyResult, window, sym, state, code,
+            (type == QEvent::KeyRelease ? 1 : 0) | (processed ? 2 : 0) |
+                (isError ? 4 : 0));
+    }
 
-    if (!proxy->processKeyEventResult(*watcher)) {
+    if (!processed) {
         filtered =
             filterEventFallback(sym, code, state, type == QEvent::KeyRelease);
     } else {
         filtered = true;
     }
 
-    if (!watcher->isError()) {
+    if (!isError) {
         update(Qt::ImCursorRectangle);
     }
 
     if (!filtered) {
         forwardEvent(window, keyEvent);
-    } else {
-        auto proxy = qobject_cast<FcitxInputContextProxy *>(watcher->parent());
-        if (proxy) {
-            FcitxQtICData &data = *static_cast<FcitxQtICData *>(
-                proxy->property("icData").value<void *>());
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-            data.event = std::make_unique<QKeyEvent>(
-                keyEvent.type(), keyEvent.key(), keyEvent.modifiers(),
-                keyEvent.nativeScanCode(), keyEvent.nativeVirtualKey(),
-                keyEvent.nativeModifiers(), keyEvent.text(),
-                keyEvent.isAutoRepeat(), keyEvent.count(), keyEvent.device());
-#else
-            data.event = std::unique_ptr<QKeyEvent>(new QKeyEvent(keyEvent));
-#endif
+    } else if (proxy) {
+        FcitxQtICData &data = *proxy->icData();
+        data.event = keyEvent;
+    }
+
+    if (proxy && type == QEvent::KeyPress) {
+        FcitxQtICData &data = *proxy->icData();
+        if (data.mergedRepeats && data.mergedRepeat.nativeVirtualKey == sym) {
+            const int count = data.mergedRepeats;
+            const FcitxKeyEventData repeat = data.mergedRepeat;
+            const bool ended = data.mergedRepeatsEnded;
+            data.clearMergedRepeats();
+            m_recorder->record(FcitxFlightEventType::AutoRepeatMerge,
+                               traceId(proxy), count, 0, !filtered);
+            if (processed && !isError && proxy->isValid()) {
+                // fcitx used the key, e.g. Backspace in the preedit, so it
+                // needs every repeat too, unless the key was released or
+                // another one typed since, which fcitx already has.
+                if (!ended) {
+                    for (int i = 0; i < count; i++) {
+                        sendKeyEvent(proxy, window, repeat);
+                    }
+                }
+            } else if (!filtered) {
+                // fcitx didn't change because of this key, so it wouldn't
+                // for the repeats either.
+                for (int i = 0; i < count; i++) {
+                    forwardEvent(window, repeat);
+                }
+            }
         }
     }
+}
 
-    delete watcher;
+bool QFcitxPlatformInputContext::dropsActions(QObject *proxy) {
+    auto icProxy = qobject_cast<FcitxInputContextProxy *>(proxy);
+    return icProxy && icProxy->icData() && icProxy->icData()->expiredKeys > 0;
 }
 
 bool QFcitxPlatformInputContext::filterEventFallback(uint keyval, uint keycode,
@@ -817,6 +1389,179 @@ bool QFcitxPlatformInputContext::filterEventFallback(uint keyval, uint keycode,
     return false;
 }
 
+bool QFcitxPlatformInputContext::bufferEarlyInput(QWindow *window,
+                                                  const QKeyEvent &event) {
+    if (m_earlyInputTimeout <= 0 || !window) {
+        return false;
+    }
+    auto iter = m_icMap.find(window);
+    if (iter == m_icMap.end()) {
+        return false;
+    }
+    auto &data = iter->second;
+    if (data.earlyInputExpired || !data.proxy->isCreatingInputContext()) {
+        return false;
+    }
+
+    if (data.earlyKeys.empty()) {
+        FcitxInputContextProxy *proxy = data.proxy;
+        const quint32 generation = data.earlyInputGeneration;
+        QTimer::singleShot(m_earlyInputTimeout, proxy,
+                           [this, proxy, generation]() {
+                               if (proxy->icData()->earlyInputGeneration ==
+                                   generation) {
+                                   flushEarlyInput(proxy, false);
+                               }
+                           });
+    }
+    data.earlyKeys.push_back(FcitxKeyEventData(event));
+    m_recorder->addEarlyInputKey();
+    m_recorder->record(FcitxFlightEventType::EarlyInput, traceId(data.proxy),
+                       data.earlyKeys.size(), 0,
+                       event.type() == QEvent::KeyRelease);
+    if (data.earlyKeys.size() >= MaxEarlyInputKeys) {
+        flushEarlyInput(data.proxy, false);
+    }
+    return true;
+}
+
+void QFcitxPlatformInputContext::flushEarlyInput(FcitxInputContextProxy *proxy,
+                                                 bool replay) {
+    FcitxQtICData &data = *proxy->icData();
+    if (data.earlyKeys.empty()) {
+        return;
+    }
+    auto keys = std::move(data.earlyKeys);
+    data.earlyKeys.clear();
+    data.earlyInputGeneration++;
+    if (!replay) {
+        data.earlyInputExpired = true;
+    }
+    m_recorder->record(FcitxFlightEventType::EarlyInputFlush, traceId(proxy),
+                       keys.size(), 0, replay);
+
+    QWindow *window = proxy->window();
+    for (const auto &key : keys) {
+        if (!replay) {
+            finishKeyEvent(nullptr, window, key, false, true);
+            continue;
+        }
+        sendKeyEvent(proxy, window, key);
+    }
+}
+
+void QFcitxPlatformInputContext::sendKeyEvent(FcitxInputContextProxy *proxy,
+                                              QWindow *window,
+                                              const FcitxKeyEventData &key) {
+    if (sendThreadedKeyEvent(proxy, window, key)) {
+        return;
+    }
+    sendDBusKeyEvent(proxy, window, key);
+}
+
+void QFcitxPlatformInputContext::sendDBusKeyEvent(
+    FcitxInputContextProxy *proxy, QWindow *window,
+    const FcitxKeyEventData &key) {
+    // Never wait for these even in sync mode.
+    if (!proxy->processKeyEventAsync(
+            key.nativeVirtualKey, key.nativeScanCode, key.nativeModifiers,
+            key.type == QEvent::KeyRelease, key.timestamp)) {
+        finishKeyEvent(proxy, window, key, false, true);
+        return;
+    }
+    const quint32 serial = ++m_keySerial;
+    m_recorder->record(FcitxFlightEventType::KeySend, traceId(proxy), serial, 0,
+                       key.type == QEvent::KeyRelease);
+    FcitxQtICData &data = *proxy->icData();
+    data.pendingDBusKeys.push_back(
+        FcitxPendingKeyEvent{0, serial, key, window});
+    data.pendingKeys++;
+}
+
+bool QFcitxPlatformInputContext::sendThreadedKeyEvent(
+    FcitxInputContextProxy *proxy, QWindow *window,
+    const FcitxKeyEventData &key) {
+    FcitxQtICData &data = *proxy->icData();
+    if (data.waitingKeys.empty()) {
+        if (!m_ipcWorker || m_syncMode) {
+            return false;
+        }
+        if (startThreadedKeyEvent(proxy, window, key)) {
+            return true;
+        }
+        // Nothing of this input context to overtake.
+        if (data.threadedKeys == 0) {
+            return false;
+        }
+    }
+    data.waitingKeys.push_back(FcitxPendingKeyEvent{0, 0, key, window});
+    data.pendingKeys++;
+    m_waitingKeys++;
+    return true;
+}
+
+bool QFcitxPlatformInputContext::startThreadedKeyEvent(
+    FcitxInputContextProxy *proxy, QWindow *window,
+    const FcitxKeyEventData &key) {
+    // The worker never has more than MaxInFlight requests, so the slot is
+    // only taken if a reply got lost. Keys also stay on this thread while
+    // the shared memory transport is coming up, its records are ordered
+    // against the calls made here.
+    FcitxThreadedKeyEvent &slot =
+        m_threadedKeys[(m_ipcRequestId + 1) % FcitxIPCWorker::MaxInFlight];
+    if (slot.id != 0 || proxy->usesSharedMemoryTransport()) {
+        return false;
+    }
+    const bool isRelease = key.type == QEvent::KeyRelease;
+    // Like processKeyEvent, fcitx needs the queued state before the key.
+    // It's sent from here, ahead of the worker sending the key.
+    proxy->flushState(false);
+    FcitxIPCRequest request;
+    request.id = ++m_ipcRequestId;
+    request.connectionName = proxy->connectionName();
+    request.message = proxy->processKeyEventMessage(
+        key.nativeVirtualKey, key.nativeScanCode, key.nativeModifiers,
+        isRelease, key.timestamp);
+    request.portal = proxy->isPortal();
+    const quint64 id = request.id;
+    const quint32 serial = ++m_keySerial;
+    m_recorder->record(FcitxFlightEventType::KeySend, traceId(proxy), serial, 0,
+                       isRelease);
+    if (!m_ipcWorker->send(std::move(request))) {
+        return false;
+    }
+    slot.id = id;
+    slot.traceSerial = serial;
+    slot.proxy = proxy;
+    slot.event = key;
+    slot.window = window;
+    FcitxQtICData &data = *proxy->icData();
+    data.pendingKeys++;
+    data.threadedKeys++;
+    return true;
+}
+
+void QFcitxPlatformInputContext::sendWaitingKeys(FcitxQtICData &data) {
+    FcitxInputContextProxy *proxy = data.proxy;
+    while (!data.waitingKeys.empty()) {
+        FcitxPendingKeyEvent pending = data.waitingKeys.front();
+        // if window is already destroyed, we can only throw this event away.
+        const bool sent =
+            !pending.window ||
+            startThreadedKeyEvent(proxy, pending.window, pending.event);
+        if (!sent && data.threadedKeys > 0) {
+            return;
+        }
+        data.waitingKeys.erase(data.waitingKeys.begin());
+        data.pendingKeys--;
+        // The worker has nothing of this input context left, so D-Bus
+        // keeps the order.
+        if (!sent) {
+            sendDBusKeyEvent(proxy, pending.window, pending.event);
+        }
+    }
+}
+
 FcitxInputContextProxy *QFcitxPlatformInputContext::validIC() {
     if (m_icMap.empty()) {
         return nullptr;
@@ -844,11 +1589,31 @@ QFcitxPlatformInputContext::validICByWindow(QWindow *w) {
     return data.proxy;
 }
 
+bool QFcitxPlatformInputContext::loadCompose() {
+    if (m_xkbComposeLoaded) {
+        return !m_xkbComposeState.isNull();
+    }
+    // Only once, even if the locale has no compose table.
+    m_xkbComposeLoaded = true;
+    m_xkbContext.reset(_xkb_context_new_helper());
+    if (!m_xkbContext) {
+        return false;
+    }
+    m_xkbComposeTable.reset(xkb_compose_table_new_from_locale(
+        m_xkbContext.data(), get_locale(), XKB_COMPOSE_COMPILE_NO_FLAGS));
+    if (!m_xkbComposeTable) {
+        return false;
+    }
+    m_xkbComposeState.reset(xkb_compose_state_new(
+        m_xkbComposeTable.data(), XKB_COMPOSE_STATE_NO_FLAGS));
+    return !m_xkbComposeState.isNull();
+}
+
 bool QFcitxPlatformInputContext::processCompose(uint keyval, uint state,
                                                 bool isRelease) {
     Q_UNUSED(state);
 
-    if (!m_xkbComposeTable || isRelease)
+    if (isRelease || !loadCompose())
         return false;
 
     struct xkb_compose_state *xkbComposeState = m_xkbComposeState.data();
@@ -21,22 +21,33 @@
 #ifndef QFCITXPLATFORMINPUTCONTEXT_H
 #define QFCITXPLATFORMINPUTCONTEXT_H
 
+#include "fcitxflightrecorder.h"
 #include "fcitxinputcontextproxy.h"
+#include "fcitxipcworker.h"
 #include "fcitxqtdbustypes.h"
 #include "fcitxwatcher.h"
 #include <QDBusConnection>
 #include <QDBusServiceWatcher>
+#include <QElapsedTimer>
 #include <QGuiApplication>
 #include <QKeyEvent>
 #include <QPointer>
 #include <QRect>
 #include <QWindow>
+#include <array>
 #include <memory>
 #include <qpa/qplatforminputcontext.h>
 #include <unordered_map>
+#include <vector>
 #include <xkbcommon/xkbcommon-compose.h>
 
+class FcitxCandidateWindow;
+class FcitxICScheduler;
+class FcitxOutboundQueue;
+class FcitxPolicy;
+class FcitxSessionRecorder;
 class QFileSystemWatcher;
+class QThread;
 enum FcitxKeyEventType { FCITX_PRESS_KEY, FCITX_RELEASE_KEY };
 
 enum FcitxCapabilityFlags {
@@ -91,47 +102,109 @@ enum FcitxKeyState {
     FcitxKeyState_UsedMask = 0x5c001fff
 };
 
+// What we need to forward a key event, kept by value so that keeping a key
+// around doesn't need a heap allocated QKeyEvent.
+struct FcitxKeyEventData {
+    FcitxKeyEventData() {}
+    explicit FcitxKeyEventData(const QKeyEvent &event)
+        : text(event.text()), timestamp(event.timestamp()),
+          type(event.type()), key(event.key()), modifiers(event.modifiers()),
+          nativeScanCode(event.nativeScanCode()),
+          nativeVirtualKey(event.nativeVirtualKey()),
+          nativeModifiers(event.nativeModifiers()), count(event.count()),
+          isAutoRepeat(event.isAutoRepeat()) {}
+
+    // Ordered by alignment to keep it free of padding.
+    QString text;
+    ulong timestamp = 0;
+    QEvent::Type type = QEvent::None;
+    int key = 0;
+    Qt::KeyboardModifiers modifiers;
+    quint32 nativeScanCode = 0;
+    quint32 nativeVirtualKey = 0;
+    quint32 nativeModifiers = 0;
+    int count = 1;
+    bool isAutoRepeat = false;
+};
+
+// Key sent from this thread, waiting for its result. serial is the one of
+// the shared memory transport, 0 for D-Bus.
+struct FcitxPendingKeyEvent {
+    quint32 serial;
+    quint32 traceSerial;
+    FcitxKeyEventData event;
+    QPointer<QWindow> window;
+};
+
+// Key sent through the IPC worker thread, waiting for its result. id is 0
+// if the slot is free.
+struct FcitxThreadedKeyEvent {
+    quint64 id = 0;
+    quint32 traceSerial = 0;
+    QPointer<FcitxInputContextProxy> proxy;
+    FcitxKeyEventData event;
+    QPointer<QWindow> window;
+};
+
 struct FcitxQtICData {
-    FcitxQtICData(FcitxWatcher *watcher)
-        : proxy(new FcitxInputContextProxy(watcher, watcher)),
-          surroundingAnchor(-1), surroundingCursor(-1) {}
+    FcitxQtICData(FcitxWatcher *watcher, QWindow *window)
+        : proxy(new FcitxInputContextProxy(watcher, watcher)) {
+        proxy->setICData(this, window);
+    }
     FcitxQtICData(const FcitxQtICData &that) = delete;
     ~FcitxQtICData() {
         if (proxy) {
             delete proxy;
         }
     }
-    QFlags<FcitxCapabilityFlags> capability;
+    // The held back autorepeat only makes sense to the key it waits for.
+    void clearMergedRepeats() {
+        mergedRepeats = 0;
+        mergedRepeat = FcitxKeyEventData();
+        mergedRepeatsEnded = false;
+    }
+    // One per window in every process, so the queues are vectors that
+    // don't allocate until used, unlike std::deque, and the scalars are
+    // grouped to avoid padding.
     FcitxInputContextProxy *proxy;
     QRect rect;
     // Last key event forwarded.
-    std::unique_ptr<QKeyEvent> event;
+    FcitxKeyEventData event;
     QString surroundingText;
-    int surroundingAnchor;
-    int surroundingCursor;
-};
-
-class ProcessKeyWatcher : public QDBusPendingCallWatcher {
-    Q_OBJECT
-public:
-    ProcessKeyWatcher(const QKeyEvent &event, QWindow *window,
-                      const QDBusPendingCall &call, QObject *parent = 0)
-        : QDBusPendingCallWatcher(call, parent),
-          m_event(event.type(), event.key(), event.modifiers(),
-                  event.nativeScanCode(), event.nativeVirtualKey(),
-                  event.nativeModifiers(), event.text(), event.isAutoRepeat(),
-                  event.count()),
-          m_window(window) {}
-
-    virtual ~ProcessKeyWatcher() {}
-
-    const QKeyEvent &keyEvent() { return m_event; }
-
-    QWindow *window() { return m_window.data(); }
-
-private:
-    QKeyEvent m_event;
-    QPointer<QWindow> m_window;
+    // Keys sent over D-Bus from this thread, fcitx answers them in order.
+    std::vector<FcitxPendingKeyEvent> pendingDBusKeys;
+    std::vector<FcitxPendingKeyEvent> pendingSharedKeys;
+    // Keys waiting for a free slot of the IPC worker, behind the keys it
+    // already has.
+    std::vector<FcitxPendingKeyEvent> waitingKeys;
+    // Keys typed while the input context is being created, replayed in order
+    // once it is ready.
+    std::vector<FcitxKeyEventData> earlyKeys;
+    // Autorepeat presses held back while fcitx is behind, delivered or
+    // dropped with the reply of the next press of the same key.
+    FcitxKeyEventData mergedRepeat;
+    QFlags<FcitxCapabilityFlags> capability;
+    int surroundingAnchor = -1;
+    int surroundingCursor = -1;
+    // Number of key events sent over D-Bus without reply yet, including
+    // waitingKeys.
+    int pendingKeys = 0;
+    // Part of pendingKeys sent by the IPC worker.
+    int threadedKeys = 0;
+    // Bumped whenever earlyKeys is flushed, so a stale timeout is ignored.
+    quint32 earlyInputGeneration = 0;
+    // Last key sent to fcitx, only its autorepeat is merged.
+    quint32 lastSentKeyval = 0;
+    int mergedRepeats = 0;
+    // Expired keys waiting for their Reset to be answered, commits, forwarded
+    // keys and surrounding text deletions are dropped until then.
+    int expiredKeys = 0;
+    // The input context didn't show up in time, stop holding keys until it
+    // does.
+    bool earlyInputExpired = false;
+    // Another key was sent after mergedRepeat, the repeats aren't sent to
+    // fcitx any more, only delivered locally if fcitx ignores the key.
+    bool mergedRepeatsEnded = false;
 };
 
 struct XkbContextDeleter {
@@ -160,6 +233,12 @@ class FcitxQtInputMethodProxy;
 class QFcitxPlatformInputContext : public QPlatformInputContext {
     Q_OBJECT
 public:
+    // Keys held back while waiting for the input context, more than that are
+    // delivered locally right away.
+    static constexpr size_t MaxEarlyInputKeys = 64;
+    // Autorepeat presses held back for one key, about a second of repeats.
+    static constexpr int MaxMergedRepeats = 32;
+
     QFcitxPlatformInputContext();
     virtual ~QFcitxPlatformInputContext();
 
@@ -173,12 +252,28 @@ public:
     virtual void setFocusObject(QObject *object) Q_DECL_OVERRIDE;
     virtual QLocale locale() const Q_DECL_OVERRIDE;
 
+    // The parts of the key and text handling that depend only on their
+    // arguments, also used by the microbenchmarks.
+    static FcitxKeyEventData createKeyEvent(uint keyval, uint state,
+                                            bool isRelaese,
+                                            const FcitxKeyEventData &event);
+    // Convert Qt's UTF-16 cursor and anchor in text to characters.
+    static void surroundingTextPosition(const QString &text, int &cursor,
+                                        int &anchor);
+    // Convert offset and nchar of DeleteSurroundingText from characters
+    // around the selection to Qt's UTF-16 around the cursor, returns false
+    // if they are out of text.
+    static bool surroundingTextDeletion(const QString &text, int cursor,
+                                        int anchor, int &offset, int &nchar);
+
 public Q_SLOTS:
     void cursorRectChanged();
     void commitString(const QString &str);
-    void updateFormattedPreedit(const FcitxFormattedPreeditList &preeditList,
+    void updateFormattedPreedit(const FcitxFormattedPreeditText &preeditText,
                                 int cursorPos);
     void deleteSurroundingText(int offset, uint nchar);
+    void updateClientSideUI(const QString &auxUp, const QString &auxDown,
+                            const QString &candidates);
     void forwardKey(uint keyval, uint state, bool type);
     void createInputContextFinished();
     void cleanUp();
@@ -187,10 +282,24 @@ public Q_SLOTS:
                          const QString &langCode);
 
 private:
+    // Compile the compose table of the locale on first use, it is the
+    // largest allocation of the plugin and most processes never need it.
+    bool loadCompose();
     bool processCompose(uint keyval, uint state, bool isRelaese);
-    QKeyEvent *createKeyEvent(uint keyval, uint state, bool isRelaese,
-                              const QKeyEvent *event);
-    void forwardEvent(QWindow *window, const QKeyEvent &event);
+    // Ask Qt::ImEnabled and Qt::ImHints once per focus object, returns
+    // false without focus object.
+    bool queryFocusObject();
+    bool objectAcceptsInputMethod();
+    bool isPasswordFocus();
+    // Keys typed into the focus object are kept out of session recordings.
+    bool isSensitiveFocus();
+    void forwardEvent(QWindow *window, const FcitxKeyEventData &event);
+    void finishKeyEvent(FcitxInputContextProxy *proxy, QWindow *window,
+                        const FcitxKeyEventData &keyEvent, bool processed,
+                        bool isError);
+    // Whether the actions of the input context are dropped, see
+    // FcitxQtICData::expiredKeys.
+    static bool dropsActions(QObject *proxy);
 
     void addCapability(FcitxQtICData &data,
                        QFlags<FcitxCapabilityFlags> capability,
@@ -219,29 +328,93 @@ private:
     FcitxInputContextProxy *validICByWindow(QWindow *window);
     bool filterEventFallback(uint keyval, uint keycode, uint state,
                              bool isRelaese);
+    bool bufferEarlyInput(QWindow *window, const QKeyEvent &event);
+    // Send the buffered keys to fcitx if replay is true, otherwise deliver
+    // them locally.
+    void flushEarlyInput(FcitxInputContextProxy *proxy, bool replay);
+    // Send a key that is not the event being filtered right now, its result
+    // goes to finishKeyEvent.
+    void sendKeyEvent(FcitxInputContextProxy *proxy, QWindow *window,
+                      const FcitxKeyEventData &key);
+    void sendDBusKeyEvent(FcitxInputContextProxy *proxy, QWindow *window,
+                          const FcitxKeyEventData &key);
+    // Send the key through the IPC worker. While the worker has keys of the
+    // input context, later keys wait for a free slot instead of overtaking
+    // them, false means the key takes the regular path.
+    bool sendThreadedKeyEvent(FcitxInputContextProxy *proxy, QWindow *window,
+                              const FcitxKeyEventData &key);
+    bool startThreadedKeyEvent(FcitxInputContextProxy *proxy, QWindow *window,
+                               const FcitxKeyEventData &key);
+    void sendWaitingKeys(FcitxQtICData &data);
 
     FcitxWatcher *m_watcher;
     QString m_preedit;
     QString m_commitPreedit;
-    FcitxFormattedPreeditList m_preeditList;
+    FcitxFormattedPreeditText m_preeditText;
     int m_cursorPos;
     bool m_useSurroundingText;
     bool m_syncMode;
+    bool m_useSharedMemory;
+    bool m_clientSideControlState;
+    bool m_suppressKeyRelease;
+    int m_surroundingTextLimit;
+    int m_keyDeadline;
+    int m_earlyInputTimeout;
+    bool m_clientSideUI;
+    bool m_passwordFastPath;
+    // Keys waiting for reply before autorepeat is merged, 0 disables it.
+    int m_autoRepeatBacklog;
     QString m_lastSurroundingText;
     int m_lastSurroundingAnchor = 0;
     int m_lastSurroundingCursor = 0;
     std::unordered_map<QWindow *, FcitxQtICData> m_icMap;
     QPointer<QWindow> m_lastWindow;
     QPointer<QObject> m_lastObject;
+    // Focus object m_imEnabled and m_imHints belong to, cleared on focus
+    // change and on update(Qt::ImEnabled) or update(Qt::ImHints).
+    QPointer<QObject> m_imEnabledObject;
+    Qt::InputMethodHints m_imHints;
+    bool m_imEnabled = false;
+    // Focus is in a password field and keys are handled locally.
+    bool m_passwordFocus = false;
     bool m_destroy;
     QScopedPointer<struct xkb_context, XkbContextDeleter> m_xkbContext;
     QScopedPointer<struct xkb_compose_table, XkbComposeTableDeleter>
         m_xkbComposeTable;
     QScopedPointer<struct xkb_compose_state, XkbComposeStateDeleter>
         m_xkbComposeState;
+    bool m_xkbComposeLoaded = false;
     QLocale m_locale;
+    // Created on first use, only with client-side-ui.
+    QScopedPointer<FcitxCandidateWindow> m_candidateWindow;
+    FcitxFlightRecorder *m_recorder;
+    // Only with FCITX_QT_RECORD.
+    QScopedPointer<FcitxSessionRecorder> m_sessionRecorder;
+    FcitxPolicy *m_policy;
+    FcitxICScheduler *m_icScheduler;
+    FcitxOutboundQueue *m_outboundQueue;
+    QElapsedTimer m_uptime;
+    quint32 m_keySerial = 0;
+    QThread *m_ipcThread = nullptr;
+    FcitxIPCWorker *m_ipcWorker = nullptr;
+    quint64 m_ipcRequestId = 0;
+    // Indexed by request id, a slot still in use makes the key wait in
+    // FcitxQtICData::waitingKeys.
+    std::array<FcitxThreadedKeyEvent, FcitxIPCWorker::MaxInFlight>
+        m_threadedKeys;
+    // Keys waiting for a slot in all input contexts, so m_icMap is only
+    // walked when there are some.
+    size_t m_waitingKeys = 0;
+    // Expired keys whose input context drops fcitx's actions until the Reset
+    // sent for them is answered.
+    std::vector<std::pair<quint64, QPointer<FcitxInputContextProxy>>>
+        m_expiredKeys;
 private Q_SLOTS:
-    void processKeyEventFinished(QDBusPendingCallWatcher *);
+    void processKeyEventFinished(bool processed, bool isError);
+    void processKeyEventSharedFinished(quint32 serial, bool processed);
+    void sharedMemoryTransportClosed();
+    void processIPCResults();
+    void applyPolicy();
 };
 
 #endif // QFCITXPLATFORMINPUTCONTEXT_H
@@ -0,0 +1 @@
+../../qt5/dbusproxygen/fcitxdbusproxygen.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxcandidatewindow.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxcandidatewindow.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxflightrecorder.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxflightrecorder.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxicscheduler.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxicscheduler.h
\ No newline at end of file
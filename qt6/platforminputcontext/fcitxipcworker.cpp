@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxipcworker.cpp
\ No newline at end of file
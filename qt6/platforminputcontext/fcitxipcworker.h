@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxipcworker.h
\ No newline at end of file
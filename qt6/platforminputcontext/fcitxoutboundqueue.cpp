@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxoutboundqueue.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxoutboundqueue.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxpolicy.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxpolicy.h
\ No newline at end of file
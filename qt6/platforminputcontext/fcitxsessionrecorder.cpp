@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxsessionrecorder.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxsessionrecorder.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxshmtransport.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxshmtransport.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../qt5/platforminputcontext/fcitxspscqueue.h
\ No newline at end of file